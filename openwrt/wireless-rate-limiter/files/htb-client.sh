@@ -6,39 +6,67 @@ INTERFACE="$3"
 MAC_ADDRESS="$4"
 DOWNSPEED="$5"
 UPSPEED="$6"
+DOWNGUARANTEE="$7"
+UPGUARANTEE="$8"
 IFB_INTERFACE="$INTERFACE-ifb"
 
+# Members of a group are shaped within the trees of the group
+GROUP="$9"
+SLOT="${10}"
+
+# Filter node, the class of a client roamed within the group stays in the slot it was created in
+NODE="${11:-$(($2 & 0xfff))}"
+
+# Slot and node of the filters a roamed client takes over
+FROM_SLOT="${12}"
+FROM_NODE="${13}"
+
 . /lib/wireless-rate-limiter/htb-shared.sh
 
+if [ -n "$GROUP" ]; then
+	INTERFACE="$GROUP-gdn"
+	IFB_INTERFACE="$GROUP-gup"
+	group_slot_use "$((ID >> GROUP_SLOT_SHIFT))"
+	group_table_use "$SLOT"
+fi
+
 function mac_filter_policy_add() {
 	local iface
+	local class_id
 	local filter_id
 	local direction
 	local mac
 	
 	iface="$1"
-	filter_id="$2"
-	direction="$3"
-	mac="$4"
+	class_id="$2"
+	filter_id="$3"
+	direction="$4"
+	mac="$5"
 
 	local flow_id
+	local filter_bucket
 	local filter_handle
 
-	flow_id="1:${filter_id}"
-	filter_handle="800::${filter_id}"
+	# Node ids are local to the table of the slot
+	flow_id="1:$(tc_id "$class_id")"
+	filter_id="$(tc_id "$filter_id")"
+	filter_bucket="${U32_TABLE}:$(u32_bucket "$mac"):"
+	filter_handle="${filter_bucket}${filter_id}"
 	
-	tc filter add dev "$iface" protocol all parent 1: prio 1 handle "$filter_handle" u32 match ether "$direction" "$mac" flowid "$flow_id"
+	tc filter add dev "$iface" protocol all parent 1: prio 1 handle "$filter_handle" u32 ht "$filter_bucket" match ether "$direction" "$mac" flowid "$flow_id"
 }
 
 function mac_filter_policy_remove() {
 	local iface
 	local filter_id
+	local mac
 	
 	iface="$1"
 	filter_id="$2"
+	mac="$3"
 
 	local filter_handle
-	filter_handle="800::${filter_id}"
+	filter_handle="${U32_TABLE}:$(u32_bucket "$mac"):$(tc_id "$filter_id")"
 
 	tc filter del dev "$iface" protocol all parent 1: prio 1 handle "$filter_handle" u32
 }
@@ -50,6 +78,8 @@ function set_client_policy() {
 	local mac
 	local rate_down
 	local rate_up
+	local guarantee_down
+	local guarantee_up
 	
 	id="$1"
 	iface="$2"
@@ -57,15 +87,17 @@ function set_client_policy() {
 	mac="$4"
 	rate_down="$5"
 	rate_up="$6"
+	guarantee_down="$7"
+	guarantee_up="$8"
 
 	if [ -n "$rate_down" ]; then
-		qdisc_add_child $iface $id "$rate_down"
-		mac_filter_policy_add $iface $id "dst" "$mac"
+		qdisc_add_child $iface $id "$rate_down" "$guarantee_down"
+		mac_filter_policy_add $iface $id "$NODE" "dst" "$mac"
 	fi
 
 	if [ -n "$rate_up" ]; then
-		qdisc_add_child $ifbdev $id "$rate_up"
-		mac_filter_policy_add $ifbdev $id "src" "$mac"
+		qdisc_add_child $ifbdev $id "$rate_up" "$guarantee_up"
+		mac_filter_policy_add $ifbdev $id "$NODE" "src" "$mac"
 	fi
 }
 
@@ -80,15 +112,31 @@ function remove_client_policy() {
 	ifbdev="$3"
 	mac="$4"
 	
-	mac_filter_policy_remove $iface $id
+	mac_filter_policy_remove $iface "$NODE" "$mac"
 	qdisc_remove_child $iface $id
-	mac_filter_policy_remove $ifbdev $id
+	mac_filter_policy_remove $ifbdev "$NODE" "$mac"
 	qdisc_remove_child $ifbdev $id
 }
 
 if [ "$ACTION" = "add" ]; then
 	remove_client_policy "$ID" "$INTERFACE" "$IFB_INTERFACE" "$MAC_ADDRESS"
-	set_client_policy "$ID" "$INTERFACE" "$IFB_INTERFACE" "$MAC_ADDRESS" "$DOWNSPEED" "$UPSPEED"
+	set_client_policy "$ID" "$INTERFACE" "$IFB_INTERFACE" "$MAC_ADDRESS" "$DOWNSPEED" "$UPSPEED" "$DOWNGUARANTEE" "$UPGUARANTEE"
+elif [ "$ACTION" = "update" ]; then
+	# Filters and leaf qdiscs stay in place
+	class_set_child "$INTERFACE" "$ID" "$DOWNSPEED" "$DOWNGUARANTEE"
+	class_set_child "$IFB_INTERFACE" "$ID" "$UPSPEED" "$UPGUARANTEE"
+elif [ "$ACTION" = "move" ]; then
+	# Both filters lead to the same class while the old ones go, class and queue stay in place
+	mac_filter_policy_remove "$INTERFACE" "$NODE" "$MAC_ADDRESS"
+	mac_filter_policy_remove "$IFB_INTERFACE" "$NODE" "$MAC_ADDRESS"
+	mac_filter_policy_add "$INTERFACE" "$ID" "$NODE" "dst" "$MAC_ADDRESS"
+	mac_filter_policy_add "$IFB_INTERFACE" "$ID" "$NODE" "src" "$MAC_ADDRESS"
+	class_set_child "$INTERFACE" "$ID" "$DOWNSPEED" "$DOWNGUARANTEE"
+	class_set_child "$IFB_INTERFACE" "$ID" "$UPSPEED" "$UPGUARANTEE"
+
+	group_table_use "$FROM_SLOT"
+	mac_filter_policy_remove "$INTERFACE" "$FROM_NODE" "$MAC_ADDRESS"
+	mac_filter_policy_remove "$IFB_INTERFACE" "$FROM_NODE" "$MAC_ADDRESS"
 elif [ "$ACTION" = "remove" ]; then
 	remove_client_policy "$ID" "$INTERFACE" "$IFB_INTERFACE" "$MAC_ADDRESS"
 fi
\ No newline at end of file
@@ -0,0 +1,70 @@
+#!/bin/sh
+
+. /lib/wireless-rate-limiter/htb-shared.sh
+
+ACTION="$1"
+GROUP="$2"
+
+# How much all clients of the member interfaces are allowed to download
+DOWNSPEED="$3"
+# How much all clients of the member interfaces are allowed to upload
+UPSPEED="$4"
+
+# Member interfaces redirect their traffic in both directions
+DOWN_INTERFACE="$GROUP-gdn"
+UP_INTERFACE="$GROUP-gup"
+
+function group_add() {
+	local interface
+	local speed
+
+	interface="$1"
+	speed="$2"
+
+	if [ -z "$speed" ]; then
+		speed="1000mbit"
+	fi
+
+	ip link add "$interface" type ifb
+	ip link set "$interface" up
+
+	# Unknown clients of all members share the default class
+	tc qdisc add dev "$interface" root handle 1: htb default 2
+	tc class add dev "$interface" parent 1: classid 1:1 htb rate "$speed" burst 128k quantum 8192
+	qdisc_add_child "$interface" 2 "$speed"
+}
+
+function group_update() {
+	local interface
+	local speed
+
+	interface="$1"
+	speed="$2"
+
+	if [ -z "$speed" ]; then
+		speed="1000mbit"
+	fi
+
+	tc class replace dev "$interface" parent 1: classid 1:1 htb rate "$speed" burst 128k quantum 8192
+	class_set_child "$interface" 2 "$speed"
+}
+
+function group_remove() {
+	# Trees of the members go with the IFBs
+	ip link del "$DOWN_INTERFACE"
+	ip link del "$UP_INTERFACE"
+}
+
+if [ "$ACTION" = "add" ]; then
+	group_remove
+	group_add "$DOWN_INTERFACE" "$DOWNSPEED"
+	group_add "$UP_INTERFACE" "$UPSPEED"
+	exit 0
+elif [ "$ACTION" = "update" ]; then
+	group_update "$DOWN_INTERFACE" "$DOWNSPEED"
+	group_update "$UP_INTERFACE" "$UPSPEED"
+	exit 0
+elif [ "$ACTION" = "remove" ]; then
+	group_remove
+	exit 0
+fi
@@ -13,12 +13,18 @@ UPSPEED="$4"
 IFB_INTERFACE="$INTERFACE-ifb"
 IFB_PRIORITY=512
 
+# Members of a group are shaped within the trees of the group, created by htb-group.sh
+GROUP="$5"
+SLOT="$6"
+
 function qdisc_add() {
 	local interface
 	local speed
+	local hashkey
 	
 	interface="$1"
 	speed="$2"
+	hashkey="$3"
 
 	if [ -z "$speed" ]; then
 		speed="1000mbit"
@@ -27,6 +33,25 @@ function qdisc_add() {
 	tc qdisc add dev "$interface" root handle 1: htb default 2
 	tc class add dev "$interface" parent 1: classid 1:1 htb rate "$speed" burst 128k quantum 8192
 	qdisc_add_child "$interface" 2 "$speed"
+
+	# Hash clients by the last byte of their address, a packet probes a single bucket
+	tc filter add dev "$interface" protocol all parent 1: prio 1 handle "${U32_TABLE}:" u32 divisor "$U32_BUCKETS"
+	tc filter add dev "$interface" protocol all parent 1: prio 1 handle 800::1 u32 match u32 0 0 hashkey $hashkey link "${U32_TABLE}:"
+}
+
+function qdisc_update() {
+	local interface
+	local speed
+
+	interface="$1"
+	speed="$2"
+
+	if [ -z "$speed" ]; then
+		speed="1000mbit"
+	fi
+
+	tc class replace dev "$interface" parent 1: classid 1:1 htb rate "$speed" burst 128k quantum 8192
+	class_set_child "$interface" 2 "$speed"
 }
 
 function qdisc_remove() {
@@ -42,11 +67,77 @@ function qdisc_remove() {
 	# Delete Intermediate Functional Block
 	# Implicitly deletes the Queueing Discipline (Towards the interface)
 	tc filter del dev "$interface" ingress protocol all prio "$IFB_PRIORITY"
+	tc filter del dev "$interface" egress protocol all prio "$IFB_PRIORITY"
 	ip link set "$ifb_interface" down
 	ip link del "$ifb_interface"
 }
 
-if [ "$ACTION" = "add" ]; then
+function member_add() {
+	local interface
+	local speed
+	local hashkey
+
+	interface="$1"
+	speed="$2"
+	hashkey="$3"
+
+	if [ -z "$speed" ]; then
+		speed="1000mbit"
+	fi
+
+	# Root of the slot beneath the group root, unknown clients use the group default class
+	tc class add dev "$interface" parent 1:1 classid "$CLASS_PARENT" htb rate "$speed" burst 128k quantum 8192
+	# Kept by earlier members of the slot
+	tc filter add dev "$interface" protocol all parent 1: prio 1 handle "${U32_TABLE}:" u32 divisor "$U32_BUCKETS" 2>/dev/null
+	tc filter add dev "$interface" protocol all parent 1: prio 1 handle "800::${U32_TABLE}" u32 match u32 0 0 hashkey $hashkey link "${U32_TABLE}:" 2>/dev/null
+}
+
+function member_flush() {
+	local interface
+	local base
+	local classid
+	local minor
+
+	interface="$1"
+	base="$((SLOT << GROUP_SLOT_SHIFT))"
+
+	# Filters hold a reference to the classes, table and link stay for the next member
+	tc filter show dev "$interface" parent 1: | sed -n "s/.* fh \(${U32_TABLE}:[0-9a-f]*:[0-9a-f]*\) .*/\1/p" | while read -r handle; do
+		tc filter del dev "$interface" protocol all parent 1: prio 1 handle "$handle" u32
+	done
+
+	# Classes left by an earlier member of the slot, clients before the root
+	tc class show dev "$interface" | while read -r _ _ classid _; do
+		minor="$((0x${classid#1:}))"
+		[ "$minor" -ge "$base" ] && [ "$minor" -lt "$((base + (1 << GROUP_SLOT_SHIFT)))" ] && echo "$minor"
+	done | sort -rn | while read -r minor; do
+		tc class del dev "$interface" classid "1:$(tc_id "$minor")"
+	done
+}
+
+if [ -n "$GROUP" ]; then
+	group_slot_use "$SLOT"
+
+	if [ "$ACTION" = "add" ] || [ "$ACTION" = "remove" ]; then
+		qdisc_remove "$INTERFACE" "$IFB_INTERFACE"
+		member_flush "$GROUP-gdn"
+		member_flush "$GROUP-gup"
+	fi
+
+	if [ "$ACTION" = "add" ]; then
+		member_add "$GROUP-gdn" "$DOWNSPEED" "mask 0x000000ff at -12"
+		member_add "$GROUP-gup" "$UPSPEED" "mask 0x00ff0000 at -4"
+
+		# Redirect traffic of both directions to the group
+		tc qdisc add dev "$INTERFACE" clsact
+		tc filter add dev "$INTERFACE" egress protocol all prio "$IFB_PRIORITY" matchall action mirred egress redirect dev "$GROUP-gdn"
+		tc filter add dev "$INTERFACE" ingress protocol all prio "$IFB_PRIORITY" matchall action mirred egress redirect dev "$GROUP-gup"
+	elif [ "$ACTION" = "update" ]; then
+		tc class replace dev "$GROUP-gdn" parent 1:1 classid "$CLASS_PARENT" htb rate "${DOWNSPEED:-1000mbit}" burst 128k quantum 8192
+		tc class replace dev "$GROUP-gup" parent 1:1 classid "$CLASS_PARENT" htb rate "${UPSPEED:-1000mbit}" burst 128k quantum 8192
+	fi
+	exit 0
+elif [ "$ACTION" = "add" ]; then
 	# Delete existing configuration
 	qdisc_remove "$INTERFACE" "$IFB_INTERFACE"
 
@@ -59,10 +150,17 @@ if [ "$ACTION" = "add" ]; then
 	tc filter add dev "$INTERFACE" ingress protocol all prio "$IFB_PRIORITY" matchall action mirred egress redirect dev "$IFB_INTERFACE"
 
 	# Create Queueing Discipline (Towards the interface)
-	qdisc_add "$INTERFACE" "$DOWNSPEED"
+	# Destination address, last byte at -9
+	qdisc_add "$INTERFACE" "$DOWNSPEED" "mask 0x000000ff at -12"
 
 	# Create Queueing Discipline (From the interface)
-	qdisc_add "$IFB_INTERFACE" "$UPSPEED"
+	# Source address, last byte at -3
+	qdisc_add "$IFB_INTERFACE" "$UPSPEED" "mask 0x00ff0000 at -4"
+	exit 0
+elif [ "$ACTION" = "update" ]; then
+	# Client classes and filters stay in place
+	qdisc_update "$INTERFACE" "$DOWNSPEED"
+	qdisc_update "$IFB_INTERFACE" "$UPSPEED"
 	exit 0
 elif [ "$ACTION" = "remove" ]; then
 	qdisc_remove "$INTERFACE" "$IFB_INTERFACE"
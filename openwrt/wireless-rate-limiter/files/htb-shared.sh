@@ -1,16 +1,51 @@
-function qdisc_add_child() {
+# tc parses class-ids as hexadecimal, the daemon passes decimal ids
+function tc_id() {
+	printf '%x' "$1"
+}
+
+# Client filters are placed in u32 table 1: bucketed by the last address byte
+U32_TABLE=1
+U32_BUCKETS=256
+
+# Parent of client classes, members of a group use the root class of their slot
+CLASS_PARENT=1:1
+
+# Members of a group get the class-ids (slot << 12) onwards and u32 table slot + 1
+GROUP_SLOT_SHIFT=12
+
+function group_slot_use() {
+	local slot
+
+	slot="$1"
+
+	group_table_use "$slot"
+	CLASS_PARENT="1:$(tc_id "$(((slot << GROUP_SLOT_SHIFT) | 1))")"
+}
+
+# Filters of a client roamed within the group are in another slot than its class
+function group_table_use() {
+	U32_TABLE="$(tc_id "$(($1 + 1))")"
+}
+
+function u32_bucket() {
+	echo "${1##*:}"
+}
+
+# Creates or changes the class in place, the guaranteed rate defaults to 1mbit
+function class_set_child() {
 	local interface
 	local id
+	local tcid
 	local ceil
+	local rate
 	local htb_burst
-	local fq_flows
-	local fq_packets
-	
+
 	interface="$1"
 	id="$2"
 	ceil="$3"
+	rate="${4:-1mbit}"
+	tcid="$(tc_id "$id")"
 
-	ceil=""
 	if [ -n "$ceil" ]; then
 		ceil="ceil $ceil"
 	fi
@@ -20,6 +55,22 @@ function qdisc_add_child() {
 		htb_burst=16k
 	fi
 
+	tc class replace dev "$interface" parent "$CLASS_PARENT" classid "1:$tcid" htb rate "$rate" $ceil burst "$htb_burst" prio 1 quantum 4096
+}
+
+function qdisc_add_child() {
+	local interface
+	local id
+	local tcid
+	local fq_flows
+	local fq_packets
+	
+	interface="$1"
+	id="$2"
+	tcid="$(tc_id "$id")"
+
+	class_set_child "$interface" "$id" "$3" "$4"
+
 	fq_flows=1024
 	if [ "$id" -gt "9" ]; then
 		fq_flows=64
@@ -30,17 +81,16 @@ function qdisc_add_child() {
 		fq_packets=1024
 	fi
 
-	tc class replace dev "$interface" parent 1:1 classid "1:$id" htb rate 1mbit $ceil burst "$htb_burst" prio 1 quantum 4096
-	tc qdisc replace dev "$interface" parent "1:$id" handle "$id:" fq_codel flows "$fq_flows" limit "$fq_packets" noecn
+	tc qdisc replace dev "$interface" parent "1:$tcid" handle "$tcid:" fq_codel flows "$fq_flows" limit "$fq_packets" noecn
 }
 
 function qdisc_remove_child() {
 	local interface
-	local id
+	local tcid
 	
 	interface="$1"
-	id="$2"
+	tcid="$(tc_id "$2")"
 	
-	tc class del dev "$interface" parent 1:1 classid "1:$id"
-	tc qdisc del dev "$interface" parent "1:$id" handle "$id:"
+	tc class del dev "$interface" parent "$CLASS_PARENT" classid "1:$tcid"
+	tc qdisc del dev "$interface" parent "1:$tcid" handle "$tcid:"
 }
@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <net/if.h>
+#include <linux/genetlink.h>
+#include <linux/nl80211.h>
+
+#include "airtime.h"
+#include "log.h"
+#include "netlink.h"
+#include "stats.h"
+
+static struct wrl_nl genl = {
+	.fd = -1,
+};
+
+static uint16_t nl80211_id;
+
+/* Failed family lookups are cached instead of repeated for every station */
+#define WRL_AIRTIME_LOOKUP_INTERVAL (60 * 1000 * 1000)
+
+static struct {
+	uint64_t retry_at;
+	int ret;
+} lookup;
+
+static int
+wrl_airtime_family_cb(struct nlmsghdr *nlh, void *priv)
+{
+	struct genlmsghdr *ghdr = NLMSG_DATA(nlh);
+	struct nlattr *tb[CTRL_ATTR_MAX + 1];
+	int len;
+
+	len = nlh->nlmsg_len - NLMSG_SPACE(GENL_HDRLEN);
+	if (len < 0)
+		return 0;
+
+	wrl_nl_attr_parse(tb, CTRL_ATTR_MAX, (uint8_t *)ghdr + GENL_HDRLEN, len);
+	if (!tb[CTRL_ATTR_FAMILY_NAME] || !tb[CTRL_ATTR_FAMILY_ID] ||
+	    strcmp(wrl_nl_attr_data(tb[CTRL_ATTR_FAMILY_NAME]), NL80211_GENL_NAME))
+		return 0;
+
+	nl80211_id = *(uint16_t *)wrl_nl_attr_data(tb[CTRL_ATTR_FAMILY_ID]);
+
+	return 0;
+}
+
+static int
+wrl_airtime_open(void)
+{
+	struct genlmsghdr *ghdr;
+	struct wrl_nl_msg msg;
+	int ret;
+
+	if (lookup.retry_at && wrl_stats_now() < lookup.retry_at)
+		return lookup.ret;
+
+	ret = wrl_nl_open(&genl, NETLINK_GENERIC);
+	if (ret)
+		goto out;
+
+	/* Resolve the nl80211 family once, it is stable while the module is loaded */
+	ghdr = wrl_nl_msg_init(&msg, GENL_ID_CTRL, 0, GENL_HDRLEN);
+	ghdr->cmd = CTRL_CMD_GETFAMILY;
+	ghdr->version = 1;
+
+	ret = wrl_nl_dump(&genl, &msg, wrl_airtime_family_cb, NULL);
+	/* No cfg80211 in this kernel */
+	if (!ret && !nl80211_id)
+		ret = -EOPNOTSUPP;
+
+	if (ret) {
+		MSG(ERROR, "Failed to resolve nl80211 family (%d)\n", ret);
+		wrl_nl_close(&genl);
+	}
+
+out:
+	lookup.ret = ret;
+	lookup.retry_at = ret ? wrl_stats_now() + WRL_AIRTIME_LOOKUP_INTERVAL : 0;
+
+	return ret;
+}
+
+int
+wrl_airtime_set(const char *ifname, const uint8_t *mac, uint16_t weight)
+{
+	struct genlmsghdr *ghdr;
+	struct wrl_nl_msg msg;
+	int ifindex;
+	int ret;
+
+	if (genl.fd < 0) {
+		ret = wrl_airtime_open();
+		if (ret)
+			return ret;
+	}
+
+	ifindex = if_nametoindex(ifname);
+	if (!ifindex)
+		return -ENODEV;
+
+	ghdr = wrl_nl_msg_init(&msg, nl80211_id, 0, GENL_HDRLEN);
+	ghdr->cmd = NL80211_CMD_SET_STATION;
+
+	wrl_nl_attr_put_u32(&msg, NL80211_ATTR_IFINDEX, ifindex);
+	wrl_nl_attr_put(&msg, NL80211_ATTR_MAC, mac, 6);
+	wrl_nl_attr_put_u16(&msg, NL80211_ATTR_AIRTIME_WEIGHT, weight ? weight : WRL_AIRTIME_WEIGHT_DEFAULT);
+
+	return wrl_nl_request(&genl, &msg);
+}
+
+void
+wrl_airtime_close(void)
+{
+	wrl_nl_close(&genl);
+	nl80211_id = 0;
+	memset(&lookup, 0, sizeof(lookup));
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/* Weight of stations without a configured one, as assigned by mac80211 */
+#define WRL_AIRTIME_WEIGHT_DEFAULT 256
+
+/* Set the airtime weight of a station, 0 restores the default */
+int wrl_airtime_set(const char *ifname, const uint8_t *mac, uint16_t weight);
+void wrl_airtime_close(void);
@@ -0,0 +1,687 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <libubox/uloop.h>
+
+#include "airtime.h"
+#include "backend.h"
+#include "client.h"
+#include "group.h"
+#include "interface.h"
+#include "log.h"
+#include "roam.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "wrl.h"
+
+#define WRL_APPLY_RETRY_INTERVAL 1000
+
+/* Failed operations back off from the retry interval up to this limit in ms */
+#define WRL_APPLY_RETRY_MAX 60000
+
+/* Operations per transaction, remaining work follows in the next one */
+#define WRL_APPLY_MAX_OPS 256
+
+struct wrl_apply_work {
+	enum wrl_apply_priority priority;
+	enum wrl_op_type type;
+	struct wrl_group *group;
+	struct wrl_interface *interface;
+	struct wrl_client *client;
+};
+
+/* Work found by an apply, kept allocated between transactions */
+static struct {
+	struct wrl_apply_work *work;
+	uint32_t size;
+	uint32_t num;
+} wrl_apply_queue;
+
+void
+wrl_schedule_apply(struct wrl_data *wrl, int timeout)
+{
+	/* Don't postpone an earlier pending apply */
+	if (wrl->apply.pending && uloop_timeout_remaining(&wrl->apply) <= timeout)
+		return;
+
+	uloop_timeout_set(&wrl->apply, timeout);
+}
+
+static struct wrl_op *
+wrl_rate_op_add(struct list_head *ops, enum wrl_op_type type, struct wrl_group *group,
+		struct wrl_interface *interface, struct wrl_client *client)
+{
+	struct wrl_op *op;
+
+	op = calloc(1, sizeof(*op));
+	if (!op) {
+		MSG(ERROR, "Failed to allocate memory for operation\n");
+		return NULL;
+	}
+
+	op->type = type;
+
+	if (group) {
+		strncpy(op->group.name, group->name, sizeof(op->group.name) - 1);
+		op->rate = group->rate;
+
+		/* Group must stay allocated until the result is known */
+		group->pending = 1;
+		list_add_tail(&op->head, ops);
+		return op;
+	}
+
+	strncpy(op->interface, interface->name, sizeof(op->interface) - 1);
+
+	/* Trees are removed from where they are, everything else goes where configured */
+	op->group = type == WRL_OP_INTERFACE_REMOVE ? interface->kernel_group : interface->group;
+
+	if (client) {
+		op->rate = client->rate;
+		op->guarantee = client->guarantee;
+		op->client_id = client->id;
+		op->home = client->home;
+		op->from = client->from;
+		op->airtime_weight = client->airtime.weight;
+		memcpy(op->address, client->address, sizeof(op->address));
+
+		/* Client must stay allocated until the result is known */
+		client->pending = 1;
+	} else {
+		op->rate = interface->rate;
+	}
+
+	list_add_tail(&op->head, ops);
+
+	return op;
+}
+
+static void
+wrl_rate_backoff_failed(struct wrl_backoff *backoff)
+{
+	uint64_t interval = WRL_APPLY_RETRY_INTERVAL;
+	int i;
+
+	if (backoff->failures < UINT8_MAX)
+		backoff->failures++;
+
+	for (i = 1; i < backoff->failures && interval < WRL_APPLY_RETRY_MAX; i++)
+		interval *= 2;
+	if (interval > WRL_APPLY_RETRY_MAX)
+		interval = WRL_APPLY_RETRY_MAX;
+
+	backoff->retry_at = wrl_stats_now() + interval * 1000;
+}
+
+static void
+wrl_rate_backoff_reset(struct wrl_backoff *backoff)
+{
+	backoff->failures = 0;
+	backoff->retry_at = 0;
+}
+
+static int
+wrl_rate_backoff_active(struct wrl_data *wrl, struct wrl_backoff *backoff, uint64_t now, uint64_t *next_retry)
+{
+	if (backoff->retry_at <= now)
+		return 0;
+
+	wrl->queue.deferred++;
+	if (!*next_retry || backoff->retry_at < *next_retry)
+		*next_retry = backoff->retry_at;
+	return 1;
+}
+
+static void
+wrl_rate_work_queue(struct wrl_data *wrl, enum wrl_apply_priority priority, enum wrl_op_type type,
+		    struct wrl_group *group, struct wrl_interface *interface, struct wrl_client *client)
+{
+	struct wrl_apply_work *work;
+	uint32_t size;
+
+	if (wrl_apply_queue.num == wrl_apply_queue.size) {
+		size = wrl_apply_queue.size ? wrl_apply_queue.size * 2 : 64;
+		work = realloc(wrl_apply_queue.work, size * sizeof(*work));
+		if (!work) {
+			/* Still unapplied, found again by the next apply */
+			MSG(ERROR, "Failed to allocate memory for shaping work\n");
+			return;
+		}
+
+		wrl_apply_queue.work = work;
+		wrl_apply_queue.size = size;
+	}
+
+	work = &wrl_apply_queue.work[wrl_apply_queue.num++];
+	work->priority = priority;
+	work->type = type;
+	work->group = group;
+	work->interface = interface;
+	work->client = client;
+	wrl->queue.pending[priority]++;
+}
+
+static void
+wrl_rate_work_add(struct wrl_data *wrl, enum wrl_apply_priority priority, enum wrl_op_type type,
+		  struct wrl_interface *interface, struct wrl_client *client)
+{
+	wrl_rate_work_queue(wrl, priority, type, NULL, interface, client);
+}
+
+static void
+wrl_rate_work_log(struct wrl_apply_work *work)
+{
+	struct wrl_interface *interface = work->interface;
+	struct wrl_client *client = work->client;
+
+	if (work->group) {
+		MSG(INFO, "%s limits for group %s rx=%dkbit/s tx=%dkbit/s\n",
+		    work->type == WRL_OP_GROUP_REMOVE ? "Purge" : "Applying rate for",
+		    work->group->name, work->group->rate.down, work->group->rate.up);
+		return;
+	}
+
+	if (!client) {
+		MSG(INFO, "%s limits for interface %s rx=%dkbit/s tx=%dkbit/s\n",
+		    work->type == WRL_OP_INTERFACE_REMOVE ? "Purge" : "Applying rate for",
+		    interface->name, interface->rate.down, interface->rate.up);
+		return;
+	}
+
+	if (work->type == WRL_OP_CLIENT_AIRTIME) {
+		MSG(INFO, "Applying airtime weight %u for client %02x:%02x:%02x:%02x:%02x:%02x\n",
+		    client->airtime.weight ? client->airtime.weight : WRL_AIRTIME_WEIGHT_DEFAULT,
+		    client->address[0], client->address[1], client->address[2],
+		    client->address[3], client->address[4], client->address[5]);
+		return;
+	}
+
+	if (work->type == WRL_OP_CLIENT_MOVE) {
+		MSG(INFO, "Moving rate of roamed client %02x:%02x:%02x:%02x:%02x:%02x to %s, rx=%dkbit/s, tx=%dkbit/s\n",
+		    client->address[0], client->address[1], client->address[2],
+		    client->address[3], client->address[4], client->address[5],
+		    interface->name, client->rate.down, client->rate.up);
+		return;
+	}
+
+	if (!client->connected) {
+		MSG(INFO, "Removing rate for departed client %02x:%02x:%02x:%02x:%02x:%02x\n",
+		    client->address[0], client->address[1], client->address[2],
+		    client->address[3], client->address[4], client->address[5]);
+		return;
+	}
+
+	MSG(INFO, "Applying rate for client %02x:%02x:%02x:%02x:%02x:%02x, rx=%dkbit/s, tx=%dkbit/s\n",
+	    client->address[0], client->address[1], client->address[2],
+	    client->address[3], client->address[4], client->address[5],
+	    client->rate.down, client->rate.up);
+}
+
+static void
+wrl_rate_interface_reset(struct wrl_data *wrl, struct wrl_interface *interface)
+{
+	struct wrl_client *client, *tmp;
+
+	/* Rebuilding or removing the root qdisc dropped all client classes */
+	wrl_client_for_each_safe(client, tmp, &interface->clients) {
+		/* Roamed clients on other members lost their class as well */
+		if (client->lent)
+			wrl->apply_postponed = 1;
+
+		memset(&client->from, 0, sizeof(client->from));
+		memset(&client->home, 0, sizeof(client->home));
+		client->roamed = 0;
+		client->lent = 0;
+		client->installed = 0;
+		if (!client->connected && !client->pending)
+			wrl_client_free(&interface->clients, client);
+	}
+}
+
+static int
+wrl_rate_group_op_complete(struct wrl_data *wrl, struct wrl_op *op)
+{
+	struct wrl_interface *interface;
+	struct wrl_group *group;
+
+	group = wrl_group_get(wrl, op->group.name);
+	if (!group)
+		return 0;
+
+	group->pending = 0;
+
+	if (op->ret) {
+		wrl_stats.counters.op_failures++;
+		MSG(ERROR, "Failed to apply rate for group %s (%d)\n", op->group.name, op->ret);
+
+		/* Trees in unknown state, rebuild them on retry */
+		if (op->type == WRL_OP_GROUP_UPDATE)
+			group->installed = 0;
+		wrl_rate_backoff_failed(&group->backoff);
+		return op->ret;
+	}
+
+	wrl_rate_backoff_reset(&group->backoff);
+
+	group->installed = op->type != WRL_OP_GROUP_REMOVE;
+	group->kernel_rate = op->rate;
+	if (op->rate.down == group->rate.down && op->rate.up == group->rate.up)
+		group->rate.applied = 1;
+
+	if (op->type == WRL_OP_GROUP_UPDATE)
+		return 0;
+
+	/* Recreated trees lost the classes of all members */
+	list_for_each_entry(interface, &wrl->interfaces, head) {
+		if (!interface->kernel_group.slot ||
+		    strncmp(interface->kernel_group.name, op->group.name, sizeof(op->group.name)))
+			continue;
+
+		wrl_rate_interface_reset(wrl, interface);
+		memset(&interface->kernel_group, 0, sizeof(interface->kernel_group));
+		interface->installed = 0;
+	}
+
+	return 0;
+}
+
+static int
+wrl_rate_airtime_complete(struct wrl_interface *interface, struct wrl_client *client, struct wrl_op *op)
+{
+	if (op->ret == -EOPNOTSUPP) {
+		MSG(ERROR, "Airtime weights are not supported on interface %s\n", interface->name);
+		interface->airtime_unsupported = 1;
+	} else if (op->ret && op->ret != -ENOENT) {
+		wrl_stats.counters.op_failures++;
+		MSG(ERROR, "Failed to apply airtime weight for client %02x:%02x:%02x:%02x:%02x:%02x on %s (%d)\n",
+		    op->address[0], op->address[1], op->address[2],
+		    op->address[3], op->address[4], op->address[5],
+		    op->interface, op->ret);
+		wrl_rate_backoff_failed(&client->airtime.backoff);
+		return op->ret;
+	}
+
+	wrl_rate_backoff_reset(&client->airtime.backoff);
+	if (op->airtime_weight == client->airtime.weight)
+		client->airtime.applied = 1;
+
+	return 0;
+}
+
+static int
+wrl_rate_op_complete(struct wrl_data *wrl, struct wrl_op *op)
+{
+	struct wrl_interface *interface;
+	struct wrl_client *client;
+
+	if (op->type == WRL_OP_GROUP_ADD || op->type == WRL_OP_GROUP_UPDATE ||
+	    op->type == WRL_OP_GROUP_REMOVE)
+		return wrl_rate_group_op_complete(wrl, op);
+
+	/* Interface vanished while the operation was in flight */
+	interface = wrl_interface_get(wrl, op->interface);
+	if (!interface)
+		return 0;
+
+	if (op->type == WRL_OP_INTERFACE_ADD || op->type == WRL_OP_INTERFACE_UPDATE ||
+	    op->type == WRL_OP_INTERFACE_REMOVE) {
+		if (op->ret) {
+			wrl_stats.counters.op_failures++;
+			MSG(ERROR, "Failed to apply rate for interface %s (%d)\n", op->interface, op->ret);
+
+			/* Tree in unknown state, rebuild it on retry */
+			if (op->type == WRL_OP_INTERFACE_UPDATE)
+				interface->installed = 0;
+			wrl_rate_backoff_failed(&interface->backoff);
+			return op->ret;
+		}
+
+		wrl_rate_backoff_reset(&interface->backoff);
+
+		if (op->type != WRL_OP_INTERFACE_UPDATE)
+			wrl_rate_interface_reset(wrl, interface);
+
+		interface->installed = op->type != WRL_OP_INTERFACE_REMOVE;
+		interface->kernel_rate = op->rate;
+		if (op->type == WRL_OP_INTERFACE_REMOVE)
+			memset(&interface->kernel_group, 0, sizeof(interface->kernel_group));
+		else
+			interface->kernel_group = op->group;
+
+		/* Configuration might have changed in the meantime */
+		if (op->type == WRL_OP_INTERFACE_REMOVE ||
+		    (op->rate.down == interface->rate.down && op->rate.up == interface->rate.up))
+			interface->rate.applied = 1;
+		return 0;
+	}
+
+	client = wrl_client_get(&interface->clients, op->address, NULL);
+	if (!client || client->id != op->client_id)
+		return 0;
+
+	client->pending = 0;
+
+	if (op->type == WRL_OP_CLIENT_AIRTIME)
+		return wrl_rate_airtime_complete(interface, client, op);
+
+	if (op->ret) {
+		wrl_stats.counters.op_failures++;
+		MSG(ERROR, "Failed to apply rate for client %02x:%02x:%02x:%02x:%02x:%02x on %s (%d)\n",
+		    op->address[0], op->address[1], op->address[2],
+		    op->address[3], op->address[4], op->address[5],
+		    op->interface, op->ret);
+
+		/* Partially added shaping is cleaned up by a later removal */
+		if (op->type == WRL_OP_CLIENT_ADD)
+			client->installed = 1;
+
+		/* Classes possibly gone, adding again removes leftovers first */
+		if (op->type == WRL_OP_CLIENT_UPDATE) {
+			client->installed = 0;
+			wrl_client_rate_applied(client, 0);
+			memset(&client->home, 0, sizeof(client->home));
+		}
+
+		/* Migration abandoned, the client gets a class of its own */
+		if (op->type == WRL_OP_CLIENT_MOVE) {
+			memset(&client->from, 0, sizeof(client->from));
+			memset(&client->home, 0, sizeof(client->home));
+			wrl_client_rate_applied(client, 0);
+		}
+		wrl_rate_backoff_failed(&client->backoff);
+		return op->ret;
+	}
+
+	wrl_rate_backoff_reset(&client->backoff);
+
+	if (op->type == WRL_OP_CLIENT_UPDATE) {
+		client->kernel_rate = op->rate;
+		if (op->rate.down == client->rate.down && op->rate.up == client->rate.up)
+			wrl_client_rate_applied(client, 1);
+		if (op->guarantee.down == client->guarantee.down && op->guarantee.up == client->guarantee.up)
+			client->guarantee.applied = 1;
+		return 0;
+	}
+
+	if (op->type == WRL_OP_CLIENT_MOVE)
+		wrl_roam_moved(wrl, op, client);
+
+	/* Last filters of a class taken over from another member */
+	if (op->type == WRL_OP_CLIENT_REMOVE && op->home.slot) {
+		memset(&client->home, 0, sizeof(client->home));
+		wrl_roam_released(wrl, op);
+	}
+
+	client->installed = op->type != WRL_OP_CLIENT_REMOVE;
+	client->kernel_rate = op->rate;
+
+	/* Departed clients are released once their shaping is gone */
+	if (!client->connected) {
+		if (!client->installed)
+			wrl_client_free(&interface->clients, client);
+		return 0;
+	}
+
+	/* Removal meant for the departure of a station associated again, it is added anew */
+	if (op->type == WRL_OP_CLIENT_REMOVE && (op->rate.down || op->rate.up)) {
+		wrl_client_rate_applied(client, 0);
+		return 0;
+	}
+
+	if (op->rate.down != client->rate.down || op->rate.up != client->rate.up)
+		return 0;
+
+	wrl_client_rate_applied(client, 1);
+
+	if (client->installed && op->guarantee.down == client->guarantee.down &&
+	    op->guarantee.up == client->guarantee.up)
+		client->guarantee.applied = 1;
+
+	/* First limit in place since the client associated */
+	if (client->connected_at && client->installed) {
+		wrl_stats_histogram_add(&interface->enforcement, wrl_stats_now() - client->connected_at);
+		client->connected_at = 0;
+	}
+	return 0;
+}
+
+static void
+wrl_rate_apply_complete(struct wrl_transaction *transaction)
+{
+	struct wrl_data *wrl = container_of(transaction, struct wrl_data, transaction);
+	struct wrl_op *op, *tmp;
+	int failed = 0;
+
+	/* Only acknowledge successful changes, failed ones are retried */
+	list_for_each_entry_safe(op, tmp, &transaction->ops, head) {
+		if (wrl_rate_op_complete(wrl, op))
+			failed = 1;
+		list_del(&op->head);
+		free(op);
+	}
+
+	wrl->transaction_pending = 0;
+	wrl->queue.in_flight = 0;
+	wrl_stats_stage_done(WRL_STATS_STAGE_APPLY, wrl->transaction_start);
+	wrl_snapshot_schedule(wrl);
+
+	/* Earliest possible retry, later backoffs are scheduled by that apply */
+	if (failed)
+		wrl_schedule_apply(wrl, WRL_APPLY_RETRY_INTERVAL);
+
+	if (wrl->full_purge == WRL_PURGE_PENDING)
+		wrl->full_purge = WRL_PURGE_DONE;
+
+	/* Changes arriving during the transaction were postponed */
+	if (wrl->apply_postponed) {
+		wrl->apply_postponed = 0;
+		wrl_schedule_apply(wrl, 0);
+	}
+}
+
+void
+wrl_rate_apply(struct wrl_data *wrl)
+{
+	struct wrl_transaction *transaction = &wrl->transaction;
+	struct wrl_interface *interface;
+	struct wrl_group *group;
+	struct wrl_client *client;
+	struct list_head *ops = &transaction->ops;
+	struct wrl_apply_work *work;
+	uint64_t now, next_retry = 0;
+	uint32_t i, budget;
+	int prio, rebuild;
+
+	/* A single transaction is in flight at any time */
+	if (wrl->transaction_pending) {
+		wrl->apply_postponed = 1;
+		return;
+	}
+
+	INIT_LIST_HEAD(ops);
+	transaction->complete = wrl_rate_apply_complete;
+
+	now = wrl_stats_now();
+	wrl_apply_queue.num = 0;
+	memset(&wrl->queue, 0, sizeof(wrl->queue));
+	wrl_group_sync(wrl);
+	wrl_roam_sync(wrl);
+
+	/* Group trees are built before and removed after the trees of their members */
+	list_for_each_entry(group, &wrl->groups, head) {
+		group->queued = 0;
+
+		if (wrl->full_purge == WRL_PURGE_DONE)
+			continue;
+
+		if (wrl_rate_backoff_active(wrl, &group->backoff, now, &next_retry))
+			continue;
+
+		if (wrl->full_purge == WRL_PURGE_PENDING || !group->members) {
+			if (group->installed)
+				wrl_rate_work_queue(wrl, WRL_APPLY_PRIO_REMOVAL, WRL_OP_GROUP_REMOVE, group, NULL, NULL);
+		} else if (!group->installed || !group->rate.applied) {
+			wrl_rate_work_queue(wrl, WRL_APPLY_PRIO_INTERFACE,
+					    group->installed ? WRL_OP_GROUP_UPDATE : WRL_OP_GROUP_ADD,
+					    group, NULL, NULL);
+			group->queued = 1;
+		}
+	}
+
+	/* Collect all outstanding work, the backend gets it by priority */
+	list_for_each_entry(interface, &wrl->interfaces, head) {
+		if (wrl->full_purge == WRL_PURGE_DONE)
+			continue;
+
+		/* Trees in the wrong place are removed first, the rebuild follows right after */
+		if (interface->installed && wrl->full_purge == WRL_PURGE_NONE &&
+		    !wrl_group_ref_equal(&interface->group, &interface->kernel_group)) {
+			if (!wrl_rate_backoff_active(wrl, &interface->backoff, now, &next_retry)) {
+				wrl_rate_work_add(wrl, WRL_APPLY_PRIO_INTERFACE, WRL_OP_INTERFACE_REMOVE, interface, NULL);
+				wrl->apply_postponed = 1;
+			}
+			continue;
+		}
+
+		group = NULL;
+		if (interface->group.slot && wrl->full_purge == WRL_PURGE_NONE) {
+			group = wrl_group_get(wrl, interface->group.name);
+
+			/* Members wait for the trees of their group */
+			if (!group || (!group->installed && !group->queued))
+				continue;
+		}
+
+		/* Rebuilt group trees lost the classes of all members */
+		rebuild = !interface->installed || (group && !group->installed);
+
+		if (wrl_rate_backoff_active(wrl, &interface->backoff, now, &next_retry)) {
+			/* Clients of a missing tree wait for it */
+			if (rebuild || wrl->full_purge == WRL_PURGE_PENDING)
+				continue;
+		} else if (wrl->full_purge == WRL_PURGE_PENDING) {
+			wrl_rate_work_add(wrl, WRL_APPLY_PRIO_INTERFACE, WRL_OP_INTERFACE_REMOVE, interface, NULL);
+		} else if (!interface->rate.applied || rebuild) {
+			/* Outside of purges the tree is present even without a limit */
+			/* An installed tree keeps its client classes */
+			wrl_rate_work_add(wrl, WRL_APPLY_PRIO_INTERFACE,
+					  rebuild ? WRL_OP_INTERFACE_ADD : WRL_OP_INTERFACE_UPDATE,
+					  interface, NULL);
+		}
+
+		/* Apply client rates */
+		wrl_client_for_each(client, &interface->clients) {
+			if (!client->connected) {
+				/* Interface operations drop the classes of departed clients as well */
+				if (rebuild || wrl->full_purge != WRL_PURGE_NONE)
+					continue;
+
+				/* Filters or class in use by the member the station roamed to */
+				if (client->roamed || client->lent)
+					continue;
+
+				if (!wrl_rate_backoff_active(wrl, &client->backoff, now, &next_retry))
+					wrl_rate_work_add(wrl, WRL_APPLY_PRIO_REMOVAL, WRL_OP_CLIENT_REMOVE, interface, client);
+				continue;
+			}
+
+			/* Weights are set next to the shaping, within the same budget */
+			if (!client->airtime.applied) {
+				if (interface->airtime_unsupported)
+					client->airtime.applied = 1;
+				else if (!wrl_rate_backoff_active(wrl, &client->airtime.backoff, now, &next_retry))
+					wrl_rate_work_add(wrl, client->installed ? WRL_APPLY_PRIO_UPDATE : WRL_APPLY_PRIO_ASSOCIATION,
+							  WRL_OP_CLIENT_AIRTIME, interface, client);
+			}
+
+			/* Roamed within the group, filters are moved and the class is kept */
+			if (client->from.slot) {
+				if (!rebuild && wrl->full_purge == WRL_PURGE_NONE) {
+					if (!wrl_rate_backoff_active(wrl, &client->backoff, now, &next_retry))
+						wrl_rate_work_add(wrl, WRL_APPLY_PRIO_ASSOCIATION, WRL_OP_CLIENT_MOVE, interface, client);
+					continue;
+				}
+
+				/* Rebuilt trees lost the class, start over with one of its own */
+				memset(&client->from, 0, sizeof(client->from));
+				memset(&client->home, 0, sizeof(client->home));
+			}
+
+			/* Class in use on the member the station left, returned or released first */
+			if (client->lent)
+				continue;
+
+			if (!rebuild && client->rate.applied) {
+				/* Rebalanced guarantee, the class is changed in place */
+				if (client->installed && !client->guarantee.applied &&
+				    wrl->full_purge == WRL_PURGE_NONE &&
+				    !wrl_rate_backoff_active(wrl, &client->backoff, now, &next_retry))
+					wrl_rate_work_add(wrl, WRL_APPLY_PRIO_UPDATE, WRL_OP_CLIENT_UPDATE, interface, client);
+				continue;
+			}
+
+			if (wrl->full_purge == WRL_PURGE_PENDING) {
+				/* Interface limits purged, do nothing instead of acking 0 limits */
+				wrl_client_rate_applied(client, 1);
+				continue;
+			}
+
+			/* A rebuilt tree lost all classes, retry with it */
+			if (!rebuild && wrl_rate_backoff_active(wrl, &client->backoff, now, &next_retry))
+				continue;
+
+			/* Check if we should remove the rate limit */
+			if (client->rate.down == 0 && client->rate.up == 0)
+				wrl_rate_work_add(wrl, WRL_APPLY_PRIO_UPDATE, WRL_OP_CLIENT_REMOVE, interface, client);
+			else if (client->installed && !rebuild)
+				wrl_rate_work_add(wrl, WRL_APPLY_PRIO_UPDATE, WRL_OP_CLIENT_UPDATE, interface, client);
+			else {
+				/* Classes are added to the slot of the interface */
+				memset(&client->home, 0, sizeof(client->home));
+				wrl_rate_work_add(wrl, client->installed ? WRL_APPLY_PRIO_UPDATE : WRL_APPLY_PRIO_ASSOCIATION,
+						  WRL_OP_CLIENT_ADD, interface, client);
+			}
+		}
+	}
+
+	/* Backed off work is picked up again once due */
+	if (next_retry)
+		wrl_schedule_apply(wrl, (next_retry - now) / 1000 + 1);
+
+	/* Bounded transactions keep the loop responsive, the remainder follows right after */
+	budget = WRL_APPLY_MAX_OPS;
+	for (prio = 0; prio < __WRL_APPLY_PRIO_MAX && budget; prio++) {
+		for (i = 0; i < wrl_apply_queue.num && budget; i++) {
+			work = &wrl_apply_queue.work[i];
+			if (work->priority != prio)
+				continue;
+
+			wrl_rate_work_log(work);
+			if (!wrl_rate_op_add(ops, work->type, work->group, work->interface, work->client))
+				continue;
+
+			wrl->queue.pending[prio]--;
+			wrl->queue.in_flight++;
+			budget--;
+		}
+	}
+
+	if (list_empty(ops))
+		return;
+
+	if (wrl_apply_queue.num > wrl->queue.in_flight)
+		wrl->apply_postponed = 1;
+
+	wrl_stats.counters.transactions++;
+	wrl_stats.counters.ops += wrl->queue.in_flight;
+
+	wrl->transaction_pending = 1;
+	wrl->transaction_start = now;
+	wrl_snapshot_dirty();
+	wrl->backend->commit(transaction);
+}
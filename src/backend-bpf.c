@@ -0,0 +1,401 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <net/if.h>
+#include <linux/rtnetlink.h>
+#include <linux/pkt_sched.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "airtime.h"
+#include "backend.h"
+#include "log.h"
+#include "netlink.h"
+#include "stats.h"
+
+#include "bpf/wrl-edt.h"
+
+#ifndef WRL_BACKEND_BPF_OBJECT
+#define WRL_BACKEND_BPF_OBJECT "/usr/lib/wireless-rate-limiter/wrl-edt.bpf.o"
+#endif
+
+#define WRL_BPF_STRINGIFY(x)		#x
+#define WRL_BPF_MAP_NAME(x)		WRL_BPF_STRINGIFY(x)
+
+#define WRL_BPF_TC_HANDLE		1
+#define WRL_BPF_TC_PRIO			1
+
+#define WRL_BPF_MQ_HANDLE		(1 << 16)
+
+/* Smallest upload burst, a few full sized frames */
+#define WRL_BPF_MIN_BURST		(4 * 1514)
+
+static struct wrl_nl rtnl = {
+	.fd = -1,
+};
+
+static struct {
+	struct bpf_object *obj;
+	int egress_fd;
+	int ingress_fd;
+	int map_fd;
+} wrl_bpf;
+
+static int
+wrl_backend_bpf_qdisc(int ifindex, uint16_t type, uint16_t flags, uint32_t parent, uint32_t handle, const char *kind)
+{
+	struct wrl_nl_msg msg;
+	struct tcmsg *tcm;
+
+	tcm = wrl_nl_msg_init(&msg, type, flags, sizeof(*tcm));
+	tcm->tcm_family = AF_UNSPEC;
+	tcm->tcm_ifindex = ifindex;
+	tcm->tcm_parent = parent;
+	tcm->tcm_handle = handle;
+
+	if (kind)
+		wrl_nl_attr_put_str(&msg, TCA_KIND, kind);
+
+	return wrl_nl_request(&rtnl, &msg);
+}
+
+static int
+wrl_backend_bpf_num_tx_queues(const char *ifname)
+{
+	struct dirent *entry;
+	char path[64];
+	int num = 0;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/queues", ifname);
+	dir = opendir(path);
+	if (!dir)
+		return 1;
+
+	while ((entry = readdir(dir))) {
+		if (!strncmp(entry->d_name, "tx-", 3))
+			num++;
+	}
+	closedir(dir);
+
+	return num ? num : 1;
+}
+
+/* fq enforces the departure times, one instance per hardware queue */
+static int
+wrl_backend_bpf_root_add(int ifindex, const char *ifname)
+{
+	uint16_t flags = NLM_F_CREATE | NLM_F_REPLACE;
+	int num_queues = wrl_backend_bpf_num_tx_queues(ifname);
+	int ret;
+
+	if (num_queues == 1)
+		return wrl_backend_bpf_qdisc(ifindex, RTM_NEWQDISC, flags, TC_H_ROOT, 0, "fq");
+
+	ret = wrl_backend_bpf_qdisc(ifindex, RTM_NEWQDISC, flags, TC_H_ROOT, WRL_BPF_MQ_HANDLE, "mq");
+	if (ret)
+		return ret;
+
+	for (int i = 1; i <= num_queues && !ret; i++)
+		ret = wrl_backend_bpf_qdisc(ifindex, RTM_NEWQDISC, flags, TC_H_MAKE(WRL_BPF_MQ_HANDLE, i), 0, "fq");
+
+	return ret;
+}
+
+static void
+wrl_backend_bpf_root_del(int ifindex)
+{
+	/* Falls back to the default qdisc, fails if none was configured */
+	wrl_backend_bpf_qdisc(ifindex, RTM_DELQDISC, 0, TC_H_ROOT, 0, NULL);
+}
+
+static void
+wrl_backend_bpf_key(struct wrl_edt_key *key, int ifindex, const uint8_t *address, enum wrl_edt_direction direction)
+{
+	memset(key, 0, sizeof(*key));
+	key->ifindex = ifindex;
+	key->direction = direction;
+	if (address)
+		memcpy(key->address, address, sizeof(key->address));
+}
+
+static int
+wrl_backend_bpf_limit_set(int ifindex, const uint8_t *address, enum wrl_edt_direction direction, uint32_t rate)
+{
+	struct wrl_edt_value value = {};
+	struct wrl_edt_key key;
+
+	wrl_backend_bpf_key(&key, ifindex, address, direction);
+
+	wrl_stats.counters.backend_commands++;
+
+	/* Unlimited directions have no entry at all */
+	if (!rate) {
+		if (bpf_map_delete_elem(wrl_bpf.map_fd, &key) && errno != ENOENT)
+			goto error;
+		return 0;
+	}
+
+	/* kbit/s to byte/s */
+	value.rate = (uint64_t)rate * 1000 / 8;
+	value.burst = value.rate * WRL_EDT_BURST_NS / WRL_EDT_NSEC_PER_SEC;
+	if (value.burst < WRL_BPF_MIN_BURST)
+		value.burst = WRL_BPF_MIN_BURST;
+	value.tokens = value.burst;
+
+	if (bpf_map_update_elem(wrl_bpf.map_fd, &key, &value, BPF_ANY))
+		goto error;
+
+	return 0;
+
+error:
+	wrl_stats.counters.backend_failures++;
+	return -errno;
+}
+
+static void
+wrl_backend_bpf_limits_flush(int ifindex)
+{
+	struct wrl_edt_key key, *keys = NULL, *tmp;
+	int num_keys = 0, size = 0;
+	void *prev = NULL;
+
+	/* Collect first, deleting while iterating restarts the walk */
+	while (!bpf_map_get_next_key(wrl_bpf.map_fd, prev, &key)) {
+		prev = &key;
+
+		if (key.ifindex != ifindex)
+			continue;
+
+		if (num_keys == size) {
+			size = size ? size * 2 : 64;
+			tmp = realloc(keys, size * sizeof(*keys));
+			if (!tmp)
+				break;
+			keys = tmp;
+		}
+
+		keys[num_keys++] = key;
+	}
+
+	for (int i = 0; i < num_keys; i++)
+		bpf_map_delete_elem(wrl_bpf.map_fd, &keys[i]);
+
+	free(keys);
+}
+
+static int
+wrl_backend_bpf_interface_remove(struct wrl_op *op)
+{
+	LIBBPF_OPTS(bpf_tc_hook, hook,
+		.attach_point = BPF_TC_INGRESS | BPF_TC_EGRESS,
+	);
+	int ifindex;
+
+	ifindex = if_nametoindex(op->interface);
+	if (!ifindex)
+		return -ENODEV;
+
+	/* Removes the programs as well as a redirect of other backends */
+	hook.ifindex = ifindex;
+	bpf_tc_hook_destroy(&hook);
+
+	wrl_backend_bpf_root_del(ifindex);
+	wrl_backend_bpf_limits_flush(ifindex);
+
+	return 0;
+}
+
+static int
+wrl_backend_bpf_interface_update(struct wrl_op *op)
+{
+	int ifindex;
+	int ret;
+
+	ifindex = if_nametoindex(op->interface);
+	if (!ifindex)
+		return -ENODEV;
+
+	ret = wrl_backend_bpf_limit_set(ifindex, NULL, WRL_EDT_DIRECTION_DOWN, op->rate.down);
+	if (ret)
+		return ret;
+
+	return wrl_backend_bpf_limit_set(ifindex, NULL, WRL_EDT_DIRECTION_UP, op->rate.up);
+}
+
+static int
+wrl_backend_bpf_interface_add(struct wrl_op *op)
+{
+	LIBBPF_OPTS(bpf_tc_hook, hook,
+		.attach_point = BPF_TC_INGRESS | BPF_TC_EGRESS,
+	);
+	LIBBPF_OPTS(bpf_tc_opts, opts,
+		.handle = WRL_BPF_TC_HANDLE,
+		.priority = WRL_BPF_TC_PRIO,
+		.flags = BPF_TC_F_REPLACE,
+	);
+	int ifindex;
+	int ret;
+
+	/* Start from a clean state */
+	ret = wrl_backend_bpf_interface_remove(op);
+	if (ret)
+		return ret;
+
+	ifindex = if_nametoindex(op->interface);
+	hook.ifindex = ifindex;
+
+	ret = wrl_backend_bpf_root_add(ifindex, op->interface);
+	if (ret) {
+		MSG(ERROR, "Failed to create fq root on %s (%d)\n", op->interface, ret);
+		return ret;
+	}
+
+	ret = bpf_tc_hook_create(&hook);
+	if (ret && ret != -EEXIST)
+		return ret;
+
+	hook.attach_point = BPF_TC_EGRESS;
+	opts.prog_fd = wrl_bpf.egress_fd;
+	ret = bpf_tc_attach(&hook, &opts);
+	if (ret)
+		return ret;
+
+	hook.attach_point = BPF_TC_INGRESS;
+	opts.prog_fd = wrl_bpf.ingress_fd;
+	opts.prog_id = 0;
+	ret = bpf_tc_attach(&hook, &opts);
+	if (ret)
+		return ret;
+
+	return wrl_backend_bpf_interface_update(op);
+}
+
+static int
+wrl_backend_bpf_client_set(struct wrl_op *op, uint32_t down, uint32_t up)
+{
+	int ifindex;
+	int ret;
+
+	ifindex = if_nametoindex(op->interface);
+	if (!ifindex)
+		return -ENODEV;
+
+	ret = wrl_backend_bpf_limit_set(ifindex, op->address, WRL_EDT_DIRECTION_DOWN, down);
+	if (ret)
+		return ret;
+
+	return wrl_backend_bpf_limit_set(ifindex, op->address, WRL_EDT_DIRECTION_UP, up);
+}
+
+static void
+wrl_backend_bpf_commit(struct wrl_transaction *transaction)
+{
+	struct wrl_op *op;
+
+	list_for_each_entry(op, &transaction->ops, head) {
+		switch (op->type) {
+		case WRL_OP_INTERFACE_ADD:
+			op->ret = wrl_backend_bpf_interface_add(op);
+			break;
+		case WRL_OP_INTERFACE_REMOVE:
+			op->ret = wrl_backend_bpf_interface_remove(op);
+			break;
+		case WRL_OP_CLIENT_ADD:
+			op->ret = wrl_backend_bpf_client_set(op, op->rate.down, op->rate.up);
+			break;
+		case WRL_OP_CLIENT_REMOVE:
+			op->ret = wrl_backend_bpf_client_set(op, 0, 0);
+			break;
+		case WRL_OP_CLIENT_UPDATE:
+			/* Pacing only enforces the ceil, guarantees are ignored */
+			op->ret = wrl_backend_bpf_client_set(op, op->rate.down, op->rate.up);
+			break;
+		case WRL_OP_INTERFACE_UPDATE:
+			op->ret = wrl_backend_bpf_interface_update(op);
+			break;
+		case WRL_OP_CLIENT_AIRTIME:
+			op->ret = wrl_airtime_set(op->interface, op->address, op->airtime_weight);
+			break;
+		case WRL_OP_GROUP_ADD:
+		case WRL_OP_GROUP_REMOVE:
+		case WRL_OP_GROUP_UPDATE:
+		case WRL_OP_CLIENT_MOVE:
+			/* Pacing is per client, there is no aggregate to share. Never planned, members get no slot */
+			MSG(ERROR, "Groups are not supported by the bpf backend\n");
+			op->ret = -EOPNOTSUPP;
+			break;
+		}
+	}
+
+	/* Map updates take effect immediately */
+	transaction->complete(transaction);
+}
+
+static void
+wrl_backend_bpf_deinit(void)
+{
+	wrl_nl_close(&rtnl);
+
+	if (wrl_bpf.obj)
+		bpf_object__close(wrl_bpf.obj);
+	wrl_bpf.obj = NULL;
+}
+
+static int
+wrl_backend_bpf_init(void)
+{
+	struct bpf_program *egress, *ingress;
+	struct bpf_map *map;
+	int ret;
+
+	ret = wrl_nl_open(&rtnl, NETLINK_ROUTE);
+	if (ret)
+		return ret;
+
+	wrl_bpf.obj = bpf_object__open_file(WRL_BACKEND_BPF_OBJECT, NULL);
+	if (!wrl_bpf.obj) {
+		ret = -errno;
+		MSG(ERROR, "Failed to open %s: %s\n", WRL_BACKEND_BPF_OBJECT, strerror(errno));
+		goto error;
+	}
+
+	ret = bpf_object__load(wrl_bpf.obj);
+	if (ret) {
+		MSG(ERROR, "Failed to load %s (%d)\n", WRL_BACKEND_BPF_OBJECT, ret);
+		goto error;
+	}
+
+	egress = bpf_object__find_program_by_name(wrl_bpf.obj, "wrl_edt_egress");
+	ingress = bpf_object__find_program_by_name(wrl_bpf.obj, "wrl_edt_ingress");
+	map = bpf_object__find_map_by_name(wrl_bpf.obj, WRL_BPF_MAP_NAME(WRL_EDT_MAP_NAME));
+	if (!egress || !ingress || !map) {
+		MSG(ERROR, "Incomplete object %s\n", WRL_BACKEND_BPF_OBJECT);
+		ret = -ENOENT;
+		goto error;
+	}
+
+	wrl_bpf.egress_fd = bpf_program__fd(egress);
+	wrl_bpf.ingress_fd = bpf_program__fd(ingress);
+	wrl_bpf.map_fd = bpf_map__fd(map);
+
+	return 0;
+
+error:
+	wrl_backend_bpf_deinit();
+	return ret;
+}
+
+const struct wrl_backend wrl_backend_bpf = {
+	.name = "bpf",
+	.init = wrl_backend_bpf_init,
+	.deinit = wrl_backend_bpf_deinit,
+	.commit = wrl_backend_bpf_commit,
+};
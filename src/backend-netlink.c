@@ -0,0 +1,1056 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <linux/pkt_sched.h>
+#include <linux/pkt_cls.h>
+#include <linux/tc_act/tc_mirred.h>
+
+#include "airtime.h"
+#include "backend.h"
+#include "log.h"
+#include "mac.h"
+#include "netlink.h"
+
+#define WRL_NL_TC_MAJOR			(1 << 16)
+#define WRL_NL_TC_CLASS(minor)		TC_H_MAKE(WRL_NL_TC_MAJOR, (minor))
+#define WRL_NL_TC_ROOT_CLASS		1
+#define WRL_NL_TC_DEFAULT_CLASS		2
+
+#define WRL_NL_TC_FILTER_PRIO		1
+#define WRL_NL_TC_IFB_PRIO		512
+
+/* Client filters live in a u32 hash table bucketed by the last address byte, one per group slot */
+#define WRL_NL_TC_U32_TABLE(slot)		(((slot) + 1) << 20)
+#define WRL_NL_TC_U32_BUCKETS			256
+#define WRL_NL_TC_U32_HASH_BYTE			5
+#define WRL_NL_TC_U32_LINK_NODE(slot)		((slot) + 1)
+#define WRL_NL_TC_U32_BUCKET(table, mac)	((table) | ((mac)[WRL_NL_TC_U32_HASH_BYTE] << 12))
+#define WRL_NL_TC_U32_HANDLE(table, mac, node)	(WRL_NL_TC_U32_BUCKET(table, mac) | (node))
+
+/* Offset of the ethernet addresses relative to the network header */
+#define WRL_NL_ETHER_DST_OFFSET		-14
+#define WRL_NL_ETHER_SRC_OFFSET		-8
+
+/* Default MTU assumed by tc for computing the ceil burst */
+#define WRL_NL_TC_MTU			1600
+
+static struct wrl_nl rtnl = {
+	.fd = -1,
+};
+
+/* Messages of a transaction and the result of the operation being built */
+static struct wrl_nl_batch batch;
+static int *wrl_nl_op_ret;
+
+struct wrl_nl_u32_sel {
+	struct tc_u32_sel sel;
+	struct tc_u32_key keys[4];
+};
+
+/* Tree of an interface in one direction, on its own devices or in a slot of the group trees */
+struct wrl_nl_tree {
+	int ifindex;
+
+	/* Class-ids of the interface are relative to the base */
+	uint32_t base;
+	uint32_t parent;
+
+	/* Client filters and the filter linking to them */
+	uint32_t table;
+	uint32_t link;
+	int offset;
+};
+
+/* Classes and client filters of a group slot found in the kernel */
+struct wrl_nl_slot_state {
+	const struct wrl_nl_tree *tree;
+	uint8_t *minors;
+	uint32_t *filters;
+	uint32_t num_filters;
+};
+
+static struct tcmsg *
+wrl_backend_netlink_tc_init(struct wrl_nl_msg *msg, uint16_t type, uint16_t flags,
+			    int ifindex, uint32_t parent, uint32_t handle, uint32_t info)
+{
+	struct tcmsg *tcm;
+
+	tcm = wrl_nl_msg_init(msg, type, flags, sizeof(*tcm));
+	tcm->tcm_family = AF_UNSPEC;
+	tcm->tcm_ifindex = ifindex;
+	tcm->tcm_parent = parent;
+	tcm->tcm_handle = handle;
+	tcm->tcm_info = info;
+
+	return tcm;
+}
+
+static void
+wrl_backend_netlink_request(struct wrl_nl_msg *msg, int ignore_error)
+{
+	wrl_nl_batch_add(&rtnl, &batch, msg, wrl_nl_op_ret, ignore_error);
+}
+
+/* Best effort, used for tearing down state which might not exist */
+static void
+wrl_backend_netlink_request_optional(struct wrl_nl_msg *msg)
+{
+	wrl_nl_batch_add(&rtnl, &batch, msg, NULL, 0);
+}
+
+static int
+wrl_backend_netlink_link_request(struct wrl_nl_msg *msg, int ignore_error)
+{
+	int ret;
+
+	/* Link changes are synchronous, later messages depend on the ifindex */
+	wrl_nl_batch_flush(&rtnl, &batch);
+
+	ret = wrl_nl_request(&rtnl, msg);
+	if (ret == ignore_error)
+		return 0;
+
+	if (ret)
+		MSG(DEBUG, "Netlink request type=%d failed: %s\n", msg->nlh.nlmsg_type, strerror(-ret));
+
+	return ret;
+}
+
+static uint32_t
+wrl_backend_netlink_xmittime(uint64_t rate, uint32_t size)
+{
+	uint64_t ticks;
+
+	/* Kernel scheduler ticks are 64ns */
+	ticks = (uint64_t)size * 1000000000ULL / rate / 64;
+	if (ticks > UINT32_MAX)
+		return UINT32_MAX;
+
+	return ticks;
+}
+
+static void
+wrl_backend_netlink_ratespec(struct tc_ratespec *spec, uint64_t rate)
+{
+	spec->rate = rate > UINT32_MAX ? UINT32_MAX : rate;
+	/* No rate table is provided, let the kernel compute it */
+	spec->linklayer = TC_LINKLAYER_ETHERNET;
+}
+
+/* Links */
+static int
+wrl_backend_netlink_ifb_add(const char *ifname)
+{
+	struct wrl_nl_msg msg;
+	struct ifinfomsg *ifi;
+	struct nlattr *linkinfo;
+
+	ifi = wrl_nl_msg_init(&msg, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, sizeof(*ifi));
+	ifi->ifi_family = AF_UNSPEC;
+	ifi->ifi_flags = IFF_UP;
+	ifi->ifi_change = IFF_UP;
+
+	wrl_nl_attr_put_str(&msg, IFLA_IFNAME, ifname);
+	linkinfo = wrl_nl_nest_start(&msg, IFLA_LINKINFO);
+	wrl_nl_attr_put_str(&msg, IFLA_INFO_KIND, "ifb");
+	wrl_nl_nest_end(&msg, linkinfo);
+
+	return wrl_backend_netlink_link_request(&msg, -EEXIST);
+}
+
+static int
+wrl_backend_netlink_link_del(const char *ifname)
+{
+	struct wrl_nl_msg msg;
+	struct ifinfomsg *ifi;
+
+	ifi = wrl_nl_msg_init(&msg, RTM_DELLINK, 0, sizeof(*ifi));
+	ifi->ifi_family = AF_UNSPEC;
+	wrl_nl_attr_put_str(&msg, IFLA_IFNAME, ifname);
+
+	return wrl_backend_netlink_link_request(&msg, -ENODEV);
+}
+
+/* Queueing disciplines */
+static void
+wrl_backend_netlink_htb_add(int ifindex)
+{
+	struct tc_htb_glob glob = {
+		.version = TC_HTB_PROTOVER,
+		.rate2quantum = 10,
+		.defcls = WRL_NL_TC_DEFAULT_CLASS,
+	};
+	struct wrl_nl_msg msg;
+	struct nlattr *options;
+
+	wrl_backend_netlink_tc_init(&msg, RTM_NEWQDISC, NLM_F_CREATE | NLM_F_EXCL, ifindex,
+				    TC_H_ROOT, WRL_NL_TC_MAJOR, 0);
+	wrl_nl_attr_put_str(&msg, TCA_KIND, "htb");
+	options = wrl_nl_nest_start(&msg, TCA_OPTIONS);
+	wrl_nl_attr_put(&msg, TCA_HTB_INIT, &glob, sizeof(glob));
+	wrl_nl_nest_end(&msg, options);
+
+	wrl_backend_netlink_request(&msg, -EEXIST);
+}
+
+static void
+wrl_backend_netlink_root_del(int ifindex)
+{
+	struct wrl_nl_msg msg;
+
+	wrl_backend_netlink_tc_init(&msg, RTM_DELQDISC, 0, ifindex, TC_H_ROOT, 0, 0);
+
+	wrl_backend_netlink_request_optional(&msg);
+}
+
+static void
+wrl_backend_netlink_fq_codel_add(int ifindex, uint32_t parent, uint32_t flows, uint32_t limit)
+{
+	struct wrl_nl_msg msg;
+	struct nlattr *options;
+
+	/* Flow count can only be set on creation, keep an existing instance */
+	wrl_backend_netlink_tc_init(&msg, RTM_NEWQDISC, NLM_F_CREATE | NLM_F_EXCL, ifindex,
+				    parent, TC_H_MIN(parent) << 16, 0);
+	wrl_nl_attr_put_str(&msg, TCA_KIND, "fq_codel");
+	options = wrl_nl_nest_start(&msg, TCA_OPTIONS);
+	wrl_nl_attr_put_u32(&msg, TCA_FQ_CODEL_LIMIT, limit);
+	wrl_nl_attr_put_u32(&msg, TCA_FQ_CODEL_FLOWS, flows);
+	wrl_nl_attr_put_u32(&msg, TCA_FQ_CODEL_ECN, 0);
+	wrl_nl_nest_end(&msg, options);
+
+	wrl_backend_netlink_request(&msg, -EEXIST);
+}
+
+static void
+wrl_backend_netlink_clsact_add(int ifindex)
+{
+	struct wrl_nl_msg msg;
+
+	wrl_backend_netlink_tc_init(&msg, RTM_NEWQDISC, NLM_F_CREATE | NLM_F_EXCL, ifindex,
+				    TC_H_CLSACT, TC_H_MAKE(TC_H_CLSACT, 0), 0);
+	wrl_nl_attr_put_str(&msg, TCA_KIND, "clsact");
+
+	wrl_backend_netlink_request(&msg, -EEXIST);
+}
+
+/* Classes */
+static void
+wrl_backend_netlink_htb_class_add(int ifindex, uint32_t parent, uint32_t classid,
+				  uint32_t rate_kbit, uint32_t ceil_kbit, uint32_t burst,
+				  uint32_t prio, uint32_t quantum)
+{
+	uint64_t rate = (uint64_t)rate_kbit * 125;
+	uint64_t ceil = (uint64_t)ceil_kbit * 125;
+	struct tc_htb_opt opt = {};
+	struct wrl_nl_msg msg;
+	struct nlattr *options;
+
+	wrl_backend_netlink_ratespec(&opt.rate, rate);
+	wrl_backend_netlink_ratespec(&opt.ceil, ceil);
+	opt.buffer = wrl_backend_netlink_xmittime(rate, burst);
+	opt.cbuffer = wrl_backend_netlink_xmittime(ceil, ceil / 1000000000ULL + WRL_NL_TC_MTU);
+	opt.prio = prio;
+	opt.quantum = quantum;
+
+	/* Without NLM_F_EXCL an existing class is changed in place */
+	wrl_backend_netlink_tc_init(&msg, RTM_NEWTCLASS, NLM_F_CREATE, ifindex, parent, classid, 0);
+	wrl_nl_attr_put_str(&msg, TCA_KIND, "htb");
+	options = wrl_nl_nest_start(&msg, TCA_OPTIONS);
+	wrl_nl_attr_put(&msg, TCA_HTB_PARMS, &opt, sizeof(opt));
+	if (rate > UINT32_MAX)
+		wrl_nl_attr_put_u64(&msg, TCA_HTB_RATE64, rate);
+	if (ceil > UINT32_MAX)
+		wrl_nl_attr_put_u64(&msg, TCA_HTB_CEIL64, ceil);
+	wrl_nl_nest_end(&msg, options);
+
+	wrl_backend_netlink_request(&msg, 0);
+}
+
+static void
+wrl_backend_netlink_class_del(int ifindex, uint32_t classid)
+{
+	struct wrl_nl_msg msg;
+
+	wrl_backend_netlink_tc_init(&msg, RTM_DELTCLASS, 0, ifindex,
+				    WRL_NL_TC_CLASS(WRL_NL_TC_ROOT_CLASS), classid, 0);
+
+	wrl_backend_netlink_request_optional(&msg);
+}
+
+/* Filters */
+static void
+wrl_backend_netlink_u32_match(struct tc_u32_sel *sel, const uint8_t *data, int len, int offset)
+{
+	struct tc_u32_key *key;
+	int byte_offset;
+	int i, k;
+
+	for (i = 0; i < len; i++) {
+		byte_offset = offset + i;
+
+		/* Keys match on 32 bit words, merge bytes sharing a word */
+		for (k = 0; k < sel->nkeys; k++) {
+			if (sel->keys[k].off == (byte_offset & ~3))
+				break;
+		}
+
+		key = &sel->keys[k];
+		if (k == sel->nkeys) {
+			key->off = byte_offset & ~3;
+			sel->nkeys++;
+		}
+
+		((uint8_t *)&key->val)[byte_offset & 3] = data[i];
+		((uint8_t *)&key->mask)[byte_offset & 3] = 0xff;
+	}
+}
+
+static void
+wrl_backend_netlink_u32_table_add(const struct wrl_nl_tree *tree)
+{
+	struct wrl_nl_u32_sel sel = {};
+	int hash_offset = tree->offset + WRL_NL_TC_U32_HASH_BYTE;
+	struct wrl_nl_msg msg;
+	struct nlattr *options;
+
+	wrl_backend_netlink_tc_init(&msg, RTM_NEWTFILTER, NLM_F_CREATE | NLM_F_EXCL, tree->ifindex,
+				    WRL_NL_TC_MAJOR, tree->table,
+				    TC_H_MAKE(WRL_NL_TC_FILTER_PRIO << 16, htons(ETH_P_ALL)));
+	wrl_nl_attr_put_str(&msg, TCA_KIND, "u32");
+	options = wrl_nl_nest_start(&msg, TCA_OPTIONS);
+	wrl_nl_attr_put_u32(&msg, TCA_U32_DIVISOR, WRL_NL_TC_U32_BUCKETS);
+	wrl_nl_nest_end(&msg, options);
+
+	wrl_backend_netlink_request(&msg, -EEXIST);
+
+	/* Match everything in the root table and jump to the bucket of the address */
+	sel.sel.nkeys = 1;
+	sel.sel.hoff = hash_offset & ~3;
+	sel.sel.hmask = htonl(0xffU << (8 * (3 - (hash_offset & 3))));
+
+	wrl_backend_netlink_tc_init(&msg, RTM_NEWTFILTER, NLM_F_CREATE | NLM_F_EXCL, tree->ifindex,
+				    WRL_NL_TC_MAJOR, tree->link,
+				    TC_H_MAKE(WRL_NL_TC_FILTER_PRIO << 16, htons(ETH_P_ALL)));
+	wrl_nl_attr_put_str(&msg, TCA_KIND, "u32");
+	options = wrl_nl_nest_start(&msg, TCA_OPTIONS);
+	wrl_nl_attr_put_u32(&msg, TCA_U32_LINK, tree->table);
+	wrl_nl_attr_put(&msg, TCA_U32_SEL, &sel, sizeof(sel.sel) + sel.sel.nkeys * sizeof(sel.keys[0]));
+	wrl_nl_nest_end(&msg, options);
+
+	wrl_backend_netlink_request(&msg, -EEXIST);
+}
+
+static void
+wrl_backend_netlink_u32_add(const struct wrl_nl_tree *tree, uint32_t id, uint32_t classid, const uint8_t *mac)
+{
+	struct wrl_nl_u32_sel sel = {};
+	struct wrl_nl_msg msg;
+	struct nlattr *options;
+
+	sel.sel.flags = TC_U32_TERMINAL;
+	wrl_backend_netlink_u32_match(&sel.sel, mac, 6, tree->offset);
+
+	/* Node ids are local to the table, the class might be in another slot of the tree */
+	wrl_backend_netlink_tc_init(&msg, RTM_NEWTFILTER, NLM_F_CREATE | NLM_F_EXCL, tree->ifindex,
+				    WRL_NL_TC_MAJOR, WRL_NL_TC_U32_HANDLE(tree->table, mac, id),
+				    TC_H_MAKE(WRL_NL_TC_FILTER_PRIO << 16, htons(ETH_P_ALL)));
+	wrl_nl_attr_put_str(&msg, TCA_KIND, "u32");
+	options = wrl_nl_nest_start(&msg, TCA_OPTIONS);
+	wrl_nl_attr_put_u32(&msg, TCA_U32_HASH, WRL_NL_TC_U32_BUCKET(tree->table, mac));
+	wrl_nl_attr_put_u32(&msg, TCA_U32_CLASSID, WRL_NL_TC_CLASS(classid));
+	wrl_nl_attr_put(&msg, TCA_U32_SEL, &sel, sizeof(sel.sel) + sel.sel.nkeys * sizeof(sel.keys[0]));
+	wrl_nl_nest_end(&msg, options);
+
+	wrl_backend_netlink_request(&msg, 0);
+}
+
+static void
+wrl_backend_netlink_u32_del(int ifindex, uint32_t handle)
+{
+	struct wrl_nl_msg msg;
+
+	wrl_backend_netlink_tc_init(&msg, RTM_DELTFILTER, 0, ifindex,
+				    WRL_NL_TC_MAJOR, handle,
+				    TC_H_MAKE(WRL_NL_TC_FILTER_PRIO << 16, htons(ETH_P_ALL)));
+	wrl_nl_attr_put_str(&msg, TCA_KIND, "u32");
+
+	wrl_backend_netlink_request_optional(&msg);
+}
+
+static void
+wrl_backend_netlink_redirect_add(int ifindex, uint32_t direction, int target_ifindex)
+{
+	struct tc_mirred mirred = {
+		.action = TC_ACT_STOLEN,
+		.eaction = TCA_EGRESS_REDIR,
+		.ifindex = target_ifindex,
+	};
+	struct nlattr *options, *actions, *action, *action_options;
+	struct wrl_nl_msg msg;
+
+	wrl_backend_netlink_tc_init(&msg, RTM_NEWTFILTER, NLM_F_CREATE | NLM_F_EXCL, ifindex,
+				    TC_H_MAKE(TC_H_CLSACT, direction), 0,
+				    TC_H_MAKE(WRL_NL_TC_IFB_PRIO << 16, htons(ETH_P_ALL)));
+	wrl_nl_attr_put_str(&msg, TCA_KIND, "matchall");
+	options = wrl_nl_nest_start(&msg, TCA_OPTIONS);
+	actions = wrl_nl_nest_start(&msg, TCA_MATCHALL_ACT);
+	action = wrl_nl_nest_start(&msg, 1);
+	wrl_nl_attr_put_str(&msg, TCA_ACT_KIND, "mirred");
+	action_options = wrl_nl_nest_start(&msg, TCA_ACT_OPTIONS);
+	wrl_nl_attr_put(&msg, TCA_MIRRED_PARMS, &mirred, sizeof(mirred));
+	wrl_nl_nest_end(&msg, action_options);
+	wrl_nl_nest_end(&msg, action);
+	wrl_nl_nest_end(&msg, actions);
+	wrl_nl_nest_end(&msg, options);
+
+	wrl_backend_netlink_request(&msg, -EEXIST);
+}
+
+static void
+wrl_backend_netlink_redirect_del(int ifindex, uint32_t direction)
+{
+	struct wrl_nl_msg msg;
+
+	wrl_backend_netlink_tc_init(&msg, RTM_DELTFILTER, 0, ifindex,
+				    TC_H_MAKE(TC_H_CLSACT, direction), 0,
+				    TC_H_MAKE(WRL_NL_TC_IFB_PRIO << 16, htons(ETH_P_ALL)));
+
+	wrl_backend_netlink_request_optional(&msg);
+}
+
+/* Shaping trees */
+static void
+wrl_backend_netlink_leaf_class_set(const struct wrl_nl_tree *tree, uint32_t id, uint32_t rate_kbit, uint32_t ceil_kbit)
+{
+	uint32_t burst = id == WRL_NL_TC_DEFAULT_CLASS ? 64 * 1024 : 16 * 1024;
+
+	wrl_backend_netlink_htb_class_add(tree->ifindex, WRL_NL_TC_CLASS(tree->base | WRL_NL_TC_ROOT_CLASS),
+					  WRL_NL_TC_CLASS(tree->base | id), rate_kbit, ceil_kbit, burst, 1, 4096);
+}
+
+static void
+wrl_backend_netlink_leaf_add(const struct wrl_nl_tree *tree, uint32_t id, uint32_t rate_kbit, uint32_t ceil_kbit)
+{
+	uint32_t flows, limit;
+
+	if (id == WRL_NL_TC_DEFAULT_CLASS) {
+		flows = 1024;
+		limit = 4096;
+	} else {
+		flows = 64;
+		limit = 1024;
+	}
+
+	wrl_backend_netlink_leaf_class_set(tree, id, rate_kbit, ceil_kbit);
+	wrl_backend_netlink_fq_codel_add(tree->ifindex, WRL_NL_TC_CLASS(tree->base | id), flows, limit);
+}
+
+static void
+wrl_backend_netlink_root_class_set(const struct wrl_nl_tree *tree, uint32_t rate_kbit)
+{
+	wrl_backend_netlink_htb_class_add(tree->ifindex, tree->parent,
+					  WRL_NL_TC_CLASS(tree->base | WRL_NL_TC_ROOT_CLASS),
+					  rate_kbit, rate_kbit, 128 * 1024, 0, 8192);
+}
+
+static void
+wrl_backend_netlink_root_add(const struct wrl_nl_tree *tree, uint32_t rate_kbit)
+{
+	/* Members share the root qdisc and the default class of the group */
+	if (!tree->base) {
+		wrl_backend_netlink_htb_add(tree->ifindex);
+		wrl_backend_netlink_root_class_set(tree, rate_kbit);
+		wrl_backend_netlink_leaf_add(tree, WRL_NL_TC_DEFAULT_CLASS,
+					     wrl_backend_guarantee(0, rate_kbit), rate_kbit);
+	} else {
+		wrl_backend_netlink_root_class_set(tree, rate_kbit);
+	}
+
+	if (tree->table)
+		wrl_backend_netlink_u32_table_add(tree);
+}
+
+static void
+wrl_backend_netlink_root_update(const struct wrl_nl_tree *tree, uint32_t rate_kbit)
+{
+	wrl_backend_netlink_root_class_set(tree, rate_kbit);
+	if (!tree->base)
+		wrl_backend_netlink_leaf_class_set(tree, WRL_NL_TC_DEFAULT_CLASS,
+						   wrl_backend_guarantee(0, rate_kbit), rate_kbit);
+}
+
+static int
+wrl_backend_netlink_slot_cb(struct nlmsghdr *nlh, void *priv)
+{
+	struct wrl_nl_slot_state *slot = priv;
+	const struct wrl_nl_tree *tree = slot->tree;
+	struct tcmsg *tcm = NLMSG_DATA(nlh);
+	uint32_t minor = TC_H_MIN(tcm->tcm_handle);
+
+	if (tcm->tcm_ifindex != tree->ifindex)
+		return 0;
+
+	if (nlh->nlmsg_type == RTM_NEWTFILTER) {
+		if (TC_U32_HTID(tcm->tcm_handle) == tree->table && TC_U32_NODE(tcm->tcm_handle) &&
+		    slot->num_filters < 1 << WRL_GROUP_SLOT_SHIFT)
+			slot->filters[slot->num_filters++] = tcm->tcm_handle;
+		return 0;
+	}
+
+	if (nlh->nlmsg_type != RTM_NEWTCLASS || TC_H_MAJ(tcm->tcm_handle) != WRL_NL_TC_MAJOR ||
+	    minor < tree->base || minor - tree->base >= 1 << WRL_GROUP_SLOT_SHIFT)
+		return 0;
+
+	slot->minors[minor - tree->base] = 1;
+
+	return 0;
+}
+
+static int
+wrl_backend_netlink_slot_dump(struct wrl_nl_slot_state *slot, uint16_t type)
+{
+	struct wrl_nl_msg msg;
+
+	wrl_backend_netlink_tc_init(&msg, type, 0, slot->tree->ifindex,
+				    type == RTM_GETTFILTER ? WRL_NL_TC_MAJOR : 0, 0, 0);
+
+	return wrl_nl_dump(&rtnl, &msg, wrl_backend_netlink_slot_cb, slot);
+}
+
+static int
+wrl_backend_netlink_slot_flush(const struct wrl_nl_tree *tree)
+{
+	struct wrl_nl_slot_state slot = {
+		.tree = tree,
+	};
+	uint32_t minor, i;
+	int ret = -ENOMEM;
+
+	if (tree->ifindex <= 0)
+		return 0;
+
+	/* Table and link stay for the next member, they are released late by the kernel */
+	slot.minors = calloc(1, 1 << WRL_GROUP_SLOT_SHIFT);
+	slot.filters = calloc(1 << WRL_GROUP_SLOT_SHIFT, sizeof(*slot.filters));
+	if (!slot.minors || !slot.filters)
+		goto out;
+
+	/* Shaping left by an earlier member is only known to the kernel */
+	wrl_nl_batch_flush(&rtnl, &batch);
+
+	ret = wrl_backend_netlink_slot_dump(&slot, RTM_GETTFILTER);
+	if (!ret)
+		ret = wrl_backend_netlink_slot_dump(&slot, RTM_GETTCLASS);
+	if (ret)
+		goto out;
+
+	/* Filters hold a reference to the classes */
+	for (i = 0; i < slot.num_filters; i++)
+		wrl_backend_netlink_u32_del(tree->ifindex, slot.filters[i]);
+
+	/* Client classes before the root of the member */
+	for (minor = (1 << WRL_GROUP_SLOT_SHIFT) - 1; minor > 0; minor--) {
+		if (slot.minors[minor])
+			wrl_backend_netlink_class_del(tree->ifindex, WRL_NL_TC_CLASS(tree->base | minor));
+	}
+
+out:
+	free(slot.filters);
+	free(slot.minors);
+
+	return ret;
+}
+
+static int
+wrl_backend_netlink_ifindex(const char *ifname, char *ifb_name, int *ifb_ifindex)
+{
+	char buf[IFNAMSIZ];
+	int ifindex;
+
+	if (!ifb_name)
+		ifb_name = buf;
+
+	if (snprintf(ifb_name, IFNAMSIZ, "%s" WRL_BACKEND_IFB_SUFFIX, ifname) >= IFNAMSIZ) {
+		MSG(ERROR, "Interface name %s too long for IFB device\n", ifname);
+		return -ENAMETOOLONG;
+	}
+
+	ifindex = if_nametoindex(ifname);
+	if (!ifindex)
+		return -ENODEV;
+
+	if (ifb_ifindex)
+		*ifb_ifindex = if_nametoindex(ifb_name);
+
+	return ifindex;
+}
+
+static void
+wrl_backend_netlink_group_names(const char *group, char *down_name, char *up_name)
+{
+	snprintf(down_name, IFNAMSIZ, "%s" WRL_BACKEND_GROUP_DOWN_SUFFIX, group);
+	snprintf(up_name, IFNAMSIZ, "%s" WRL_BACKEND_GROUP_UP_SUFFIX, group);
+}
+
+/* Trees of the interface of an operation, returns the ifindex of the interface */
+static int
+wrl_backend_netlink_trees(struct wrl_op *op, struct wrl_nl_tree *down, struct wrl_nl_tree *up)
+{
+	char down_name[IFNAMSIZ], up_name[IFNAMSIZ];
+	int ifindex, ifb_ifindex;
+	uint8_t slot = op->group.slot;
+
+	ifindex = wrl_backend_netlink_ifindex(op->interface, NULL, &ifb_ifindex);
+	if (ifindex < 0)
+		return ifindex;
+
+	down->ifindex = ifindex;
+	up->ifindex = ifb_ifindex;
+	if (slot) {
+		wrl_backend_netlink_group_names(op->group.name, down_name, up_name);
+		down->ifindex = if_nametoindex(down_name);
+		up->ifindex = if_nametoindex(up_name);
+	}
+
+	down->base = wrl_backend_group_base(&op->group);
+	down->parent = slot ? WRL_NL_TC_CLASS(WRL_NL_TC_ROOT_CLASS) : WRL_NL_TC_MAJOR;
+	down->table = WRL_NL_TC_U32_TABLE(slot);
+	down->link = WRL_NL_TC_U32_LINK_NODE(slot);
+	up->base = down->base;
+	up->parent = down->parent;
+	up->table = down->table;
+	up->link = down->link;
+
+	down->offset = WRL_NL_ETHER_DST_OFFSET;
+	up->offset = WRL_NL_ETHER_SRC_OFFSET;
+
+	return ifindex;
+}
+
+static int
+wrl_backend_netlink_interface_remove(struct wrl_op *op)
+{
+	struct wrl_nl_tree down, up;
+	char ifb_name[IFNAMSIZ];
+	int ifindex, ret;
+
+	ifindex = wrl_backend_netlink_ifindex(op->interface, ifb_name, NULL);
+	if (ifindex < 0)
+		return ifindex;
+
+	/* Deleting the IFB implicitly deletes the upload tree */
+	wrl_backend_netlink_root_del(ifindex);
+	wrl_backend_netlink_redirect_del(ifindex, TC_H_MIN_INGRESS);
+	wrl_backend_netlink_redirect_del(ifindex, TC_H_MIN_EGRESS);
+
+	/* Members leave their slot of the group trees empty for the next one */
+	if (op->group.slot) {
+		wrl_backend_netlink_trees(op, &down, &up);
+
+		ret = wrl_backend_netlink_slot_flush(&down);
+		if (!ret)
+			ret = wrl_backend_netlink_slot_flush(&up);
+		if (ret)
+			return ret;
+	}
+
+	return wrl_backend_netlink_link_del(ifb_name);
+}
+
+static int
+wrl_backend_netlink_member_add(struct wrl_op *op)
+{
+	struct wrl_nl_tree down, up;
+	int ifindex;
+
+	ifindex = wrl_backend_netlink_trees(op, &down, &up);
+	if (ifindex < 0)
+		return ifindex;
+
+	if (!down.ifindex || !up.ifindex)
+		return -ENODEV;
+
+	/* Classes first, traffic reaches the group trees with the redirects */
+	wrl_backend_netlink_root_add(&down, wrl_backend_rate(op->rate.down));
+	wrl_backend_netlink_root_add(&up, wrl_backend_rate(op->rate.up));
+
+	wrl_backend_netlink_clsact_add(ifindex);
+	wrl_backend_netlink_redirect_add(ifindex, TC_H_MIN_EGRESS, down.ifindex);
+	wrl_backend_netlink_redirect_add(ifindex, TC_H_MIN_INGRESS, up.ifindex);
+
+	return 0;
+}
+
+static int
+wrl_backend_netlink_interface_add(struct wrl_op *op)
+{
+	struct wrl_nl_tree down, up;
+	char ifb_name[IFNAMSIZ];
+	int ifindex;
+	int ret;
+
+	/* Start from a clean state */
+	ret = wrl_backend_netlink_interface_remove(op);
+	if (ret)
+		return ret;
+
+	if (op->group.slot)
+		return wrl_backend_netlink_member_add(op);
+
+	ifindex = wrl_backend_netlink_ifindex(op->interface, ifb_name, NULL);
+
+	/* Create Intermediate Functional Block */
+	ret = wrl_backend_netlink_ifb_add(ifb_name);
+	if (ret)
+		return ret;
+
+	wrl_backend_netlink_trees(op, &down, &up);
+	if (!up.ifindex)
+		return -ENODEV;
+
+	/* Redirect traffic to IFB */
+	wrl_backend_netlink_clsact_add(ifindex);
+	wrl_backend_netlink_redirect_add(ifindex, TC_H_MIN_INGRESS, up.ifindex);
+
+	/* Create Queueing Discipline (Towards the interface) */
+	wrl_backend_netlink_root_add(&down, wrl_backend_rate(op->rate.down));
+
+	/* Create Queueing Discipline (From the interface) */
+	wrl_backend_netlink_root_add(&up, wrl_backend_rate(op->rate.up));
+
+	return 0;
+}
+
+static int
+wrl_backend_netlink_interface_update(struct wrl_op *op)
+{
+	struct wrl_nl_tree down, up;
+	int ifindex;
+
+	ifindex = wrl_backend_netlink_trees(op, &down, &up);
+	if (ifindex < 0)
+		return ifindex;
+
+	if (!down.ifindex || !up.ifindex)
+		return -ENODEV;
+
+	/* Classes are changed in place, client classes and filters are kept */
+	wrl_backend_netlink_root_update(&down, wrl_backend_rate(op->rate.down));
+	wrl_backend_netlink_root_update(&up, wrl_backend_rate(op->rate.up));
+
+	return 0;
+}
+
+/* Tree holding the class of the client, the slot of the member it was created on */
+static uint32_t
+wrl_backend_netlink_client_class(struct wrl_op *op, const struct wrl_nl_tree *tree, struct wrl_nl_tree *class_tree)
+{
+	*class_tree = *tree;
+	if (!op->home.slot)
+		return op->client_id + WRL_BACKEND_CLIENT_ID_OFFSET;
+
+	class_tree->base = (uint32_t)op->home.slot << WRL_GROUP_SLOT_SHIFT;
+	return op->home.id + WRL_BACKEND_CLIENT_ID_OFFSET;
+}
+
+static void
+wrl_backend_netlink_client_del(const struct wrl_nl_tree *down, const struct wrl_nl_tree *up,
+			       uint32_t id, uint32_t classid, const uint8_t *mac)
+{
+	/* Filters hold a reference to the class */
+	wrl_backend_netlink_u32_del(down->ifindex, WRL_NL_TC_U32_HANDLE(down->table, mac, id));
+	wrl_backend_netlink_class_del(down->ifindex, WRL_NL_TC_CLASS(classid));
+
+	if (up->ifindex <= 0)
+		return;
+
+	wrl_backend_netlink_u32_del(up->ifindex, WRL_NL_TC_U32_HANDLE(up->table, mac, id));
+	wrl_backend_netlink_class_del(up->ifindex, WRL_NL_TC_CLASS(classid));
+}
+
+static int
+wrl_backend_netlink_client_remove(struct wrl_op *op)
+{
+	struct wrl_nl_tree down, up, class_tree;
+	uint32_t class_id;
+	int ifindex;
+
+	ifindex = wrl_backend_netlink_trees(op, &down, &up);
+	if (ifindex < 0)
+		return ifindex;
+
+	if (down.ifindex <= 0)
+		return -ENODEV;
+
+	class_id = wrl_backend_netlink_client_class(op, &down, &class_tree);
+	wrl_backend_netlink_client_del(&down, &up, op->client_id + WRL_BACKEND_CLIENT_ID_OFFSET,
+				       class_tree.base | class_id, op->address);
+
+	return 0;
+}
+
+static int
+wrl_backend_netlink_client_add(struct wrl_op *op)
+{
+	uint32_t id = op->client_id + WRL_BACKEND_CLIENT_ID_OFFSET;
+	struct wrl_nl_tree down, up;
+	int ifindex;
+
+	ifindex = wrl_backend_netlink_trees(op, &down, &up);
+	if (ifindex < 0)
+		return ifindex;
+
+	if (!down.ifindex || !up.ifindex)
+		return -ENODEV;
+
+	wrl_backend_netlink_client_del(&down, &up, id, down.base | id, op->address);
+
+	/* Download */
+	wrl_backend_netlink_leaf_add(&down, id, wrl_backend_guarantee(op->guarantee.down, op->rate.down),
+				     wrl_backend_rate(op->rate.down));
+	wrl_backend_netlink_u32_add(&down, id, down.base | id, op->address);
+
+	/* Upload */
+	wrl_backend_netlink_leaf_add(&up, id, wrl_backend_guarantee(op->guarantee.up, op->rate.up),
+				     wrl_backend_rate(op->rate.up));
+	wrl_backend_netlink_u32_add(&up, id, up.base | id, op->address);
+
+	return 0;
+}
+
+static void
+wrl_backend_netlink_client_class_set(struct wrl_op *op, const struct wrl_nl_tree *down, const struct wrl_nl_tree *up)
+{
+	struct wrl_nl_tree class_down, class_up;
+	uint32_t id;
+
+	id = wrl_backend_netlink_client_class(op, down, &class_down);
+	wrl_backend_netlink_client_class(op, up, &class_up);
+
+	/* Classes are changed in place, filters and leaf qdiscs are kept */
+	wrl_backend_netlink_leaf_class_set(&class_down, id, wrl_backend_guarantee(op->guarantee.down, op->rate.down),
+					   wrl_backend_rate(op->rate.down));
+	wrl_backend_netlink_leaf_class_set(&class_up, id, wrl_backend_guarantee(op->guarantee.up, op->rate.up),
+					   wrl_backend_rate(op->rate.up));
+}
+
+static int
+wrl_backend_netlink_client_update(struct wrl_op *op)
+{
+	struct wrl_nl_tree down, up;
+	int ifindex;
+
+	ifindex = wrl_backend_netlink_trees(op, &down, &up);
+	if (ifindex < 0)
+		return ifindex;
+
+	if (!down.ifindex || !up.ifindex)
+		return -ENODEV;
+
+	wrl_backend_netlink_client_class_set(op, &down, &up);
+
+	return 0;
+}
+
+static int
+wrl_backend_netlink_client_move(struct wrl_op *op)
+{
+	uint32_t id = op->client_id + WRL_BACKEND_CLIENT_ID_OFFSET;
+	uint32_t from = op->from.id + WRL_BACKEND_CLIENT_ID_OFFSET;
+	uint32_t from_table = WRL_NL_TC_U32_TABLE(op->from.slot);
+	struct wrl_nl_tree down, up, class_tree;
+	uint32_t class_id;
+	int ifindex;
+
+	ifindex = wrl_backend_netlink_trees(op, &down, &up);
+	if (ifindex < 0)
+		return ifindex;
+
+	if (!down.ifindex || !up.ifindex)
+		return -ENODEV;
+
+	class_id = wrl_backend_netlink_client_class(op, &down, &class_tree);
+
+	/* Members share the trees, both filters lead to the same class while the old ones go */
+	wrl_backend_netlink_u32_del(down.ifindex, WRL_NL_TC_U32_HANDLE(down.table, op->address, id));
+	wrl_backend_netlink_u32_del(up.ifindex, WRL_NL_TC_U32_HANDLE(up.table, op->address, id));
+	wrl_backend_netlink_u32_add(&down, id, class_tree.base | class_id, op->address);
+	wrl_backend_netlink_u32_add(&up, id, class_tree.base | class_id, op->address);
+	wrl_backend_netlink_u32_del(down.ifindex, WRL_NL_TC_U32_HANDLE(from_table, op->address, from));
+	wrl_backend_netlink_u32_del(up.ifindex, WRL_NL_TC_U32_HANDLE(from_table, op->address, from));
+
+	/* Class and queue stay with their backlog and tokens, rates follow the new interface */
+	wrl_backend_netlink_client_class_set(op, &down, &up);
+
+	return 0;
+}
+
+static int
+wrl_backend_netlink_group_remove(struct wrl_op *op)
+{
+	char down_name[IFNAMSIZ], up_name[IFNAMSIZ];
+	int ret;
+
+	wrl_backend_netlink_group_names(op->group.name, down_name, up_name);
+
+	/* Members were removed before, the trees go with the IFBs */
+	ret = wrl_backend_netlink_link_del(down_name);
+	if (ret)
+		return ret;
+
+	return wrl_backend_netlink_link_del(up_name);
+}
+
+/* Trees of a group, the root class carries the aggregate and the default class unknown clients */
+static int
+wrl_backend_netlink_group_trees(struct wrl_op *op, struct wrl_nl_tree *down, struct wrl_nl_tree *up)
+{
+	char down_name[IFNAMSIZ], up_name[IFNAMSIZ];
+
+	memset(down, 0, sizeof(*down));
+	memset(up, 0, sizeof(*up));
+
+	wrl_backend_netlink_group_names(op->group.name, down_name, up_name);
+	down->ifindex = if_nametoindex(down_name);
+	up->ifindex = if_nametoindex(up_name);
+	down->parent = WRL_NL_TC_MAJOR;
+	up->parent = WRL_NL_TC_MAJOR;
+
+	return down->ifindex && up->ifindex ? 0 : -ENODEV;
+}
+
+static int
+wrl_backend_netlink_group_add(struct wrl_op *op)
+{
+	char down_name[IFNAMSIZ], up_name[IFNAMSIZ];
+	struct wrl_nl_tree down, up;
+	int ret;
+
+	/* Start from a clean state */
+	ret = wrl_backend_netlink_group_remove(op);
+	if (ret)
+		return ret;
+
+	wrl_backend_netlink_group_names(op->group.name, down_name, up_name);
+
+	ret = wrl_backend_netlink_ifb_add(down_name);
+	if (!ret)
+		ret = wrl_backend_netlink_ifb_add(up_name);
+	if (!ret)
+		ret = wrl_backend_netlink_group_trees(op, &down, &up);
+	if (ret)
+		return ret;
+
+	wrl_backend_netlink_root_add(&down, wrl_backend_rate(op->rate.down));
+	wrl_backend_netlink_root_add(&up, wrl_backend_rate(op->rate.up));
+
+	return 0;
+}
+
+static int
+wrl_backend_netlink_group_update(struct wrl_op *op)
+{
+	struct wrl_nl_tree down, up;
+	int ret;
+
+	ret = wrl_backend_netlink_group_trees(op, &down, &up);
+	if (ret)
+		return ret;
+
+	wrl_backend_netlink_root_update(&down, wrl_backend_rate(op->rate.down));
+	wrl_backend_netlink_root_update(&up, wrl_backend_rate(op->rate.up));
+
+	return 0;
+}
+
+static void
+wrl_backend_netlink_commit(struct wrl_transaction *transaction)
+{
+	struct wrl_op *op;
+	int ret = 0;
+
+	list_for_each_entry(op, &transaction->ops, head) {
+		op->ret = 0;
+
+		/* Kernel errors are collected per operation when the batch is acknowledged */
+		wrl_nl_op_ret = &op->ret;
+
+		switch (op->type) {
+		case WRL_OP_INTERFACE_ADD:
+			ret = wrl_backend_netlink_interface_add(op);
+			break;
+		case WRL_OP_INTERFACE_REMOVE:
+			ret = wrl_backend_netlink_interface_remove(op);
+			break;
+		case WRL_OP_CLIENT_ADD:
+			ret = wrl_backend_netlink_client_add(op);
+			break;
+		case WRL_OP_CLIENT_REMOVE:
+			ret = wrl_backend_netlink_client_remove(op);
+			break;
+		case WRL_OP_CLIENT_UPDATE:
+			ret = wrl_backend_netlink_client_update(op);
+			break;
+		case WRL_OP_INTERFACE_UPDATE:
+			ret = wrl_backend_netlink_interface_update(op);
+			break;
+		case WRL_OP_GROUP_ADD:
+			ret = wrl_backend_netlink_group_add(op);
+			break;
+		case WRL_OP_GROUP_REMOVE:
+			ret = wrl_backend_netlink_group_remove(op);
+			break;
+		case WRL_OP_GROUP_UPDATE:
+			ret = wrl_backend_netlink_group_update(op);
+			break;
+		case WRL_OP_CLIENT_MOVE:
+			ret = wrl_backend_netlink_client_move(op);
+			break;
+		case WRL_OP_CLIENT_AIRTIME:
+			ret = wrl_airtime_set(op->interface, op->address, op->airtime_weight);
+			break;
+		}
+
+		if (ret && !op->ret)
+			op->ret = ret;
+	}
+
+	wrl_nl_op_ret = NULL;
+	wrl_nl_batch_flush(&rtnl, &batch);
+
+	/* Netlink transactions complete synchronously */
+	transaction->complete(transaction);
+}
+
+static int
+wrl_backend_netlink_init(void)
+{
+	return wrl_nl_open(&rtnl, NETLINK_ROUTE);
+}
+
+static void
+wrl_backend_netlink_deinit(void)
+{
+	wrl_nl_close(&rtnl);
+}
+
+const struct wrl_backend wrl_backend_netlink = {
+	.name = "netlink",
+	.init = wrl_backend_netlink_init,
+	.deinit = wrl_backend_netlink_deinit,
+	.commit = wrl_backend_netlink_commit,
+	.counters = wrl_backend_tc_counters,
+	.adopt = wrl_backend_tc_adopt,
+	.groups = 1,
+};
@@ -0,0 +1,383 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <libubox/uloop.h>
+
+#include "airtime.h"
+#include "backend.h"
+#include "log.h"
+#include "mac.h"
+#include "stats.h"
+
+#define WRL_BACKEND_SHELL_PATH "/lib/wireless-rate-limiter"
+
+/* Marker of per-operation exit codes in the output of a job script */
+#define WRL_BACKEND_SHELL_RESULT "wireless-rate-limiter-result"
+
+/* Interfaces are shaped in parallel, bounded to this number of shells */
+#define WRL_BACKEND_SHELL_MAX_JOBS 4
+
+#define WRL_BACKEND_SHELL_TEMPLATE "/tmp/wireless-rate-limiter.XXXXXX"
+
+/* All operations of a single interface, executed in order by one shell */
+struct wrl_backend_shell_job {
+	struct list_head head;
+	struct uloop_process proc;
+
+	char interface[32];
+	struct wrl_op **ops;
+	int num_ops;
+
+	char script[sizeof(WRL_BACKEND_SHELL_TEMPLATE)];
+	char results[sizeof(WRL_BACKEND_SHELL_TEMPLATE)];
+};
+
+static struct {
+	struct wrl_transaction *transaction;
+	struct list_head queued;
+	int running;
+} wrl_backend_shell_state;
+
+static void
+wrl_backend_shell_command(struct wrl_op *op, char *buf, size_t len)
+{
+	char mac_string[18];
+	char group[32] = "";
+	char member[48] = "";
+
+	/* Members are shaped within the trees of their group */
+	if (op->group.slot) {
+		snprintf(group, sizeof(group), " %s %u", op->group.name, op->group.slot);
+
+		/* Filter node of the client, its class might be on another member */
+		snprintf(member, sizeof(member), "%s %u", group, op->client_id + WRL_BACKEND_CLIENT_ID_OFFSET);
+	}
+
+	switch (op->type) {
+	case WRL_OP_INTERFACE_ADD:
+		snprintf(buf, len,
+			 "sh " WRL_BACKEND_SHELL_PATH "/htb-netdev.sh add %s %ukbit %ukbit%s",
+			 op->interface, wrl_backend_rate(op->rate.down), wrl_backend_rate(op->rate.up), group);
+		break;
+	case WRL_OP_INTERFACE_UPDATE:
+		snprintf(buf, len,
+			 "sh " WRL_BACKEND_SHELL_PATH "/htb-netdev.sh update %s %ukbit %ukbit%s",
+			 op->interface, wrl_backend_rate(op->rate.down), wrl_backend_rate(op->rate.up), group);
+		break;
+	case WRL_OP_INTERFACE_REMOVE:
+		if (op->group.slot)
+			snprintf(buf, len,
+				 "sh " WRL_BACKEND_SHELL_PATH "/htb-netdev.sh remove %s %ukbit %ukbit%s",
+				 op->interface, wrl_backend_rate(op->rate.down), wrl_backend_rate(op->rate.up), group);
+		else
+			snprintf(buf, len,
+				 "sh " WRL_BACKEND_SHELL_PATH "/htb-netdev.sh remove %s",
+				 op->interface);
+		break;
+	case WRL_OP_CLIENT_ADD:
+		wrl_mac_to_string(op->address, mac_string);
+		snprintf(buf, len,
+			 "sh " WRL_BACKEND_SHELL_PATH "/htb-client.sh add %u %s %s %ukbit %ukbit %ukbit %ukbit%s",
+			 wrl_backend_class_id(op), op->interface, mac_string,
+			 wrl_backend_rate(op->rate.down), wrl_backend_rate(op->rate.up),
+			 wrl_backend_guarantee(op->guarantee.down, op->rate.down),
+			 wrl_backend_guarantee(op->guarantee.up, op->rate.up), member);
+		break;
+	case WRL_OP_CLIENT_UPDATE:
+		wrl_mac_to_string(op->address, mac_string);
+		snprintf(buf, len,
+			 "sh " WRL_BACKEND_SHELL_PATH "/htb-client.sh update %u %s %s %ukbit %ukbit %ukbit %ukbit%s",
+			 wrl_backend_class_id(op), op->interface, mac_string,
+			 wrl_backend_rate(op->rate.down), wrl_backend_rate(op->rate.up),
+			 wrl_backend_guarantee(op->guarantee.down, op->rate.down),
+			 wrl_backend_guarantee(op->guarantee.up, op->rate.up), member);
+		break;
+	case WRL_OP_CLIENT_REMOVE:
+		wrl_mac_to_string(op->address, mac_string);
+		snprintf(buf, len,
+			 "sh " WRL_BACKEND_SHELL_PATH "/htb-client.sh remove %u %s %s%s%s",
+			 wrl_backend_class_id(op), op->interface, mac_string,
+			 op->group.slot ? " - - - -" : "", member);
+		break;
+	case WRL_OP_CLIENT_MOVE:
+		wrl_mac_to_string(op->address, mac_string);
+		snprintf(buf, len,
+			 "sh " WRL_BACKEND_SHELL_PATH "/htb-client.sh move %u %s %s %ukbit %ukbit %ukbit %ukbit%s %u %u",
+			 wrl_backend_class_id(op), op->interface, mac_string,
+			 wrl_backend_rate(op->rate.down), wrl_backend_rate(op->rate.up),
+			 wrl_backend_guarantee(op->guarantee.down, op->rate.down),
+			 wrl_backend_guarantee(op->guarantee.up, op->rate.up), member,
+			 op->from.slot, op->from.id + WRL_BACKEND_CLIENT_ID_OFFSET);
+		break;
+	case WRL_OP_GROUP_ADD:
+		snprintf(buf, len,
+			 "sh " WRL_BACKEND_SHELL_PATH "/htb-group.sh add %s %ukbit %ukbit",
+			 op->group.name, wrl_backend_rate(op->rate.down), wrl_backend_rate(op->rate.up));
+		break;
+	case WRL_OP_GROUP_UPDATE:
+		snprintf(buf, len,
+			 "sh " WRL_BACKEND_SHELL_PATH "/htb-group.sh update %s %ukbit %ukbit",
+			 op->group.name, wrl_backend_rate(op->rate.down), wrl_backend_rate(op->rate.up));
+		break;
+	case WRL_OP_GROUP_REMOVE:
+		snprintf(buf, len,
+			 "sh " WRL_BACKEND_SHELL_PATH "/htb-group.sh remove %s",
+			 op->group.name);
+		break;
+	case WRL_OP_CLIENT_AIRTIME:
+		/* Set directly on commit, never part of a batch */
+		break;
+	}
+}
+
+static void wrl_backend_shell_job_start_next(void);
+
+static void
+wrl_backend_shell_job_results(struct wrl_backend_shell_job *job)
+{
+	char line[256];
+	int index, status;
+	FILE *results;
+
+	results = fopen(job->results, "r");
+	if (!results) {
+		MSG(ERROR, "Failed to read results of interface %s: %s\n", job->interface, strerror(errno));
+		return;
+	}
+
+	while (fgets(line, sizeof(line), results)) {
+		if (sscanf(line, WRL_BACKEND_SHELL_RESULT " %d %d", &index, &status) != 2)
+			continue;
+
+		if (index < 0 || index >= job->num_ops)
+			continue;
+
+		job->ops[index]->ret = status;
+		if (status)
+			wrl_stats.counters.backend_failures++;
+	}
+
+	fclose(results);
+}
+
+static void
+wrl_backend_shell_job_finish(struct wrl_backend_shell_job *job)
+{
+	struct wrl_transaction *transaction;
+
+	if (job->script[0])
+		unlink(job->script);
+	if (job->results[0])
+		unlink(job->results);
+
+	free(job->ops);
+	free(job);
+
+	wrl_backend_shell_job_start_next();
+
+	/* Completed already if a failing job was finished while starting the next ones */
+	transaction = wrl_backend_shell_state.transaction;
+	if (!transaction || wrl_backend_shell_state.running ||
+	    !list_empty(&wrl_backend_shell_state.queued))
+		return;
+
+	wrl_backend_shell_state.transaction = NULL;
+	transaction->complete(transaction);
+}
+
+static void
+wrl_backend_shell_job_exited(struct uloop_process *proc, int ret)
+{
+	struct wrl_backend_shell_job *job = container_of(proc, struct wrl_backend_shell_job, proc);
+
+	MSG(DEBUG, "Batch for interface %s finished with status %d\n", job->interface, ret);
+
+	wrl_backend_shell_job_results(job);
+	wrl_backend_shell_state.running--;
+	wrl_backend_shell_job_finish(job);
+}
+
+static int
+wrl_backend_shell_job_script(struct wrl_backend_shell_job *job)
+{
+	char command_buffer[512];
+	FILE *script;
+	int fd;
+
+	strcpy(job->script, WRL_BACKEND_SHELL_TEMPLATE);
+	fd = mkstemp(job->script);
+	if (fd < 0) {
+		MSG(ERROR, "Failed to create batch script: %s\n", strerror(errno));
+		job->script[0] = 0;
+		return -errno;
+	}
+
+	script = fdopen(fd, "w");
+	if (!script) {
+		MSG(ERROR, "Failed to open batch script: %s\n", strerror(errno));
+		close(fd);
+		return -errno;
+	}
+
+	wrl_stats.counters.backend_commands += job->num_ops;
+
+	for (int i = 0; i < job->num_ops; i++) {
+		wrl_backend_shell_command(job->ops[i], command_buffer, sizeof(command_buffer));
+		MSG(DEBUG, "Queueing command: %s\n", command_buffer);
+		fprintf(script, "%s\necho \"" WRL_BACKEND_SHELL_RESULT " %d $?\"\n", command_buffer, i);
+	}
+
+	fclose(script);
+
+	return 0;
+}
+
+static int
+wrl_backend_shell_job_spawn(struct wrl_backend_shell_job *job)
+{
+	int fd, ret;
+	pid_t pid;
+
+	ret = wrl_backend_shell_job_script(job);
+	if (ret)
+		return ret;
+
+	/* Results are written to a file and read once the shell exited */
+	strcpy(job->results, WRL_BACKEND_SHELL_TEMPLATE);
+	fd = mkstemp(job->results);
+	if (fd < 0) {
+		MSG(ERROR, "Failed to create result file: %s\n", strerror(errno));
+		job->results[0] = 0;
+		return -errno;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		MSG(ERROR, "Failed to execute batch script: %s\n", strerror(errno));
+		close(fd);
+		return -errno;
+	}
+
+	if (pid == 0) {
+		dup2(fd, STDOUT_FILENO);
+		close(fd);
+		execl("/bin/sh", "sh", job->script, NULL);
+		_exit(127);
+	}
+
+	close(fd);
+
+	job->proc.pid = pid;
+	job->proc.cb = wrl_backend_shell_job_exited;
+	uloop_process_add(&job->proc);
+
+	MSG(DEBUG, "Executing batch of %d commands for interface %s\n", job->num_ops, job->interface);
+
+	return 0;
+}
+
+static void
+wrl_backend_shell_job_start_next(void)
+{
+	struct wrl_backend_shell_job *job;
+
+	while (wrl_backend_shell_state.running < WRL_BACKEND_SHELL_MAX_JOBS &&
+	       !list_empty(&wrl_backend_shell_state.queued)) {
+		job = list_first_entry(&wrl_backend_shell_state.queued, struct wrl_backend_shell_job, head);
+		list_del(&job->head);
+
+		if (wrl_backend_shell_job_spawn(job)) {
+			/* Operations of the job keep their error */
+			wrl_backend_shell_job_finish(job);
+			return;
+		}
+
+		wrl_backend_shell_state.running++;
+	}
+}
+
+static struct wrl_backend_shell_job *
+wrl_backend_shell_job_get(const char *interface)
+{
+	struct wrl_backend_shell_job *job;
+
+	list_for_each_entry(job, &wrl_backend_shell_state.queued, head) {
+		if (!strcmp(job->interface, interface))
+			return job;
+	}
+
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		return NULL;
+
+	strncpy(job->interface, interface, sizeof(job->interface) - 1);
+	list_add_tail(&job->head, &wrl_backend_shell_state.queued);
+
+	return job;
+}
+
+static void
+wrl_backend_shell_commit(struct wrl_transaction *transaction)
+{
+	struct wrl_backend_shell_job *job;
+	struct wrl_op **ops;
+	struct wrl_op *op;
+
+	wrl_backend_shell_state.transaction = transaction;
+
+	/* One job per interface keeps the order of its operations, members share the job of their group */
+	list_for_each_entry(op, &transaction->ops, head) {
+		/* Not shaping, nothing to order against the scripts */
+		if (op->type == WRL_OP_CLIENT_AIRTIME) {
+			op->ret = wrl_airtime_set(op->interface, op->address, op->airtime_weight);
+			continue;
+		}
+
+		/* Operations without reported exit code failed */
+		op->ret = -EIO;
+
+		job = wrl_backend_shell_job_get(op->group.slot || !op->interface[0] ? op->group.name : op->interface);
+		if (!job)
+			continue;
+
+		ops = realloc(job->ops, (job->num_ops + 1) * sizeof(*ops));
+		if (!ops)
+			continue;
+
+		ops[job->num_ops++] = op;
+		job->ops = ops;
+	}
+
+	if (list_empty(&wrl_backend_shell_state.queued)) {
+		wrl_backend_shell_state.transaction = NULL;
+		transaction->complete(transaction);
+		return;
+	}
+
+	wrl_backend_shell_job_start_next();
+}
+
+static int
+wrl_backend_shell_init(void)
+{
+	INIT_LIST_HEAD(&wrl_backend_shell_state.queued);
+	wrl_backend_shell_state.running = 0;
+
+	return 0;
+}
+
+const struct wrl_backend wrl_backend_shell = {
+	.name = "shell",
+	.init = wrl_backend_shell_init,
+	.commit = wrl_backend_shell_commit,
+	.counters = wrl_backend_tc_counters,
+	.adopt = wrl_backend_tc_adopt,
+	.groups = 1,
+};
@@ -0,0 +1,579 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <net/if.h>
+#include <linux/rtnetlink.h>
+#include <linux/pkt_sched.h>
+#include <linux/pkt_cls.h>
+#include <linux/gen_stats.h>
+
+#include "backend.h"
+#include "log.h"
+#include "netlink.h"
+
+/* Layout of the HTB tree, see backend-netlink.c and htb-shared.sh */
+#define WRL_TC_MAJOR		(1 << 16)
+#define WRL_TC_ROOT_CLASS	1
+#define WRL_TC_DEFAULT_CLASS	2
+
+#define WRL_TC_U32_TABLE	0x00100000
+#define WRL_TC_U32_BUCKETS	256
+#define WRL_TC_U32_LINK		0x80000001
+
+#define WRL_TC_ETHER_DST_OFFSET	-14
+#define WRL_TC_ETHER_SRC_OFFSET	-8
+
+static struct wrl_nl rtnl = {
+	.fd = -1,
+};
+
+/* Class of a device by minor, grown on demand and reused */
+struct wrl_tc_class {
+	struct wrl_counters counters;
+
+	/* byte/s */
+	uint64_t rate;
+	uint64_t ceil;
+
+	/* Address matched by the filter of the class */
+	uint8_t address[6];
+
+	uint8_t valid;
+	uint8_t leaf;
+	uint8_t filter;
+};
+
+struct wrl_tc_device {
+	struct wrl_tc_class *classes;
+	uint32_t num_classes;
+	int ifindex;
+
+	/* Offset of the client address in filters */
+	int offset;
+
+	/* First minor of the interface in group trees, classes are indexed relative to it */
+	uint32_t base;
+
+	uint8_t root;
+	uint8_t table;
+	uint8_t link;
+	uint8_t redirect;
+};
+
+/* Download on the interface, upload on its IFB */
+static struct wrl_tc_device wrl_tc_devices[2];
+
+static struct wrl_tc_class *
+wrl_tc_class_get(struct wrl_tc_device *dev, uint32_t minor)
+{
+	struct wrl_tc_class *classes;
+	uint32_t num_classes;
+
+	if (minor < dev->num_classes)
+		return &dev->classes[minor];
+
+	num_classes = minor + 1 > WRL_CLIENT_TABLE_LIMIT + WRL_BACKEND_CLIENT_ID_OFFSET ?
+		      minor + 1 : WRL_CLIENT_TABLE_LIMIT + WRL_BACKEND_CLIENT_ID_OFFSET;
+
+	classes = realloc(dev->classes, num_classes * sizeof(*classes));
+	if (!classes)
+		return NULL;
+
+	memset(&classes[dev->num_classes], 0, (num_classes - dev->num_classes) * sizeof(*classes));
+	dev->classes = classes;
+	dev->num_classes = num_classes;
+
+	return &dev->classes[minor];
+}
+
+/* Class of a minor within the range of the interface */
+static struct wrl_tc_class *
+wrl_tc_class_minor(struct wrl_tc_device *dev, uint32_t minor, int *err)
+{
+	struct wrl_tc_class *class;
+
+	*err = 0;
+	if (dev->base && (minor < dev->base || minor - dev->base >= 1 << WRL_GROUP_SLOT_SHIFT))
+		return NULL;
+
+	class = wrl_tc_class_get(dev, minor - dev->base);
+	if (!class)
+		*err = -ENOMEM;
+
+	return class;
+}
+
+static int
+wrl_tc_msg_parse(struct nlmsghdr *nlh, struct nlattr **tb)
+{
+	struct tcmsg *tcm = NLMSG_DATA(nlh);
+	int len;
+
+	len = nlh->nlmsg_len - NLMSG_SPACE(sizeof(*tcm));
+	if (len < 0)
+		return -1;
+
+	wrl_nl_attr_parse(tb, TCA_MAX, (uint8_t *)tcm + NLMSG_ALIGN(sizeof(*tcm)), len);
+
+	return 0;
+}
+
+static int
+wrl_tc_kind_is(struct nlattr **tb, const char *kind)
+{
+	return tb[TCA_KIND] && !strcmp(wrl_nl_attr_data(tb[TCA_KIND]), kind);
+}
+
+static void
+wrl_tc_stats_parse(struct nlattr **tb, struct wrl_counters *counters)
+{
+	struct nlattr *stats[TCA_STATS_MAX + 1];
+	struct gnet_stats_basic basic = {};
+	struct gnet_stats_queue queue = {};
+
+	memset(counters, 0, sizeof(*counters));
+	if (!tb[TCA_STATS2])
+		return;
+
+	wrl_nl_attr_parse(stats, TCA_STATS_MAX, wrl_nl_attr_data(tb[TCA_STATS2]), wrl_nl_attr_len(tb[TCA_STATS2]));
+
+	/* Older kernels send shorter structures */
+	if (stats[TCA_STATS_BASIC])
+		memcpy(&basic, wrl_nl_attr_data(stats[TCA_STATS_BASIC]),
+		       wrl_nl_attr_len(stats[TCA_STATS_BASIC]) < sizeof(basic) ?
+		       wrl_nl_attr_len(stats[TCA_STATS_BASIC]) : sizeof(basic));
+
+	if (stats[TCA_STATS_QUEUE])
+		memcpy(&queue, wrl_nl_attr_data(stats[TCA_STATS_QUEUE]),
+		       wrl_nl_attr_len(stats[TCA_STATS_QUEUE]) < sizeof(queue) ?
+		       wrl_nl_attr_len(stats[TCA_STATS_QUEUE]) : sizeof(queue));
+
+	counters->bytes = basic.bytes;
+	counters->packets = basic.packets;
+	counters->drops = queue.drops;
+	counters->overlimits = queue.overlimits;
+	counters->backlog = queue.backlog;
+
+	/* Packet counter of the basic stats wraps at 32 bit */
+	if (stats[TCA_STATS_PKT64] && wrl_nl_attr_len(stats[TCA_STATS_PKT64]) == sizeof(uint64_t))
+		memcpy(&counters->packets, wrl_nl_attr_data(stats[TCA_STATS_PKT64]), sizeof(uint64_t));
+}
+
+static void
+wrl_tc_htb_parse(struct nlattr **tb, struct wrl_tc_class *class)
+{
+	struct nlattr *options[TCA_HTB_MAX + 1];
+	struct tc_htb_opt *opt;
+
+	if (!tb[TCA_OPTIONS])
+		return;
+
+	wrl_nl_attr_parse(options, TCA_HTB_MAX, wrl_nl_attr_data(tb[TCA_OPTIONS]), wrl_nl_attr_len(tb[TCA_OPTIONS]));
+	if (!options[TCA_HTB_PARMS] || wrl_nl_attr_len(options[TCA_HTB_PARMS]) < sizeof(*opt))
+		return;
+
+	opt = wrl_nl_attr_data(options[TCA_HTB_PARMS]);
+	class->rate = opt->rate.rate;
+	class->ceil = opt->ceil.rate;
+
+	/* Rates above 32 bit are sent separately */
+	if (options[TCA_HTB_RATE64])
+		memcpy(&class->rate, wrl_nl_attr_data(options[TCA_HTB_RATE64]), sizeof(uint64_t));
+	if (options[TCA_HTB_CEIL64])
+		memcpy(&class->ceil, wrl_nl_attr_data(options[TCA_HTB_CEIL64]), sizeof(uint64_t));
+}
+
+static int
+wrl_tc_class_cb(struct nlmsghdr *nlh, void *priv)
+{
+	struct wrl_tc_device *dev = priv;
+	struct tcmsg *tcm = NLMSG_DATA(nlh);
+	struct nlattr *tb[TCA_MAX + 1];
+	struct wrl_counters counters;
+	struct wrl_tc_class *class;
+	int err;
+
+	if (nlh->nlmsg_type != RTM_NEWTCLASS || tcm->tcm_ifindex != dev->ifindex ||
+	    TC_H_MAJ(tcm->tcm_handle) != WRL_TC_MAJOR || wrl_tc_msg_parse(nlh, tb) ||
+	    !wrl_tc_kind_is(tb, "htb"))
+		return 0;
+
+	class = wrl_tc_class_minor(dev, TC_H_MIN(tcm->tcm_handle), &err);
+	if (!class)
+		return err;
+
+	/* Backlog of leaf classes includes their qdisc, drops are taken from the qdisc */
+	wrl_tc_stats_parse(tb, &counters);
+	class->counters.bytes = counters.bytes;
+	class->counters.packets = counters.packets;
+	class->counters.overlimits = counters.overlimits;
+	class->counters.backlog = counters.backlog;
+
+	wrl_tc_htb_parse(tb, class);
+	class->valid = 1;
+
+	return 0;
+}
+
+static int
+wrl_tc_qdisc_cb(struct nlmsghdr *nlh, void *priv)
+{
+	struct wrl_tc_device *dev = priv;
+	struct tcmsg *tcm = NLMSG_DATA(nlh);
+	struct nlattr *tb[TCA_MAX + 1];
+	struct wrl_counters counters;
+	struct wrl_tc_class *class, *root;
+	int err;
+
+	if (nlh->nlmsg_type != RTM_NEWQDISC || tcm->tcm_ifindex != dev->ifindex || wrl_tc_msg_parse(nlh, tb))
+		return 0;
+
+	if (tcm->tcm_parent == TC_H_ROOT) {
+		dev->root = tcm->tcm_handle == WRL_TC_MAJOR && wrl_tc_kind_is(tb, "htb");
+		return 0;
+	}
+
+	if (TC_H_MAJ(tcm->tcm_parent) != WRL_TC_MAJOR)
+		return 0;
+
+	class = wrl_tc_class_minor(dev, TC_H_MIN(tcm->tcm_parent), &err);
+	if (!class)
+		return err;
+
+	root = wrl_tc_class_get(dev, WRL_TC_ROOT_CLASS);
+	if (!root)
+		return -ENOMEM;
+
+	/* Leaf qdiscs are created with the minor of their class as major */
+	class->leaf = tcm->tcm_handle == TC_H_MIN(tcm->tcm_parent) << 16 && wrl_tc_kind_is(tb, "fq_codel");
+
+	/* Leaf qdiscs count overflow as well as AQM drops */
+	wrl_tc_stats_parse(tb, &counters);
+	class->counters.drops += counters.drops;
+	root->counters.drops += counters.drops;
+
+	return 0;
+}
+
+static int
+wrl_tc_u32_address(struct wrl_tc_device *dev, struct nlattr *attr, uint8_t *address)
+{
+	struct tc_u32_sel *sel = wrl_nl_attr_data(attr);
+	struct tc_u32_key *key;
+	int byte_offset;
+	int i, k;
+
+	if (wrl_nl_attr_len(attr) < sizeof(*sel) ||
+	    wrl_nl_attr_len(attr) < sizeof(*sel) + sel->nkeys * sizeof(*key))
+		return -1;
+
+	/* Every byte of the address has to be matched exactly */
+	for (i = 0; i < 6; i++) {
+		byte_offset = dev->offset + i;
+
+		for (k = 0; k < sel->nkeys; k++) {
+			key = &sel->keys[k];
+			if (key->off == (byte_offset & ~3) && ((uint8_t *)&key->mask)[byte_offset & 3] == 0xff)
+				break;
+		}
+
+		if (k == sel->nkeys)
+			return -1;
+
+		address[i] = ((uint8_t *)&key->val)[byte_offset & 3];
+	}
+
+	return 0;
+}
+
+static int
+wrl_tc_filter_cb(struct nlmsghdr *nlh, void *priv)
+{
+	struct wrl_tc_device *dev = priv;
+	struct tcmsg *tcm = NLMSG_DATA(nlh);
+	struct nlattr *options[TCA_U32_MAX + 1];
+	struct nlattr *tb[TCA_MAX + 1];
+	struct wrl_tc_class *class;
+	uint32_t classid;
+
+	if (nlh->nlmsg_type != RTM_NEWTFILTER || tcm->tcm_ifindex != dev->ifindex || wrl_tc_msg_parse(nlh, tb))
+		return 0;
+
+	/* Redirect of the interface ingress to the IFB */
+	if (tcm->tcm_parent == TC_H_MAKE(TC_H_CLSACT, TC_H_MIN_INGRESS)) {
+		if (wrl_tc_kind_is(tb, "matchall"))
+			dev->redirect = 1;
+		return 0;
+	}
+
+	if (!wrl_tc_kind_is(tb, "u32") || !tb[TCA_OPTIONS])
+		return 0;
+
+	wrl_nl_attr_parse(options, TCA_U32_MAX, wrl_nl_attr_data(tb[TCA_OPTIONS]), wrl_nl_attr_len(tb[TCA_OPTIONS]));
+
+	if (tcm->tcm_handle == WRL_TC_U32_TABLE) {
+		dev->table = options[TCA_U32_DIVISOR] &&
+			     *(uint32_t *)wrl_nl_attr_data(options[TCA_U32_DIVISOR]) == WRL_TC_U32_BUCKETS;
+		return 0;
+	}
+
+	if (tcm->tcm_handle == WRL_TC_U32_LINK) {
+		dev->link = options[TCA_U32_LINK] &&
+			    *(uint32_t *)wrl_nl_attr_data(options[TCA_U32_LINK]) == WRL_TC_U32_TABLE;
+		return 0;
+	}
+
+	/* Client filters of the hash table */
+	if (TC_U32_HTID(tcm->tcm_handle) != WRL_TC_U32_TABLE || !TC_U32_NODE(tcm->tcm_handle) ||
+	    !options[TCA_U32_CLASSID] || !options[TCA_U32_SEL])
+		return 0;
+
+	classid = *(uint32_t *)wrl_nl_attr_data(options[TCA_U32_CLASSID]);
+	if (TC_H_MAJ(classid) != WRL_TC_MAJOR)
+		return 0;
+
+	class = wrl_tc_class_get(dev, TC_H_MIN(classid));
+	if (!class)
+		return -ENOMEM;
+
+	/* A second filter for the same class can't be adopted */
+	if (class->filter || wrl_tc_u32_address(dev, options[TCA_U32_SEL], class->address))
+		class->filter = UINT8_MAX;
+	else
+		class->filter = 1;
+
+	return 0;
+}
+
+static int
+wrl_tc_device_dump(struct wrl_tc_device *dev, uint16_t type, uint32_t parent, wrl_nl_cb cb)
+{
+	struct wrl_nl_msg msg;
+	struct tcmsg *tcm;
+
+	tcm = wrl_nl_msg_init(&msg, type, 0, sizeof(*tcm));
+	tcm->tcm_family = AF_UNSPEC;
+	tcm->tcm_ifindex = dev->ifindex;
+	tcm->tcm_parent = parent;
+
+	return wrl_nl_dump(&rtnl, &msg, cb, dev);
+}
+
+static int
+wrl_tc_device_read(struct wrl_tc_device *dev, const char *ifname, int offset, uint32_t base, int filters)
+{
+	int ret;
+
+	dev->ifindex = if_nametoindex(ifname);
+	if (!dev->ifindex)
+		return -ENODEV;
+
+	dev->offset = offset;
+	dev->base = base;
+	dev->root = 0;
+	dev->table = 0;
+	dev->link = 0;
+	dev->redirect = 0;
+	if (dev->classes)
+		memset(dev->classes, 0, dev->num_classes * sizeof(*dev->classes));
+
+	/* One dump for all classes and one for all qdiscs of the device */
+	ret = wrl_tc_device_dump(dev, RTM_GETTCLASS, 0, wrl_tc_class_cb);
+	if (ret)
+		return ret;
+
+	ret = wrl_tc_device_dump(dev, RTM_GETQDISC, 0, wrl_tc_qdisc_cb);
+	if (ret || !filters || !dev->root)
+		return ret;
+
+	ret = wrl_tc_device_dump(dev, RTM_GETTFILTER, WRL_TC_MAJOR, wrl_tc_filter_cb);
+	if (ret || offset != WRL_TC_ETHER_DST_OFFSET)
+		return ret;
+
+	return wrl_tc_device_dump(dev, RTM_GETTFILTER, TC_H_MAKE(TC_H_CLSACT, TC_H_MIN_INGRESS), wrl_tc_filter_cb);
+}
+
+static int
+wrl_tc_open(const char *interface, char *ifb_name)
+{
+	int ret;
+
+	if (rtnl.fd < 0) {
+		ret = wrl_nl_open(&rtnl, NETLINK_ROUTE);
+		if (ret)
+			return ret;
+	}
+
+	if (snprintf(ifb_name, IFNAMSIZ, "%s" WRL_BACKEND_IFB_SUFFIX, interface) >= IFNAMSIZ)
+		return -ENAMETOOLONG;
+
+	return 0;
+}
+
+static void
+wrl_tc_device_counters(struct wrl_tc_device *dev, enum wrl_direction direction,
+		       wrl_backend_counters_cb cb, void *priv)
+{
+	struct wrl_tc_class *class;
+	uint32_t minor;
+
+	for (minor = 0; minor < dev->num_classes; minor++) {
+		class = &dev->classes[minor];
+		if (!class->valid)
+			continue;
+
+		if (minor == WRL_TC_ROOT_CLASS)
+			cb(priv, direction, WRL_BACKEND_COUNTERS_INTERFACE, &class->counters);
+		else if (minor >= WRL_BACKEND_CLIENT_ID_OFFSET)
+			cb(priv, direction, minor - WRL_BACKEND_CLIENT_ID_OFFSET, &class->counters);
+	}
+}
+
+int
+wrl_backend_tc_counters(const char *interface, const struct wrl_group_ref *group, wrl_backend_counters_cb cb, void *priv)
+{
+	struct wrl_tc_device *down = &wrl_tc_devices[WRL_DIRECTION_DOWN];
+	struct wrl_tc_device *up = &wrl_tc_devices[WRL_DIRECTION_UP];
+	uint32_t base = wrl_backend_group_base(group);
+	char down_name[IFNAMSIZ];
+	char ifb_name[IFNAMSIZ];
+	int ret;
+
+	ret = wrl_tc_open(interface, ifb_name);
+	if (ret)
+		return ret;
+
+	/* Members are read from their range of the group trees */
+	snprintf(down_name, sizeof(down_name), "%s", interface);
+	if (group->slot) {
+		snprintf(down_name, sizeof(down_name), "%s" WRL_BACKEND_GROUP_DOWN_SUFFIX, group->name);
+		snprintf(ifb_name, sizeof(ifb_name), "%s" WRL_BACKEND_GROUP_UP_SUFFIX, group->name);
+	}
+
+	ret = wrl_tc_device_read(down, down_name, WRL_TC_ETHER_DST_OFFSET, base, 0);
+	if (ret)
+		return ret;
+
+	wrl_tc_device_counters(down, WRL_DIRECTION_DOWN, cb, priv);
+
+	ret = wrl_tc_device_read(up, ifb_name, WRL_TC_ETHER_SRC_OFFSET, base, 0);
+	if (ret)
+		return ret;
+
+	wrl_tc_device_counters(up, WRL_DIRECTION_UP, cb, priv);
+
+	return 0;
+}
+
+static struct wrl_tc_class *
+wrl_tc_class_find(struct wrl_tc_device *dev, uint32_t minor)
+{
+	return minor < dev->num_classes ? &dev->classes[minor] : NULL;
+}
+
+static int
+wrl_tc_class_complete(struct wrl_tc_class *class)
+{
+	return class && class->valid && class->leaf && class->filter == 1;
+}
+
+static int
+wrl_tc_device_complete(struct wrl_tc_device *dev)
+{
+	struct wrl_tc_class *root = wrl_tc_class_find(dev, WRL_TC_ROOT_CLASS);
+	struct wrl_tc_class *def = wrl_tc_class_find(dev, WRL_TC_DEFAULT_CLASS);
+
+	return dev->root && dev->table && dev->link &&
+	       root && root->valid && def && def->valid && def->leaf;
+}
+
+/* Rate in kbit/s as configured, 0 for unlimited */
+static uint32_t
+wrl_tc_rate(uint64_t rate)
+{
+	rate /= 125;
+
+	return rate >= WRL_BACKEND_RATE_UNLIMITED ? 0 : rate;
+}
+
+static uint32_t
+wrl_tc_guarantee(uint64_t guarantee, uint32_t rate)
+{
+	guarantee /= 125;
+
+	/* Default guarantees are not tracked as rebalanced ones */
+	return guarantee == wrl_backend_guarantee(0, rate) ? 0 : guarantee;
+}
+
+int
+wrl_backend_tc_adopt(const char *interface, struct wrl_rate *rate, wrl_backend_adopt_cb cb, void *priv)
+{
+	struct wrl_tc_device *down = &wrl_tc_devices[WRL_DIRECTION_DOWN];
+	struct wrl_tc_device *up = &wrl_tc_devices[WRL_DIRECTION_UP];
+	struct wrl_backend_client_state client;
+	struct wrl_tc_class *class_down, *class_up;
+	char ifb_name[IFNAMSIZ];
+	uint32_t minor, num_classes;
+	int ret;
+
+	ret = wrl_tc_open(interface, ifb_name);
+	if (ret)
+		return ret;
+
+	ret = wrl_tc_device_read(down, interface, WRL_TC_ETHER_DST_OFFSET, 0, 1);
+	if (ret)
+		return ret;
+
+	ret = wrl_tc_device_read(up, ifb_name, WRL_TC_ETHER_SRC_OFFSET, 0, 1);
+	if (ret)
+		return ret == -ENODEV ? -ENOENT : ret;
+
+	if (!wrl_tc_device_complete(down) || !wrl_tc_device_complete(up) || !down->redirect)
+		return -ENOENT;
+
+	/* Clients are only adopted with class, leaf qdisc and filter on both devices */
+	num_classes = down->num_classes > up->num_classes ? down->num_classes : up->num_classes;
+	for (minor = WRL_BACKEND_CLIENT_ID_OFFSET; minor < num_classes; minor++) {
+		class_down = wrl_tc_class_find(down, minor);
+		class_up = wrl_tc_class_find(up, minor);
+
+		if ((!class_down || (!class_down->valid && !class_down->filter)) &&
+		    (!class_up || (!class_up->valid && !class_up->filter)))
+			continue;
+
+		if (!wrl_tc_class_complete(class_down) || !wrl_tc_class_complete(class_up) ||
+		    memcmp(class_down->address, class_up->address, sizeof(class_down->address)))
+			return -EINVAL;
+	}
+
+	rate->down = wrl_tc_rate(down->classes[WRL_TC_ROOT_CLASS].ceil);
+	rate->up = wrl_tc_rate(up->classes[WRL_TC_ROOT_CLASS].ceil);
+
+	for (minor = WRL_BACKEND_CLIENT_ID_OFFSET; minor < num_classes; minor++) {
+		class_down = wrl_tc_class_find(down, minor);
+		if (!class_down || !class_down->valid)
+			continue;
+
+		class_up = &up->classes[minor];
+
+		memset(&client, 0, sizeof(client));
+		client.client_id = minor - WRL_BACKEND_CLIENT_ID_OFFSET;
+		memcpy(client.address, class_down->address, sizeof(client.address));
+		client.rate.down = wrl_tc_rate(class_down->ceil);
+		client.rate.up = wrl_tc_rate(class_up->ceil);
+		client.guarantee.down = wrl_tc_guarantee(class_down->rate, client.rate.down);
+		client.guarantee.up = wrl_tc_guarantee(class_up->rate, client.rate.up);
+		client.guarantee.applied = 1;
+
+		ret = cb(priv, &client);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
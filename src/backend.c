@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libubox/utils.h>
+
+#include "backend.h"
+#include "log.h"
+
+static const struct wrl_backend *wrl_backends[] = {
+	&wrl_backend_netlink,
+	&wrl_backend_shell,
+#ifdef WRL_BACKEND_BPF
+	&wrl_backend_bpf,
+#endif
+};
+
+const struct wrl_backend *
+wrl_backend_get(const char *name)
+{
+	for (int i = 0; i < ARRAY_SIZE(wrl_backends); i++) {
+		if (!name || strcmp(wrl_backends[i]->name, name) == 0)
+			return wrl_backends[i];
+	}
+
+	MSG(ERROR, "Unknown backend %s\n", name);
+	return NULL;
+}
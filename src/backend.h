@@ -0,0 +1,180 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "client.h"
+#include "group.h"
+#include "interface.h"
+#include "list.h"
+#include "rate.h"
+
+/* Rate applied in kbit/s when no limit is configured */
+#define WRL_BACKEND_RATE_UNLIMITED (1 * 1024 * 1024 * 1024)
+
+/* Guaranteed rate of classes in kbit/s unless rebalanced */
+#define WRL_BACKEND_GUARANTEE_DEFAULT 1000
+
+/* Offset of client class-ids, minor 1 and 2 are used by the interface */
+#define WRL_BACKEND_CLIENT_ID_OFFSET 10
+
+#define WRL_BACKEND_IFB_SUFFIX "-ifb"
+
+/* IFBs of a group, carrying the traffic of all its members */
+#define WRL_BACKEND_GROUP_DOWN_SUFFIX "-gdn"
+#define WRL_BACKEND_GROUP_UP_SUFFIX "-gup"
+
+enum wrl_op_type {
+	WRL_OP_INTERFACE_ADD,
+	WRL_OP_INTERFACE_REMOVE,
+	WRL_OP_CLIENT_ADD,
+	WRL_OP_CLIENT_REMOVE,
+	/* Rates of an installed client changed, filters are kept */
+	WRL_OP_CLIENT_UPDATE,
+	/* Rates of an installed interface changed, client classes are kept */
+	WRL_OP_INTERFACE_UPDATE,
+	/* Group trees, interface is empty */
+	WRL_OP_GROUP_ADD,
+	WRL_OP_GROUP_REMOVE,
+	WRL_OP_GROUP_UPDATE,
+	/* Filters of a client roamed within the group are taken over, its class is kept */
+	WRL_OP_CLIENT_MOVE,
+	/* Airtime weight of a station, set through nl80211 by every backend */
+	WRL_OP_CLIENT_AIRTIME,
+};
+
+/* Single shaping change, part of a transaction */
+struct wrl_op {
+	struct list_head head;
+
+	enum wrl_op_type type;
+
+	/* Copied when queued, interfaces and clients may change while in flight */
+	char interface[32];
+	struct wrl_rate rate;
+	struct wrl_rate guarantee;
+	uint32_t client_id;
+	uint8_t address[6];
+	uint16_t airtime_weight;
+
+	/* Group the interface trees are nested in, empty name for none */
+	struct wrl_group_ref group;
+
+	/* Class of the client on another member of the group, filters moved from another member */
+	struct wrl_client_ref home;
+	struct wrl_client_ref from;
+
+	/* Result, 0 on success */
+	int ret;
+};
+
+enum wrl_direction {
+	WRL_DIRECTION_DOWN,
+	WRL_DIRECTION_UP,
+};
+
+/* Client id of the counters of the interface as a whole */
+#define WRL_BACKEND_COUNTERS_INTERFACE UINT32_MAX
+
+/* Cumulative counters of a client class, the rate is left to the caller */
+typedef void (*wrl_backend_counters_cb)(void *priv, enum wrl_direction direction, uint32_t client_id,
+					const struct wrl_counters *counters);
+
+/* Client class found in the kernel, left by an earlier instance. Guarantee is
+ * only marked applied if it is known to be in place.
+ */
+struct wrl_backend_client_state {
+	uint32_t client_id;
+	uint8_t address[6];
+	struct wrl_rate rate;
+	struct wrl_rate guarantee;
+
+	/* Airtime weight of the station, 0 if unknown */
+	uint16_t airtime_weight;
+};
+
+typedef int (*wrl_backend_adopt_cb)(void *priv, const struct wrl_backend_client_state *client);
+
+struct wrl_transaction {
+	struct list_head ops;
+
+	/* Called by the backend once all operations finished */
+	void (*complete)(struct wrl_transaction *transaction);
+};
+
+struct wrl_backend {
+	const char *name;
+
+	int (*init)(void);
+	void (*deinit)(void);
+
+	/*
+	 * Execute all operations, results are stored per operation. Operations
+	 * of an interface are executed in order. Completion may be asynchronous.
+	 */
+	void (*commit)(struct wrl_transaction *transaction);
+
+	/* Read the counters of all classes of an interface, optional */
+	int (*counters)(const char *interface, const struct wrl_group_ref *group, wrl_backend_counters_cb cb, void *priv);
+
+	/*
+	 * Read the shaping state of an interface present in the kernel, optional.
+	 * Succeeds only for a complete tree, reporting its rates and all clients.
+	 */
+	int (*adopt)(const char *interface, struct wrl_rate *rate, wrl_backend_adopt_cb cb, void *priv);
+
+	/* Interface trees can be nested in the trees of a group */
+	uint8_t groups;
+};
+
+extern const struct wrl_backend wrl_backend_shell;
+extern const struct wrl_backend wrl_backend_netlink;
+#ifdef WRL_BACKEND_BPF
+extern const struct wrl_backend wrl_backend_bpf;
+#endif
+
+const struct wrl_backend *wrl_backend_get(const char *name);
+
+/* Counters and adoption of the HTB tree shared by the netlink and shell backends */
+int wrl_backend_tc_counters(const char *interface, const struct wrl_group_ref *group, wrl_backend_counters_cb cb, void *priv);
+int wrl_backend_tc_adopt(const char *interface, struct wrl_rate *rate, wrl_backend_adopt_cb cb, void *priv);
+
+static inline uint32_t
+wrl_backend_rate(uint32_t rate)
+{
+	return rate ? rate : WRL_BACKEND_RATE_UNLIMITED;
+}
+
+/* Guarantee of a class, never above its ceil */
+static inline uint32_t
+wrl_backend_guarantee(uint32_t guarantee, uint32_t rate)
+{
+	rate = wrl_backend_rate(rate);
+	if (!guarantee)
+		guarantee = WRL_BACKEND_GUARANTEE_DEFAULT;
+
+	return guarantee < rate ? guarantee : rate;
+}
+
+/* First class-id of the interface within the trees it is installed in */
+static inline uint32_t
+wrl_backend_group_base(const struct wrl_group_ref *group)
+{
+	return (uint32_t)group->slot << WRL_GROUP_SLOT_SHIFT;
+}
+
+static inline uint32_t
+wrl_backend_client_id(struct wrl_op *op)
+{
+	return wrl_backend_group_base(&op->group) | (op->client_id + WRL_BACKEND_CLIENT_ID_OFFSET);
+}
+
+/* Class-id of the client, on the member of the group it was created on */
+static inline uint32_t
+wrl_backend_class_id(struct wrl_op *op)
+{
+	if (!op->home.slot)
+		return wrl_backend_client_id(op);
+
+	return ((uint32_t)op->home.slot << WRL_GROUP_SLOT_SHIFT) | (op->home.id + WRL_BACKEND_CLIENT_ID_OFFSET);
+}
@@ -0,0 +1,483 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+/*
+ * Control-plane benchmark. Drives config resolution, client list
+ * reconciliation and apply planning of the daemon with client lists of a
+ * simulated hostapd. Shaping operations go to a backend which completes
+ * them without touching the kernel.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libubox/uloop.h>
+#include <libubox/utils.h>
+
+#include "backend.h"
+#include "client.h"
+#include "config.h"
+#include "interface.h"
+#include "log.h"
+#include "mac-table.h"
+#include "wrl.h"
+
+#define WRL_BENCH_TICKS 200
+
+/* Share of stations replaced by new ones every tick, in 1/1000 */
+#define WRL_BENCH_CHURN 20
+
+/* Configuration is replaced every this many ticks */
+#define WRL_BENCH_CONFIG_INTERVAL 50
+
+/* Every nth station has a per-MAC policy */
+#define WRL_BENCH_MAC_POLICY_RATIO 8
+
+#define WRL_BENCH_LOOKUP_ROUNDS 200
+
+static const uint32_t wrl_bench_interfaces[] = { 1, 4, 16, 64 };
+static const uint32_t wrl_bench_clients[] = { 10, 256, 1024, 4096 };
+static const uint32_t wrl_bench_lookup_clients[] = { 256, 2048 };
+
+/* Allocations, counted through the linker wrapped allocator */
+static struct {
+	uint64_t count;
+	uint64_t bytes;
+} wrl_bench_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+void __wrap_free(void *ptr);
+
+void *
+__wrap_malloc(size_t size)
+{
+	wrl_bench_allocs.count++;
+	wrl_bench_allocs.bytes += size;
+	return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t size)
+{
+	wrl_bench_allocs.count++;
+	wrl_bench_allocs.bytes += nmemb * size;
+	return __real_calloc(nmemb, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+	wrl_bench_allocs.count++;
+	wrl_bench_allocs.bytes += size;
+	return __real_realloc(ptr, size);
+}
+
+void
+__wrap_free(void *ptr)
+{
+	__real_free(ptr);
+}
+
+/* Backend acknowledging all operations right away */
+static uint64_t wrl_bench_ops;
+
+static void
+wrl_bench_backend_commit(struct wrl_transaction *transaction)
+{
+	struct wrl_op *op;
+
+	list_for_each_entry(op, &transaction->ops, head) {
+		op->ret = 0;
+		wrl_bench_ops++;
+	}
+
+	transaction->complete(transaction);
+}
+
+static const struct wrl_backend wrl_bench_backend = {
+	.name = "bench",
+	.commit = wrl_bench_backend_commit,
+};
+
+/* Simulated hostapd, station slots are taken over by a new address on churn */
+struct wrl_bench_hostapd {
+	uint32_t num_interfaces;
+	uint32_t num_stations;
+	uint16_t *epochs;
+	uint32_t seed;
+};
+
+static uint32_t
+wrl_bench_random(struct wrl_bench_hostapd *hostapd)
+{
+	/* xorshift32, reproducible across runs */
+	hostapd->seed ^= hostapd->seed << 13;
+	hostapd->seed ^= hostapd->seed >> 17;
+	hostapd->seed ^= hostapd->seed << 5;
+
+	return hostapd->seed;
+}
+
+static void
+wrl_bench_station(struct wrl_bench_hostapd *hostapd, uint32_t interface, uint32_t station, uint8_t *mac)
+{
+	uint16_t epoch = hostapd->epochs[interface * hostapd->num_stations + station];
+
+	/* Locally administered, unique per interface, slot and epoch */
+	mac[0] = 0x02;
+	mac[1] = interface;
+	mac[2] = station >> 8;
+	mac[3] = station;
+	mac[4] = epoch >> 8;
+	mac[5] = epoch;
+}
+
+static void
+wrl_bench_churn(struct wrl_bench_hostapd *hostapd)
+{
+	uint32_t total = hostapd->num_interfaces * hostapd->num_stations;
+	uint32_t churn = (total * WRL_BENCH_CHURN + 999) / 1000;
+
+	for (uint32_t i = 0; i < churn; i++)
+		hostapd->epochs[wrl_bench_random(hostapd) % total]++;
+}
+
+static void
+wrl_bench_config(struct wrl_data *wrl, struct wrl_bench_hostapd *hostapd, uint32_t round)
+{
+	struct wrl_config_interface_selectors interface_selectors = {};
+	struct wrl_config_client_selectors client_selectors = {};
+	struct wrl_config_interface *config_interface;
+	struct wrl_config_client *config_client;
+	int create;
+	uint8_t mac[6];
+
+	wrl_config_interface_purge(&wrl->config);
+	wrl_config_client_purge(&wrl->config);
+	wrl_config_mac_purge(&wrl->config);
+
+	/* Wildcards plus a more specific client policy for every other interface */
+	config_interface = wrl_config_interface_get(&wrl->config, &interface_selectors, &create);
+	config_interface->rate.down = 102400 + round;
+	config_interface->rate.up = 51200;
+	config_interface->max_clients = WRL_CLIENT_TABLE_LIMIT;
+
+	config_client = wrl_config_client_get(&wrl->config, &client_selectors, &create);
+	config_client->rate.down = 1024 + round;
+	config_client->rate.up = 512;
+
+	for (uint32_t i = 0; i < hostapd->num_interfaces; i += 2) {
+		snprintf(client_selectors.interface, sizeof(client_selectors.interface), "wlan%u", i);
+		config_client = wrl_config_client_get(&wrl->config, &client_selectors, &create);
+		config_client->rate.down = 2048;
+		config_client->rate.up = 1024 + round;
+	}
+
+	for (uint32_t i = 0; i < hostapd->num_interfaces; i++) {
+		for (uint32_t j = 0; j < hostapd->num_stations; j += WRL_BENCH_MAC_POLICY_RATIO) {
+			wrl_bench_station(hostapd, i, j, mac);
+			wrl_mac_table_set(&wrl->config.macs, mac, 4096, 2048);
+		}
+	}
+}
+
+static uint64_t
+wrl_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Equivalent of a resync with all client lists arriving at once */
+static void
+wrl_bench_tick(struct wrl_data *wrl, struct wrl_bench_hostapd *hostapd,
+	       uint64_t *reconcile, uint64_t *apply)
+{
+	struct wrl_interface *interface;
+	uint64_t start, lists;
+	uint32_t i = 0;
+	uint8_t mac[6];
+
+	start = wrl_bench_now();
+
+	list_for_each_entry(interface, &wrl->interfaces, head) {
+		if (wrl_config_interface_update(&wrl->config, interface))
+			interface->rate.applied = 0;
+
+		wrl_client_list_start(interface);
+		for (uint32_t j = 0; j < hostapd->num_stations; j++) {
+			wrl_bench_station(hostapd, i, j, mac);
+			wrl_client_connected(wrl, interface, mac);
+		}
+		wrl_client_list_done(wrl, interface);
+		i++;
+	}
+
+	lists = wrl_bench_now();
+
+	/* No uloop runs here, work postponed past the transaction budget is drained within the tick */
+	do {
+		uloop_timeout_cancel(&wrl->apply);
+		wrl_rate_apply(wrl);
+	} while (wrl->apply.pending);
+
+	*reconcile = lists - start;
+	*apply = wrl_bench_now() - lists;
+}
+
+static int
+wrl_bench_compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+struct wrl_bench_result {
+	uint64_t first;
+	uint64_t reconcile;
+	uint64_t apply;
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t max;
+	double allocs;
+	double alloc_bytes;
+	double ops;
+};
+
+static int
+wrl_bench_scenario(uint32_t num_interfaces, uint32_t num_clients, uint32_t ticks,
+		   struct wrl_bench_result *result)
+{
+	struct wrl_bench_hostapd hostapd = {
+		.num_interfaces = num_interfaces,
+		.seed = 0x5eed1234,
+	};
+	struct wrl_interface *interface, *tmp;
+	uint64_t reconcile, apply, allocs, alloc_bytes, ops;
+	uint64_t *latency;
+	struct wrl_data wrl;
+	char name[32];
+
+	hostapd.num_stations = (num_clients + num_interfaces - 1) / num_interfaces;
+	if (hostapd.num_stations > WRL_CLIENT_TABLE_LIMIT)
+		hostapd.num_stations = WRL_CLIENT_TABLE_LIMIT;
+
+	hostapd.epochs = calloc(num_interfaces * hostapd.num_stations, sizeof(*hostapd.epochs));
+	latency = calloc(ticks, sizeof(*latency));
+	if (!hostapd.epochs || !latency)
+		return -1;
+
+	memset(&wrl, 0, sizeof(wrl));
+	INIT_LIST_HEAD(&wrl.interfaces);
+	INIT_LIST_HEAD(&wrl.groups);
+	wrl_config_init(&wrl.config);
+	wrl.backend = &wrl_bench_backend;
+	wrl.full_purge = WRL_PURGE_NONE;
+
+	for (uint32_t i = 0; i < num_interfaces; i++) {
+		snprintf(name, sizeof(name), "wlan%u", i);
+		interface = wrl_interface_alloc(name);
+		if (!interface)
+			return -1;
+
+		list_add_tail(&interface->head, &wrl.interfaces);
+	}
+
+	wrl_bench_config(&wrl, &hostapd, 0);
+
+	/* Initial tick installs all interfaces and clients, in as many transactions as needed */
+	wrl_bench_tick(&wrl, &hostapd, &reconcile, &apply);
+	result->first = reconcile + apply;
+
+	memset(&wrl_bench_allocs, 0, sizeof(wrl_bench_allocs));
+	wrl_bench_ops = 0;
+	result->reconcile = 0;
+	result->apply = 0;
+
+	for (uint32_t t = 0; t < ticks; t++) {
+		wrl_bench_churn(&hostapd);
+		if (t && t % WRL_BENCH_CONFIG_INTERVAL == 0)
+			wrl_bench_config(&wrl, &hostapd, t);
+
+		wrl_bench_tick(&wrl, &hostapd, &reconcile, &apply);
+		latency[t] = reconcile + apply;
+		result->reconcile += reconcile;
+		result->apply += apply;
+	}
+
+	allocs = wrl_bench_allocs.count;
+	alloc_bytes = wrl_bench_allocs.bytes;
+	ops = wrl_bench_ops;
+
+	qsort(latency, ticks, sizeof(*latency), wrl_bench_compare);
+	result->reconcile /= ticks;
+	result->apply /= ticks;
+	result->p50 = latency[ticks / 2];
+	result->p99 = latency[(ticks * 99) / 100];
+	result->max = latency[ticks - 1];
+	result->allocs = (double)allocs / ticks;
+	result->alloc_bytes = (double)alloc_bytes / ticks;
+	result->ops = (double)ops / ticks;
+
+	/* Pending apply timeouts refer to the state torn down here */
+	uloop_timeout_cancel(&wrl.apply);
+
+	list_for_each_entry_safe(interface, tmp, &wrl.interfaces, head) {
+		wrl_client_table_free(&interface->clients);
+		list_del(&interface->head);
+		free(interface);
+	}
+
+	wrl_config_interface_purge(&wrl.config);
+	wrl_config_client_purge(&wrl.config);
+	wrl_config_mac_purge(&wrl.config);
+
+	free(hostapd.epochs);
+	free(latency);
+
+	return 0;
+}
+
+static void
+wrl_bench_lookup(uint32_t num_clients)
+{
+	struct wrl_client_table table;
+	uint64_t start, connect, hit, miss;
+	uint8_t allocate;
+	uint8_t mac[6] = { 0x02 };
+
+	wrl_client_table_init(&table);
+	wrl_client_table_set_max(&table, num_clients);
+
+	start = wrl_bench_now();
+	for (uint32_t i = 0; i < num_clients; i++) {
+		mac[2] = i >> 8;
+		mac[3] = i;
+		allocate = 0;
+		wrl_client_get(&table, mac, &allocate);
+	}
+	connect = wrl_bench_now() - start;
+
+	start = wrl_bench_now();
+	for (uint32_t r = 0; r < WRL_BENCH_LOOKUP_ROUNDS; r++) {
+		for (uint32_t i = 0; i < num_clients; i++) {
+			mac[2] = i >> 8;
+			mac[3] = i;
+			wrl_client_get(&table, mac, NULL);
+		}
+	}
+	hit = wrl_bench_now() - start;
+
+	mac[1] = 0xff;
+	start = wrl_bench_now();
+	for (uint32_t r = 0; r < WRL_BENCH_LOOKUP_ROUNDS; r++) {
+		for (uint32_t i = 0; i < num_clients; i++) {
+			mac[2] = i >> 8;
+			mac[3] = i;
+			wrl_client_get(&table, mac, NULL);
+		}
+	}
+	miss = wrl_bench_now() - start;
+
+	printf("%8u %12.1f %12.1f %12.1f %10zu\n", num_clients,
+	       (double)connect / num_clients,
+	       (double)hit / (num_clients * WRL_BENCH_LOOKUP_ROUNDS),
+	       (double)miss / (num_clients * WRL_BENCH_LOOKUP_ROUNDS),
+	       wrl_client_table_memory(&table));
+
+	wrl_client_table_free(&table);
+}
+
+static void
+wrl_bench_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-t ticks] [-l max_p99_usec] [-a max_allocs_per_tick] [-v]\n", name);
+	fprintf(stderr, "Exits with 1 if any scenario exceeds a given limit\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct wrl_bench_result result;
+	uint32_t ticks = WRL_BENCH_TICKS;
+	double max_latency = 0, max_allocs = 0;
+	int failed = 0;
+	int opt;
+
+	log_level_set(MSG_FATAL);
+
+	while ((opt = getopt(argc, argv, "t:l:a:v")) != -1) {
+		switch (opt) {
+		case 't':
+			ticks = atoi(optarg);
+			break;
+		case 'l':
+			max_latency = atof(optarg);
+			break;
+		case 'a':
+			max_allocs = atof(optarg);
+			break;
+		case 'v':
+			log_level_set(MSG_INFO);
+			break;
+		default:
+			wrl_bench_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!ticks) {
+		wrl_bench_usage(argv[0]);
+		return 1;
+	}
+
+	printf("Tick latency in usec, allocations and shaping operations per tick\n");
+	printf("%6s %8s %10s %10s %10s %10s %10s %10s %10s %12s %8s\n",
+	       "ifaces", "clients", "first", "reconcile", "apply", "p50", "p99", "max",
+	       "allocs", "alloc_bytes", "ops");
+
+	for (int i = 0; i < ARRAY_SIZE(wrl_bench_interfaces); i++) {
+		for (int j = 0; j < ARRAY_SIZE(wrl_bench_clients); j++) {
+			if (wrl_bench_scenario(wrl_bench_interfaces[i], wrl_bench_clients[j], ticks, &result)) {
+				fprintf(stderr, "Failed to allocate scenario\n");
+				return 1;
+			}
+
+			printf("%6u %8u %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %12.1f %8.1f\n",
+			       wrl_bench_interfaces[i], wrl_bench_clients[j],
+			       result.first / 1000.0, result.reconcile / 1000.0, result.apply / 1000.0,
+			       result.p50 / 1000.0, result.p99 / 1000.0, result.max / 1000.0,
+			       result.allocs, result.alloc_bytes, result.ops);
+
+			if ((max_latency && result.p99 / 1000.0 > max_latency) ||
+			    (max_allocs && result.allocs > max_allocs))
+				failed = 1;
+		}
+	}
+
+	printf("\nClient table, nsec per operation\n");
+	printf("%8s %12s %12s %12s %10s\n", "clients", "connect", "lookup", "miss", "memory");
+
+	for (int i = 0; i < ARRAY_SIZE(wrl_bench_lookup_clients); i++)
+		wrl_bench_lookup(wrl_bench_lookup_clients[i]);
+
+	if (failed)
+		fprintf(stderr, "Limits exceeded\n");
+
+	return failed;
+}
@@ -0,0 +1,164 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+/*
+ * Per-MAC rate limiting without a tc class tree.
+ *
+ * Download is paced on egress by stamping an Earliest Departure Time, which
+ * the fq qdisc at the root of the interface enforces. Upload is policed on
+ * ingress with a token bucket. State lives in a single hash map, which the
+ * daemon updates instead of programming classes and filters.
+ *
+ * The datapath does not depend on wireless, so it can be exercised on a
+ * veth pair between two network namespaces with bpftool filling the map.
+ */
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/pkt_cls.h>
+#include <bpf/bpf_helpers.h>
+
+#include "wrl-edt.h"
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, WRL_EDT_MAP_SIZE);
+	__type(key, struct wrl_edt_key);
+	__type(value, struct wrl_edt_value);
+} WRL_EDT_MAP_NAME SEC(".maps");
+
+/*
+ * Updates of the shared state race between CPUs. Like other EDT
+ * implementations this is accepted, a lost update only shifts a single
+ * packet by its own serialization delay.
+ */
+static __always_inline int
+wrl_edt_pace(struct wrl_edt_value *value, __u32 len, __u64 now, __u64 *tstamp)
+{
+	__u64 delay, next;
+
+	if (!value->rate)
+		return 0;
+
+	delay = (__u64)len * WRL_EDT_NSEC_PER_SEC / value->rate;
+	next = value->t_last + delay;
+
+	if (next <= *tstamp) {
+		value->t_last = *tstamp;
+		return 0;
+	}
+
+	if (next - now >= WRL_EDT_HORIZON_NS)
+		return -1;
+
+	value->t_last = next;
+	*tstamp = next;
+
+	return 0;
+}
+
+static __always_inline int
+wrl_edt_police(struct wrl_edt_value *value, __u32 len, __u64 now)
+{
+	__u64 elapsed, tokens;
+
+	if (!value->rate)
+		return 0;
+
+	/* Capping the refill interval keeps the product below 64 bit */
+	elapsed = now - value->t_last;
+	if (elapsed > WRL_EDT_BURST_NS)
+		elapsed = WRL_EDT_BURST_NS;
+
+	tokens = value->tokens + elapsed * value->rate / WRL_EDT_NSEC_PER_SEC;
+	if (tokens > value->burst)
+		tokens = value->burst;
+
+	value->t_last = now;
+
+	if (tokens < len) {
+		value->tokens = tokens;
+		return -1;
+	}
+
+	value->tokens = tokens - len;
+
+	return 0;
+}
+
+SEC("tc")
+int
+wrl_edt_egress(struct __sk_buff *skb)
+{
+	void *data_end = (void *)(long)skb->data_end;
+	void *data = (void *)(long)skb->data;
+	struct wrl_edt_value *client, *interface;
+	struct ethhdr *eth = data;
+	struct wrl_edt_key key = {
+		.ifindex = skb->ifindex,
+		.direction = WRL_EDT_DIRECTION_DOWN,
+	};
+	__u64 now, tstamp;
+
+	if ((void *)(eth + 1) > data_end)
+		return TC_ACT_OK;
+
+	interface = bpf_map_lookup_elem(&WRL_EDT_MAP_NAME, &key);
+
+	__builtin_memcpy(key.address, eth->h_dest, ETH_ALEN);
+	client = bpf_map_lookup_elem(&WRL_EDT_MAP_NAME, &key);
+
+	if (!client && !interface)
+		return TC_ACT_OK;
+
+	now = bpf_ktime_get_ns();
+	tstamp = skb->tstamp > now ? skb->tstamp : now;
+
+	if (client && wrl_edt_pace(client, skb->len, now, &tstamp))
+		return TC_ACT_SHOT;
+
+	if (interface && wrl_edt_pace(interface, skb->len, now, &tstamp))
+		return TC_ACT_SHOT;
+
+	skb->tstamp = tstamp;
+
+	return TC_ACT_OK;
+}
+
+SEC("tc")
+int
+wrl_edt_ingress(struct __sk_buff *skb)
+{
+	void *data_end = (void *)(long)skb->data_end;
+	void *data = (void *)(long)skb->data;
+	struct wrl_edt_value *client, *interface;
+	struct ethhdr *eth = data;
+	struct wrl_edt_key key = {
+		.ifindex = skb->ifindex,
+		.direction = WRL_EDT_DIRECTION_UP,
+	};
+	__u64 now;
+
+	if ((void *)(eth + 1) > data_end)
+		return TC_ACT_OK;
+
+	interface = bpf_map_lookup_elem(&WRL_EDT_MAP_NAME, &key);
+
+	__builtin_memcpy(key.address, eth->h_source, ETH_ALEN);
+	client = bpf_map_lookup_elem(&WRL_EDT_MAP_NAME, &key);
+
+	if (!client && !interface)
+		return TC_ACT_OK;
+
+	now = bpf_ktime_get_ns();
+
+	if (client && wrl_edt_police(client, skb->len, now))
+		return TC_ACT_SHOT;
+
+	if (interface && wrl_edt_police(interface, skb->len, now))
+		return TC_ACT_SHOT;
+
+	return TC_ACT_OK;
+}
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <linux/types.h>
+
+/* Shared between the datapath program and the bpf backend */
+
+#define WRL_EDT_MAP_NAME	wrl_edt
+#define WRL_EDT_MAP_SIZE	65536
+
+/* Departure times further ahead than this are dropped instead of queued */
+#define WRL_EDT_HORIZON_NS	(2ULL * 1000 * 1000 * 1000)
+
+/* Upload is policed, tokens accumulate for at most this long */
+#define WRL_EDT_BURST_NS	(50ULL * 1000 * 1000)
+
+#define WRL_EDT_NSEC_PER_SEC	(1000ULL * 1000 * 1000)
+
+enum wrl_edt_direction {
+	/* Paced on egress of the interface, keyed by destination */
+	WRL_EDT_DIRECTION_DOWN,
+	/* Policed on ingress of the interface, keyed by source */
+	WRL_EDT_DIRECTION_UP,
+};
+
+/* Entries with a zero address limit the interface as a whole */
+struct wrl_edt_key {
+	__u32 ifindex;
+	__u8 address[6];
+	__u8 direction;
+	__u8 pad;
+};
+
+struct wrl_edt_value {
+	/* Bytes per second */
+	__u64 rate;
+	/* Bytes, upload only */
+	__u64 burst;
+
+	/* Departure time of the last packet (down) or last refill (up) */
+	__u64 t_last;
+	__u64 tokens;
+};
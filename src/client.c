@@ -0,0 +1,412 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "client.h"
+#include "list.h"
+#include "log.h"
+#include "mac.h"
+
+#define WRL_CLIENT_TABLE_INDEX_SIZE(table) (1U << (table)->index_bits)
+#define WRL_CLIENT_TABLE_INDEX_MASK(table) (WRL_CLIENT_TABLE_INDEX_SIZE(table) - 1)
+
+static struct wrl_client *
+wrl_client_table_entry(struct wrl_client_table *table, uint32_t pos)
+{
+	uint32_t id = table->index[pos] - 1;
+
+	return &table->chunks[id / WRL_CLIENT_CHUNK_SIZE]->clients[id % WRL_CLIENT_CHUNK_SIZE];
+}
+
+/* Generation changes are stamped with, published by the next report */
+static struct {
+	uint32_t next;
+	uint8_t changed;
+} wrl_client_report = {
+	.next = 1,
+};
+
+static void
+wrl_client_reset(struct wrl_client *client)
+{
+	memset(client->address, 0, sizeof(client->address));
+	memset(&client->rate, 0, sizeof(client->rate));
+	memset(&client->kernel_rate, 0, sizeof(client->kernel_rate));
+	memset(&client->guarantee, 0, sizeof(client->guarantee));
+	memset(&client->airtime, 0, sizeof(client->airtime));
+	client->active = 0;
+	client->generation = 0;
+	client->connected_at = 0;
+	client->connected = 0;
+	client->installed = 0;
+	client->pending = 0;
+	memset(&client->backoff, 0, sizeof(client->backoff));
+	memset(&client->from, 0, sizeof(client->from));
+	memset(&client->home, 0, sizeof(client->home));
+	client->roamed = 0;
+	client->lent = 0;
+	memset(&client->usage, 0, sizeof(client->usage));
+	client->report_added = 0;
+	client->reported = 0;
+}
+
+static uint32_t
+wrl_client_table_find(struct wrl_client_table *table, const uint8_t *mac)
+{
+	uint32_t pos = wrl_mac_hash(mac, table->index_bits);
+
+	/* Terminates at the first empty slot, the index is never full */
+	while (table->index[pos]) {
+		if (memcmp(wrl_client_table_entry(table, pos)->address, mac, 6) == 0)
+			break;
+
+		pos = (pos + 1) & WRL_CLIENT_TABLE_INDEX_MASK(table);
+	}
+
+	return pos;
+}
+
+static int
+wrl_client_table_index_resize(struct wrl_client_table *table, uint32_t bits)
+{
+	struct wrl_client *client;
+	uint16_t *index;
+
+	index = calloc(1U << bits, sizeof(*index));
+	if (!index)
+		return -1;
+
+	free(table->index);
+	table->index = index;
+	table->index_bits = bits;
+
+	wrl_client_for_each(client, table)
+		table->index[wrl_client_table_find(table, client->address)] = client->id + 1;
+
+	return 0;
+}
+
+static int
+wrl_client_table_chunk_alloc(struct wrl_client_table *table, uint32_t n)
+{
+	struct wrl_client_chunk **chunks;
+	struct wrl_client_chunk *chunk;
+	struct wrl_client *client;
+	uint32_t bits;
+
+	if ((n + 1) * WRL_CLIENT_CHUNK_SIZE > WRL_CLIENT_TABLE_LIMIT)
+		return -1;
+
+	/* Keep the index at most half full */
+	bits = table->index ? table->index_bits : WRL_CLIENT_TABLE_INDEX_MIN_BITS;
+	while ((1U << bits) < 2 * (table->num_allocated + WRL_CLIENT_CHUNK_SIZE))
+		bits++;
+
+	if (!table->index || bits != table->index_bits) {
+		if (wrl_client_table_index_resize(table, bits))
+			return -1;
+	}
+
+	if (n >= table->num_chunks) {
+		chunks = realloc(table->chunks, (n + 1) * sizeof(*chunks));
+		if (!chunks)
+			return -1;
+
+		memset(&chunks[table->num_chunks], 0, (n + 1 - table->num_chunks) * sizeof(*chunks));
+		table->chunks = chunks;
+		table->num_chunks = n + 1;
+	}
+
+	chunk = calloc(1, sizeof(*chunk));
+	if (!chunk)
+		return -1;
+
+	for (int i = 0; i < WRL_CLIENT_CHUNK_SIZE; i++) {
+		client = &chunk->clients[i];
+		client->id = n * WRL_CLIENT_CHUNK_SIZE + i;
+		list_add_tail(&client->head, &table->free);
+	}
+
+	table->chunks[n] = chunk;
+	table->num_allocated += WRL_CLIENT_CHUNK_SIZE;
+
+	MSG(DEBUG, "Allocated client chunk %u, %u clients allocated\n", n, table->num_allocated);
+
+	return 0;
+}
+
+static uint32_t
+wrl_client_table_chunk_lowest(struct wrl_client_table *table)
+{
+	uint32_t n;
+
+	/* Reuse the lowest released chunk to keep ids small */
+	for (n = 0; n < table->num_chunks; n++) {
+		if (!table->chunks[n])
+			break;
+	}
+
+	return n;
+}
+
+static void
+wrl_client_table_chunk_release(struct wrl_client_table *table, uint32_t n)
+{
+	struct wrl_client_chunk *chunk = table->chunks[n];
+
+	for (int i = 0; i < WRL_CLIENT_CHUNK_SIZE; i++)
+		list_del(&chunk->clients[i].head);
+
+	free(chunk);
+	table->chunks[n] = NULL;
+	table->num_allocated -= WRL_CLIENT_CHUNK_SIZE;
+
+	while (table->num_chunks && !table->chunks[table->num_chunks - 1])
+		table->num_chunks--;
+
+	if (!table->num_chunks) {
+		free(table->chunks);
+		table->chunks = NULL;
+	}
+
+	/* Shrinking the index is best effort, the current one stays valid */
+	if (table->index_bits > WRL_CLIENT_TABLE_INDEX_MIN_BITS &&
+	    (1U << table->index_bits) >= 4 * table->num_allocated)
+		wrl_client_table_index_resize(table, table->index_bits - 1);
+
+	MSG(DEBUG, "Released client chunk %u, %u clients allocated\n", n, table->num_allocated);
+}
+
+void
+wrl_client_table_init(struct wrl_client_table *table)
+{
+	memset(table, 0, sizeof(*table));
+	INIT_LIST_HEAD(&table->active);
+	INIT_LIST_HEAD(&table->free);
+	table->max_clients = WRL_CLIENT_TABLE_DEFAULT_MAX;
+}
+
+void
+wrl_client_table_flush(struct wrl_client_table *table)
+{
+	struct wrl_client *client, *tmp;
+
+	wrl_client_for_each_safe(client, tmp, table)
+		wrl_client_free(table, client);
+}
+
+void
+wrl_client_table_free(struct wrl_client_table *table)
+{
+	uint32_t max_clients = table->max_clients;
+
+	for (uint32_t n = 0; n < table->num_chunks; n++)
+		free(table->chunks[n]);
+
+	free(table->chunks);
+	free(table->index);
+
+	wrl_client_table_init(table);
+	table->max_clients = max_clients;
+}
+
+void
+wrl_client_table_set_max(struct wrl_client_table *table, uint32_t max_clients)
+{
+	if (!max_clients)
+		max_clients = WRL_CLIENT_TABLE_DEFAULT_MAX;
+
+	if (max_clients > WRL_CLIENT_TABLE_LIMIT)
+		max_clients = WRL_CLIENT_TABLE_LIMIT;
+
+	/* Connected clients above a lowered limit are kept until they leave */
+	table->max_clients = max_clients;
+}
+
+size_t
+wrl_client_table_memory(struct wrl_client_table *table)
+{
+	size_t size;
+
+	size = (table->num_allocated / WRL_CLIENT_CHUNK_SIZE) * sizeof(struct wrl_client_chunk);
+	size += table->num_chunks * sizeof(*table->chunks);
+	if (table->index)
+		size += WRL_CLIENT_TABLE_INDEX_SIZE(table) * sizeof(*table->index);
+
+	return size;
+}
+
+static void
+wrl_client_table_insert(struct wrl_client_table *table, struct wrl_client *client, const uint8_t *mac)
+{
+	list_move_tail(&client->head, &table->active);
+	memcpy(client->address, mac, 6);
+
+	/* Index may have been resized by the chunk allocation */
+	table->index[wrl_client_table_find(table, mac)] = client->id + 1;
+	table->chunks[client->id / WRL_CLIENT_CHUNK_SIZE]->used++;
+	table->num_clients++;
+
+	client->report_added = wrl_client_report.next;
+	wrl_client_changed(client);
+}
+
+struct wrl_client *
+wrl_client_get(struct wrl_client_table *table, const uint8_t *mac, uint8_t *allocate)
+{
+	struct wrl_client *client;
+	uint32_t pos;
+
+	if (table->index) {
+		pos = wrl_client_table_find(table, mac);
+		if (table->index[pos])
+			return wrl_client_table_entry(table, pos);
+	}
+
+	if (!allocate)
+		return NULL;
+
+	*allocate = 0;
+
+	if (table->num_clients >= table->max_clients) {
+		MSG(ERROR, "Client limit of %u reached\n", table->max_clients);
+		return NULL;
+	}
+
+	if (list_empty(&table->free) && wrl_client_table_chunk_alloc(table, wrl_client_table_chunk_lowest(table))) {
+		MSG(ERROR, "No free client found\n");
+		return NULL;
+	}
+
+	MSG(DEBUG, "Allocating new client\n");
+	client = list_first_entry(&table->free, struct wrl_client, head);
+	wrl_client_table_insert(table, client, mac);
+
+	*allocate = 1;
+	return client;
+}
+
+struct wrl_client *
+wrl_client_get_at(struct wrl_client_table *table, const uint8_t *mac, uint32_t id)
+{
+	uint32_t n = id / WRL_CLIENT_CHUNK_SIZE;
+	struct wrl_client *client;
+
+	if (wrl_client_get(table, mac, NULL))
+		return NULL;
+
+	/* The client limit is not enforced, existing shaping is kept until the client leaves */
+	if ((n >= table->num_chunks || !table->chunks[n]) && wrl_client_table_chunk_alloc(table, n))
+		return NULL;
+
+	client = &table->chunks[n]->clients[id % WRL_CLIENT_CHUNK_SIZE];
+	if (!wrl_mac_is_zero(client->address))
+		return NULL;
+
+	wrl_client_table_insert(table, client, mac);
+
+	return client;
+}
+
+struct wrl_client *
+wrl_client_get_by_id(struct wrl_client_table *table, uint32_t id)
+{
+	struct wrl_client_chunk *chunk;
+	struct wrl_client *client;
+
+	if (id / WRL_CLIENT_CHUNK_SIZE >= table->num_chunks)
+		return NULL;
+
+	chunk = table->chunks[id / WRL_CLIENT_CHUNK_SIZE];
+	if (!chunk)
+		return NULL;
+
+	/* Free clients have their address cleared */
+	client = &chunk->clients[id % WRL_CLIENT_CHUNK_SIZE];
+	if (wrl_mac_is_zero(client->address))
+		return NULL;
+
+	return client;
+}
+
+static void
+wrl_client_table_removed(struct wrl_client_table *table, struct wrl_client *client)
+{
+	struct wrl_client_removed *removed;
+
+	/* Nobody learned about the client, it appeared after the last report */
+	if (client->report_added == wrl_client_report.next)
+		return;
+
+	removed = &table->removed[table->num_removed % WRL_CLIENT_REMOVED_MAX];
+	if (table->num_removed++ >= WRL_CLIENT_REMOVED_MAX && removed->generation > table->report_floor)
+		table->report_floor = removed->generation;
+
+	memcpy(removed->address, client->address, sizeof(removed->address));
+	removed->generation = wrl_client_report.next;
+	wrl_client_report.changed = 1;
+}
+
+void
+wrl_client_free(struct wrl_client_table *table, struct wrl_client *client)
+{
+	uint32_t n = client->id / WRL_CLIENT_CHUNK_SIZE;
+	uint32_t mask = WRL_CLIENT_TABLE_INDEX_MASK(table);
+	uint32_t pos, next, home;
+
+	pos = wrl_client_table_find(table, client->address);
+	if (table->index[pos] != client->id + 1)
+		return;
+
+	/* Shift back entries of the probe sequence instead of leaving a tombstone */
+	table->index[pos] = 0;
+	next = (pos + 1) & mask;
+	while (table->index[next]) {
+		home = wrl_mac_hash(wrl_client_table_entry(table, next)->address, table->index_bits);
+
+		/* Entry may only move if its home slot is not between the gap and itself */
+		if (((next - home) & mask) >= ((next - pos) & mask)) {
+			table->index[pos] = table->index[next];
+			table->index[next] = 0;
+			pos = next;
+		}
+
+		next = (next + 1) & mask;
+	}
+
+	wrl_client_table_removed(table, client);
+	wrl_client_reset(client);
+	list_move(&client->head, &table->free);
+	table->num_clients--;
+
+	/* Release empty chunks, keeping some headroom against churn at a chunk boundary */
+	if (--table->chunks[n]->used == 0 &&
+	    table->num_allocated - WRL_CLIENT_CHUNK_SIZE >= table->num_clients + WRL_CLIENT_CHUNK_SIZE / 2)
+		wrl_client_table_chunk_release(table, n);
+}
+
+void
+wrl_client_changed(struct wrl_client *client)
+{
+	client->reported = wrl_client_report.next;
+	wrl_client_report.changed = 1;
+}
+
+uint32_t
+wrl_client_report_publish(int force)
+{
+	uint32_t generation = wrl_client_report.next;
+
+	if (!wrl_client_report.changed && !force)
+		return 0;
+
+	/* Skip 0, it stands for never reported */
+	if (!++wrl_client_report.next)
+		wrl_client_report.next = 1;
+	wrl_client_report.changed = 0;
+
+	return generation;
+}
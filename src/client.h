@@ -6,11 +6,154 @@
 #include "list.h"
 #include "rate.h"
 
+/* Clients are allocated in chunks of this size */
+#define WRL_CLIENT_CHUNK_SIZE 16
+
+/* Default limit of clients per interface */
+#define WRL_CLIENT_TABLE_DEFAULT_MAX 256
+
+/* Client ids end up in 12 bit tc filter handles */
+#define WRL_CLIENT_TABLE_LIMIT 4080
+
+/* Smallest index, kept at most half full to keep probe sequences short */
+#define WRL_CLIENT_TABLE_INDEX_MIN_BITS 5
+
+/* Released clients remembered for incremental queries */
+#define WRL_CLIENT_REMOVED_MAX 64
+
+/* Entry of a station on a member of a group, slot 0 for none */
+struct wrl_client_ref {
+	uint8_t slot;
+	uint16_t id;
+};
+
 struct wrl_client {
+	/* Either on the active or on the free list of the table */
+	struct list_head head;
+
 	uint32_t id;
 	uint8_t address[6];
 
 	struct wrl_rate rate;
 
+	/* Rates in place in the kernel while installed */
+	struct wrl_rate kernel_rate;
+
+	/* Guaranteed share assigned by rebalancing, 0 for the backend default */
+	struct wrl_rate guarantee;
+
+	struct wrl_airtime airtime;
+
+	/* Directions with recent traffic, bit per enum wrl_direction */
+	uint8_t active;
+
+	/* Last client list of the interface this client was part of */
+	uint32_t generation;
+
+	/* Time of association, cleared once shaping is enforced */
+	uint64_t connected_at;
+
 	uint8_t connected;
-};
\ No newline at end of file
+
+	/* Shaping is present in the kernel and has to be removed on departure */
+	uint8_t installed;
+
+	/* Operation of this client is in flight */
+	uint8_t pending;
+	struct wrl_backoff backoff;
+
+	/* Station roamed here within the group, filters still on the entry it came from */
+	struct wrl_client_ref from;
+
+	/* Class created by the entry on another member, in use by this one */
+	struct wrl_client_ref home;
+
+	/* Filters are to be taken over by the entry the station roamed to */
+	uint8_t roamed;
+
+	/* Class is in use by the entry the station roamed to */
+	uint8_t lent;
+
+	struct wrl_usage usage;
+
+	/* Report generations the client appeared in and its reported state last changed in */
+	uint32_t report_added;
+	uint32_t reported;
+};
+
+struct wrl_client_removed {
+	uint8_t address[6];
+
+	/* Report generation of the release, 0 until reported */
+	uint32_t generation;
+};
+
+struct wrl_client_chunk {
+	uint32_t used;
+	struct wrl_client clients[WRL_CLIENT_CHUNK_SIZE];
+};
+
+struct wrl_client_table {
+	/* Chunk n holds client ids n * WRL_CLIENT_CHUNK_SIZE onwards, NULL when released */
+	struct wrl_client_chunk **chunks;
+	uint32_t num_chunks;
+
+	/* Open addressing index on the client address, holds id + 1 */
+	uint16_t *index;
+	uint32_t index_bits;
+
+	struct list_head active;
+	struct list_head free;
+	uint32_t num_clients;
+	uint32_t num_allocated;
+	uint32_t max_clients;
+
+	/* Bumped for every client list received from hostapd */
+	uint32_t generation;
+
+	/* Released clients, the oldest entry is overwritten first */
+	struct wrl_client_removed removed[WRL_CLIENT_REMOVED_MAX];
+	uint32_t num_removed;
+
+	/* Queries older than this report generation missed releases */
+	uint32_t report_floor;
+};
+
+static inline int
+wrl_client_ref_equal(const struct wrl_client_ref *a, const struct wrl_client_ref *b)
+{
+	return a->slot == b->slot && a->id == b->id;
+}
+
+#define wrl_client_for_each(client, table) \
+	list_for_each_entry(client, &(table)->active, head)
+
+#define wrl_client_for_each_safe(client, tmp, table) \
+	list_for_each_entry_safe(client, tmp, &(table)->active, head)
+
+void wrl_client_table_init(struct wrl_client_table *table);
+void wrl_client_table_flush(struct wrl_client_table *table);
+void wrl_client_table_free(struct wrl_client_table *table);
+void wrl_client_table_set_max(struct wrl_client_table *table, uint32_t max_clients);
+size_t wrl_client_table_memory(struct wrl_client_table *table);
+
+struct wrl_client *wrl_client_get(struct wrl_client_table *table, const uint8_t *mac, uint8_t *allocate);
+struct wrl_client *wrl_client_get_at(struct wrl_client_table *table, const uint8_t *mac, uint32_t id);
+struct wrl_client *wrl_client_get_by_id(struct wrl_client_table *table, uint32_t id);
+void wrl_client_free(struct wrl_client_table *table, struct wrl_client *client);
+
+/* Stamp a change of the rates, guarantees or airtime weight reported by get_client */
+void wrl_client_changed(struct wrl_client *client);
+
+/* Publish the changes stamped since the last report, returns their generation or 0 for none */
+uint32_t wrl_client_report_publish(int force);
+
+static inline void
+wrl_client_rate_applied(struct wrl_client *client, uint8_t applied)
+{
+	if (client->rate.applied == applied)
+		return;
+
+	client->rate.applied = applied;
+	wrl_client_changed(client);
+}
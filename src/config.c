@@ -8,13 +8,53 @@
 #include "list.h"
 #include "log.h"
 #include "mac.h"
+#include "mac-table.h"
 #include "rate.h"
+#include "stats.h"
 
 void
 wrl_config_init(struct wrl_config *config)
 {
 	INIT_LIST_HEAD(&config->interfaces);
 	INIT_LIST_HEAD(&config->clients);
+	INIT_LIST_HEAD(&config->groups);
+	wrl_mac_table_init(&config->macs);
+
+	/* Interfaces start at generation 0 and resolve on first use */
+	config->generation = 1;
+}
+
+enum selector_type
+wrl_config_selector_type(const char *interface, const char *ssid)
+{
+	enum selector_type type = 0;
+
+	if (interface[0])
+		type |= SELECTOR_TYPE_INTERFACE;
+	if (ssid[0])
+		type |= SELECTOR_TYPE_SSID;
+
+	return type;
+}
+
+/* Interface and SSID > interface > SSID > wildcard */
+static int
+wrl_config_selector_rank(enum selector_type type)
+{
+	return (type & SELECTOR_TYPE_INTERFACE ? 2 : 0) + (type & SELECTOR_TYPE_SSID ? 1 : 0);
+}
+
+static int
+wrl_config_selector_match(const char *sel_interface, const char *sel_ssid,
+			  struct wrl_interface *interface)
+{
+	if (sel_interface[0] && strncmp(sel_interface, interface->name, sizeof(interface->name)))
+		return -1;
+
+	if (sel_ssid[0] && (!interface->ssid_valid || strncmp(sel_ssid, interface->ssid, sizeof(interface->ssid))))
+		return -1;
+
+	return wrl_config_selector_rank(wrl_config_selector_type(sel_interface, sel_ssid));
 }
 
 
@@ -31,21 +71,12 @@ struct wrl_config_interface *
 wrl_config_interface_get(struct wrl_config *config, struct wrl_config_interface_selectors *selectors, int *create)
 {
 	struct wrl_config_interface *interface = NULL;
-	struct wrl_config_interface *wildcard = NULL;
 
 	list_for_each_entry(interface, &config->interfaces, head) {
-		/* ToDo: Only interface supported for now */
-		if (strncmp(interface->selectors.interface, selectors->interface, sizeof(selectors->interface)) == 0) {
+		if (strncmp(interface->selectors.interface, selectors->interface, sizeof(selectors->interface)) == 0 &&
+		    strncmp(interface->selectors.ssid, selectors->ssid, sizeof(selectors->ssid)) == 0) {
 			return interface;
 		}
-
-		if (interface->selectors.interface[0] == 0) {
-			wildcard = interface;
-		}
-	}
-
-	if (wildcard) {
-		return wildcard;
 	}
 
 	if (!create) {
@@ -60,6 +91,7 @@ wrl_config_interface_get(struct wrl_config *config, struct wrl_config_interface_
 	memcpy(&interface->selectors, selectors, sizeof(*selectors));
 	INIT_LIST_HEAD(&interface->head);
 	list_add_tail(&interface->head, &config->interfaces);
+	config->generation++;
 	*create = 1;
 
 	return interface;
@@ -74,6 +106,8 @@ wrl_config_interface_purge(struct wrl_config *config)
 	list_for_each_entry_safe(interface, tmp, &config->interfaces, head) {
 		vrl_config_interface_free(interface);
 	}
+
+	config->generation++;
 }
 
 
@@ -90,22 +124,14 @@ struct wrl_config_client *
 wrl_config_client_get(struct wrl_config *config, struct wrl_config_client_selectors *selectors, int *create)
 {
 	struct wrl_config_client *client;
-	struct wrl_config_client *wildcard = NULL;
 
 	list_for_each_entry(client, &config->clients, head) {
-		/* ToDo: Only interface supported for now */
-		if (strncmp(client->selectors.interface, selectors->interface, sizeof(selectors->interface)) == 0) {
+		if (strncmp(client->selectors.interface, selectors->interface, sizeof(selectors->interface)) == 0 &&
+		    strncmp(client->selectors.ssid, selectors->ssid, sizeof(selectors->ssid)) == 0) {
 			return client;
 		}
-
-		if (client->selectors.interface[0] == 0) {
-			wildcard = client;
-		}
 	}
 
-	if (wildcard)
-		return wildcard;
-
 	if (!create) {
 		return NULL;
 	}
@@ -118,6 +144,7 @@ wrl_config_client_get(struct wrl_config *config, struct wrl_config_client_select
 	memcpy(&client->selectors, selectors, sizeof(*selectors));
 	INIT_LIST_HEAD(&client->head);
 	list_add_tail(&client->head, &config->clients);
+	config->generation++;
 	*create = 1;
 
 	return client;
@@ -132,31 +159,229 @@ wrl_config_client_purge(struct wrl_config *config)
 	list_for_each_entry_safe(client, tmp, &config->clients, head) {
 		wrl_config_client_free(client);
 	}
+
+	config->generation++;
+}
+
+/* Group config */
+struct wrl_config_group *
+wrl_config_group_get(struct wrl_config *config, const char *name, int *create)
+{
+	struct wrl_config_group *group;
+
+	list_for_each_entry(group, &config->groups, head) {
+		if (strncmp(group->name, name, sizeof(group->name)) == 0)
+			return group;
+	}
+
+	if (!create)
+		return NULL;
+
+	group = calloc(1, sizeof(*group));
+	if (!group)
+		return NULL;
+
+	strncpy(group->name, name, sizeof(group->name) - 1);
+	list_add_tail(&group->head, &config->groups);
+	config->generation++;
+	*create = 1;
+
+	return group;
+}
+
+void
+wrl_config_group_purge(struct wrl_config *config)
+{
+	struct wrl_config_group *group, *tmp;
+
+	list_for_each_entry_safe(group, tmp, &config->groups, head) {
+		list_del(&group->head);
+		free(group);
+	}
+
+	config->generation++;
+}
+
+/* MAC config */
+void
+wrl_config_mac_purge(struct wrl_config *config)
+{
+	wrl_mac_table_free(&config->macs);
+}
+
+/* Bulk replacement */
+static int
+wrl_config_interface_equal(struct wrl_config_interface *a, struct wrl_config_interface *b)
+{
+	return a->rate.down == b->rate.down && a->rate.up == b->rate.up &&
+	       a->max_clients == b->max_clients && a->rebalance == b->rebalance &&
+	       !strncmp(a->group, b->group, sizeof(a->group));
+}
+
+static int
+wrl_config_group_equal(struct wrl_config_group *a, struct wrl_config_group *b)
+{
+	return a->rate.down == b->rate.down && a->rate.up == b->rate.up;
+}
+
+static int
+wrl_config_client_equal(struct wrl_config_client *a, struct wrl_config_client *b)
+{
+	return a->rate.down == b->rate.down && a->rate.up == b->rate.up &&
+	       a->airtime_weight == b->airtime_weight;
+}
+
+uint32_t
+wrl_config_replace(struct wrl_config *config, struct wrl_config *staging)
+{
+	struct wrl_config_interface *interface, *current_interface;
+	struct wrl_config_client *client, *current_client;
+	struct wrl_config_group *group, *current_group;
+	struct list_head tmp;
+	uint32_t changes = 0;
+
+	/* Added or modified policies */
+	list_for_each_entry(interface, &staging->interfaces, head) {
+		current_interface = wrl_config_interface_get(config, &interface->selectors, NULL);
+		if (!current_interface || !wrl_config_interface_equal(interface, current_interface))
+			changes++;
+	}
+
+	list_for_each_entry(client, &staging->clients, head) {
+		current_client = wrl_config_client_get(config, &client->selectors, NULL);
+		if (!current_client || !wrl_config_client_equal(client, current_client))
+			changes++;
+	}
+
+	list_for_each_entry(group, &staging->groups, head) {
+		current_group = wrl_config_group_get(config, group->name, NULL);
+		if (!current_group || !wrl_config_group_equal(group, current_group))
+			changes++;
+	}
+
+	/* Removed policies */
+	list_for_each_entry(interface, &config->interfaces, head) {
+		if (!wrl_config_interface_get(staging, &interface->selectors, NULL))
+			changes++;
+	}
+
+	list_for_each_entry(client, &config->clients, head) {
+		if (!wrl_config_client_get(staging, &client->selectors, NULL))
+			changes++;
+	}
+
+	list_for_each_entry(group, &config->groups, head) {
+		if (!wrl_config_group_get(staging, group->name, NULL))
+			changes++;
+	}
+
+	changes += wrl_mac_table_changes(&config->macs, &staging->macs);
+	if (!changes)
+		return 0;
+
+	/* Previous policies end up in the staging config and are released with it */
+	INIT_LIST_HEAD(&tmp);
+	list_splice_init(&config->interfaces, &tmp);
+	list_splice_init(&staging->interfaces, &config->interfaces);
+	list_splice_init(&tmp, &staging->interfaces);
+
+	list_splice_init(&config->clients, &tmp);
+	list_splice_init(&staging->clients, &config->clients);
+	list_splice_init(&tmp, &staging->clients);
+
+	list_splice_init(&config->groups, &tmp);
+	list_splice_init(&staging->groups, &config->groups);
+	list_splice_init(&tmp, &staging->groups);
+
+	wrl_mac_table_swap(&config->macs, &staging->macs);
+
+	/* Resolved policies refer to the released ones */
+	config->generation++;
+
+	return changes;
+}
+
+/* Policy resolution */
+void
+wrl_config_resolve(struct wrl_config *config, struct wrl_interface *interface)
+{
+	struct wrl_config_interface *config_interface;
+	struct wrl_config_client *config_client;
+	uint64_t start;
+	int rank, best;
+
+	if (interface->config.generation == config->generation)
+		return;
+
+	start = wrl_stats_now();
+
+	interface->config.interface = NULL;
+	best = -1;
+	list_for_each_entry(config_interface, &config->interfaces, head) {
+		rank = wrl_config_selector_match(config_interface->selectors.interface,
+						 config_interface->selectors.ssid, interface);
+		if (rank > best) {
+			interface->config.interface = config_interface;
+			best = rank;
+		}
+	}
+
+	interface->config.client = NULL;
+	best = -1;
+	list_for_each_entry(config_client, &config->clients, head) {
+		rank = wrl_config_selector_match(config_client->selectors.interface,
+						 config_client->selectors.ssid, interface);
+		if (rank > best) {
+			interface->config.client = config_client;
+			best = rank;
+		}
+	}
+
+	interface->config.generation = config->generation;
+
+	wrl_stats_stage_done(WRL_STATS_STAGE_CONFIG, start);
 }
 
 /* State update methods */
 int
 wrl_config_interface_update(struct wrl_config *config, struct wrl_interface *interface)
 {
-	struct wrl_config_interface_selectors selectors = {};
 	struct wrl_config_interface *config_interface;
+	const char *group = "";
+	uint32_t max_clients;
+	uint8_t rebalance;
 	int tx_rate, rx_rate;
 
-	/* ToDo: Only interface supported for now */
-	strncpy(selectors.interface, interface->name, sizeof(selectors.interface));
+	wrl_config_resolve(config, interface);
 
-	config_interface = wrl_config_interface_get(config, &selectors, NULL);
+	config_interface = interface->config.interface;
 	if (!config_interface) {
 		rx_rate = 0;
 		tx_rate = 0;
+		max_clients = 0;
+		rebalance = 0;
 	} else {
 		rx_rate = config_interface->rate.down;
 		tx_rate = config_interface->rate.up;
+		max_clients = config_interface->max_clients;
+		rebalance = config_interface->rebalance;
+
+		/* Groups without a policy of their own are ignored */
+		if (config_interface->group[0] && wrl_config_group_get(config, config_interface->group, NULL))
+			group = config_interface->group;
+		else if (config_interface->group[0])
+			MSG(DEBUG, "Interface %s refers to unknown group %s\n", interface->name, config_interface->group);
 	}
 
-	if (rx_rate != interface->rate.down || tx_rate != interface->rate.up) {
-		interface->rate.down = rx_rate;
-		interface->rate.up = tx_rate;
+	wrl_client_table_set_max(&interface->clients, max_clients);
+	interface->rebalance = rebalance;
+
+	wrl_rate_set(&interface->rate, &interface->kernel_rate, interface->installed, rx_rate, tx_rate);
+
+	/* Joining or leaving a group rebuilds the tree, the slot is assigned on apply */
+	if (strncmp(group, interface->group.name, sizeof(interface->group.name))) {
+		memset(&interface->group, 0, sizeof(interface->group));
+		strncpy(interface->group.name, group, sizeof(interface->group.name) - 1);
 		interface->rate.applied = 0;
 	}
 
@@ -166,15 +391,19 @@ wrl_config_interface_update(struct wrl_config *config, struct wrl_interface *int
 int
 wrl_config_client_update(struct wrl_config *config, struct wrl_interface *interface, struct wrl_client *client)
 {
-	struct wrl_config_client_selectors selectors = {};
 	struct wrl_config_client *config_client;
+	struct wrl_mac_table_entry *mac_entry;
+	uint16_t airtime_weight;
 	int tx_rate, rx_rate;
 
-	/* ToDo: Only interface supported for now */
-	strncpy(selectors.interface, interface->name, sizeof(selectors.interface));
+	wrl_config_resolve(config, interface);
 
-	config_client = wrl_config_client_get(config, &selectors, NULL);
-	if (!config_client) {
+	config_client = interface->config.client;
+	mac_entry = wrl_mac_table_get(&config->macs, client->address);
+	if (mac_entry) {
+		rx_rate = mac_entry->down;
+		tx_rate = mac_entry->up;
+	} else if (!config_client) {
 		rx_rate = 0;
 		tx_rate = 0;
 	} else {
@@ -182,11 +411,16 @@ wrl_config_client_update(struct wrl_config *config, struct wrl_interface *interf
 		tx_rate = config_client->rate.up;
 	}
 
-	if (rx_rate != client->rate.down || tx_rate != client->rate.up) {
-		client->rate.down = rx_rate;
-		client->rate.up = tx_rate;
-		client->rate.applied = 0;
+	if (wrl_rate_set(&client->rate, &client->kernel_rate, client->installed, rx_rate, tx_rate))
+		wrl_client_changed(client);
+
+	/* MAC overrides only cover byte rates, airtime follows the client policy */
+	airtime_weight = config_client ? config_client->airtime_weight : 0;
+	if (airtime_weight != client->airtime.weight) {
+		client->airtime.weight = airtime_weight;
+		client->airtime.applied = 0;
+		wrl_client_changed(client);
 	}
 
-	return !client->rate.applied;
+	return !client->rate.applied || !client->airtime.applied;
 }
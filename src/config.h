@@ -5,10 +5,15 @@
 #include <string.h>
 
 #include "client.h"
+#include "group.h"
 #include "interface.h"
 #include "list.h"
+#include "mac-table.h"
 #include "rate.h"
 
+/* SSIDs are up to 32 octets, plus termination */
+#define WRL_CONFIG_SSID_LEN 33
+
 enum selector_type {
 	SELECTOR_TYPE_INTERFACE = 0x01,
 	SELECTOR_TYPE_SSID = 0x02,
@@ -17,7 +22,7 @@ enum selector_type {
 
 struct wrl_config_interface_selectors {
 	char interface[32];
-	char ssid[32];
+	char ssid[WRL_CONFIG_SSID_LEN];
 };
 
 struct wrl_config_interface {
@@ -27,11 +32,27 @@ struct wrl_config_interface {
 	struct wrl_config_interface_selectors selectors;
 
 	struct wrl_rate rate;
+
+	/* Client limit of matching interfaces, 0 for the default */
+	uint32_t max_clients;
+
+	/* Distribute the interface rate between active clients */
+	uint8_t rebalance;
+
+	/* Group sharing its rates with other interfaces, empty for none */
+	char group[WRL_GROUP_NAME_LEN];
+};
+
+struct wrl_config_group {
+	struct list_head head;
+
+	char name[WRL_GROUP_NAME_LEN];
+	struct wrl_rate rate;
 };
 
 struct wrl_config_client_selectors {
 	char interface[32];
-	char ssid[32];
+	char ssid[WRL_CONFIG_SSID_LEN];
 	char mac[6];
 };
 
@@ -42,11 +63,21 @@ struct wrl_config_client {
 	struct wrl_config_client_selectors selectors;
 
 	struct wrl_rate rate;
+
+	/* Airtime weight of matching stations, 0 for the driver default */
+	uint16_t airtime_weight;
 };
 
 struct wrl_config {
 	struct list_head interfaces;
 	struct list_head clients;
+	struct list_head groups;
+
+	/* Per-MAC overrides, take precedence over client policies */
+	struct wrl_mac_table macs;
+
+	/* Bumped on every selector change, invalidates resolved policies */
+	uint32_t generation;
 };
 
 void wrl_config_init(struct wrl_config *config);
@@ -59,6 +90,20 @@ void wrl_config_interface_purge(struct wrl_config *config);
 struct wrl_config_client *wrl_config_client_get(struct wrl_config *config, struct wrl_config_client_selectors *selectors, int *create);
 void wrl_config_client_purge(struct wrl_config *config);
 
+/* Group config */
+struct wrl_config_group *wrl_config_group_get(struct wrl_config *config, const char *name, int *create);
+void wrl_config_group_purge(struct wrl_config *config);
+
+/* MAC config */
+void wrl_config_mac_purge(struct wrl_config *config);
+
+/* Swap in a staged config if it differs, returns the number of changed policies */
+uint32_t wrl_config_replace(struct wrl_config *config, struct wrl_config *staging);
+
+/* Policy resolution */
+enum selector_type wrl_config_selector_type(const char *interface, const char *ssid);
+void wrl_config_resolve(struct wrl_config *config, struct wrl_interface *interface);
+
 /* State update methods */
 int wrl_config_interface_update(struct wrl_config *config, struct wrl_interface *interface);
-int wrl_config_client_update(struct wrl_config *config, struct wrl_interface *interface, struct wrl_client *client);
\ No newline at end of file
+int wrl_config_client_update(struct wrl_config *config, struct wrl_interface *interface, struct wrl_client *client);
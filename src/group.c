@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "backend.h"
+#include "config.h"
+#include "group.h"
+#include "interface.h"
+#include "log.h"
+#include "wrl.h"
+
+struct wrl_group *
+wrl_group_get(struct wrl_data *wrl, const char *name)
+{
+	struct wrl_group *group;
+
+	list_for_each_entry(group, &wrl->groups, head) {
+		if (!strncmp(group->name, name, sizeof(group->name)))
+			return group;
+	}
+
+	return NULL;
+}
+
+int
+wrl_group_name_valid(const char *name)
+{
+	size_t len = strlen(name);
+
+	if (!len || len >= WRL_GROUP_NAME_LEN)
+		return 0;
+
+	return strspn(name, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-") == len;
+}
+
+static struct wrl_group *
+wrl_group_ref(struct wrl_data *wrl, const struct wrl_group_ref *ref)
+{
+	struct wrl_group *group;
+
+	group = wrl_group_get(wrl, ref->name);
+	if (group)
+		return group;
+
+	group = calloc(1, sizeof(*group));
+	if (!group) {
+		MSG(ERROR, "Failed to allocate memory for group %s\n", ref->name);
+		return NULL;
+	}
+
+	strncpy(group->name, ref->name, sizeof(group->name) - 1);
+	list_add_tail(&group->head, &wrl->groups);
+
+	return group;
+}
+
+static int
+wrl_group_slot_used(struct wrl_data *wrl, const char *name, uint8_t slot)
+{
+	struct wrl_group_ref ref = {};
+	struct wrl_interface *interface;
+
+	strncpy(ref.name, name, sizeof(ref.name) - 1);
+	ref.slot = slot;
+
+	list_for_each_entry(interface, &wrl->interfaces, head) {
+		if (wrl_group_ref_equal(&interface->group, &ref) ||
+		    wrl_group_ref_equal(&interface->kernel_group, &ref))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void
+wrl_group_slot_assign(struct wrl_data *wrl, struct wrl_group *group, struct wrl_interface *interface)
+{
+	uint8_t slot;
+
+	/* Rejoining the group installed keeps the classes in place */
+	if (interface->kernel_group.slot &&
+	    !strncmp(interface->group.name, interface->kernel_group.name, sizeof(interface->group.name))) {
+		interface->group.slot = interface->kernel_group.slot;
+		return;
+	}
+
+	for (slot = 1; slot <= WRL_GROUP_MAX_MEMBERS; slot++) {
+		if (!wrl_group_slot_used(wrl, interface->group.name, slot)) {
+			interface->group.slot = slot;
+			group->full = 0;
+			return;
+		}
+	}
+
+	/* Retried on every apply, a slot might be released */
+	if (!group->full)
+		MSG(ERROR, "Group %s is full, interface %s is shaped on its own\n", group->name, interface->name);
+	group->full = 1;
+}
+
+/* Reported once, the backend is fixed for the lifetime of the daemon */
+static int wrl_group_unsupported;
+
+void
+wrl_group_sync(struct wrl_data *wrl)
+{
+	struct wrl_config_group *config_group;
+	struct wrl_interface *interface;
+	struct wrl_group *group, *tmp;
+	uint32_t down, up;
+
+	list_for_each_entry(group, &wrl->groups, head)
+		group->members = 0;
+
+	list_for_each_entry(interface, &wrl->interfaces, head) {
+		/* Without support by the backend members are shaped on their own, as in a full group */
+		if (interface->group.name[0] && !wrl->backend->groups) {
+			if (!wrl_group_unsupported)
+				MSG(ERROR, "Backend %s does not support groups, members are shaped on their own\n",
+				    wrl->backend->name);
+			wrl_group_unsupported = 1;
+			continue;
+		}
+
+		if (interface->group.name[0] && (group = wrl_group_ref(wrl, &interface->group))) {
+			if (!interface->group.slot)
+				wrl_group_slot_assign(wrl, group, interface);
+			if (interface->group.slot)
+				group->members++;
+		}
+
+		/* Trees of a group left are removed before the group */
+		if (interface->kernel_group.slot &&
+		    strncmp(interface->kernel_group.name, interface->group.name, sizeof(interface->group.name)) &&
+		    (group = wrl_group_ref(wrl, &interface->kernel_group)))
+			group->members++;
+	}
+
+	list_for_each_entry_safe(group, tmp, &wrl->groups, head) {
+		if (!group->members && !group->installed && !group->pending) {
+			list_del(&group->head);
+			free(group);
+			continue;
+		}
+
+		config_group = wrl_config_group_get(&wrl->config, group->name, NULL);
+		down = config_group ? config_group->rate.down : 0;
+		up = config_group ? config_group->rate.up : 0;
+
+		wrl_rate_set(&group->rate, &group->kernel_rate, group->installed, down, up);
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "list.h"
+#include "rate.h"
+
+struct wrl_data;
+
+/* Group names end up in the names of its IFB devices */
+#define WRL_GROUP_NAME_LEN 12
+
+/* Members of a group get their own range of class-ids in its trees */
+#define WRL_GROUP_SLOT_SHIFT 12
+#define WRL_GROUP_MAX_MEMBERS 15
+
+/* Membership of an interface, shaped on its own until a slot is assigned */
+struct wrl_group_ref {
+	char name[WRL_GROUP_NAME_LEN];
+
+	/* 1 to WRL_GROUP_MAX_MEMBERS, 0 for no group or while the group is full */
+	uint8_t slot;
+};
+
+/* Aggregate shaped for several interfaces, their trees are nested beneath it */
+struct wrl_group {
+	struct list_head head;
+
+	char name[WRL_GROUP_NAME_LEN];
+	struct wrl_rate rate;
+
+	/* Group trees present in the kernel, with these rates */
+	uint8_t installed;
+	struct wrl_rate kernel_rate;
+	struct wrl_backoff backoff;
+
+	/* Interfaces configured for or installed in the group */
+	uint32_t members;
+
+	/* Operation of this group is in flight */
+	uint8_t pending;
+
+	/* Operation planned by the current apply */
+	uint8_t queued;
+
+	/* Interfaces left without a slot, reported once */
+	uint8_t full;
+};
+
+static inline int
+wrl_group_ref_equal(const struct wrl_group_ref *a, const struct wrl_group_ref *b)
+{
+	return a->slot == b->slot && !strncmp(a->name, b->name, sizeof(a->name));
+}
+
+struct wrl_group *wrl_group_get(struct wrl_data *wrl, const char *name);
+
+/* Names are used in netdev names and shell commands, only UCI section name characters are accepted */
+int wrl_group_name_valid(const char *name);
+
+/* Track the groups referenced by interfaces, assign slots and pick up configured rates */
+void wrl_group_sync(struct wrl_data *wrl);
@@ -0,0 +1,197 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "backend.h"
+#include "client.h"
+#include "config.h"
+#include "interface.h"
+#include "log.h"
+#include "mac.h"
+#include "roam.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "wrl.h"
+
+struct wrl_interface *
+wrl_interface_alloc(const char *name)
+{
+	struct wrl_interface *interface;
+
+	interface = calloc(1, sizeof(struct wrl_interface));
+	if (!interface)
+		return NULL;
+
+	INIT_LIST_HEAD(&interface->head);
+	wrl_client_table_init(&interface->clients);
+	strncpy(interface->name, name, sizeof(interface->name) - 1);
+
+	return interface;
+}
+
+struct wrl_interface *
+wrl_interface_get(struct wrl_data *wrl, const char *name)
+{
+	struct wrl_interface *interface;
+
+	list_for_each_entry(interface, &wrl->interfaces, head) {
+		if (!strncmp(interface->name, name, sizeof(interface->name)))
+			return interface;
+	}
+
+	return NULL;
+}
+
+static int
+wrl_interface_adopt_client(void *priv, const struct wrl_backend_client_state *state)
+{
+	struct wrl_interface *interface = priv;
+	struct wrl_client *client;
+
+	client = wrl_client_get_at(&interface->clients, state->address, state->client_id);
+	if (!client)
+		return -ENOSPC;
+
+	client->rate = state->rate;
+	client->rate.applied = 1;
+	client->kernel_rate = client->rate;
+	client->guarantee = state->guarantee;
+	client->airtime.weight = state->airtime_weight;
+	client->airtime.applied = 1;
+	client->installed = 1;
+
+	/* Considered connected until the first client list says otherwise */
+	client->generation = interface->clients.generation;
+	client->connected = 1;
+
+	return 0;
+}
+
+void
+wrl_interface_adopt(struct wrl_data *wrl, struct wrl_interface *interface)
+{
+	const char *source = "snapshot";
+	struct wrl_rate rate = {};
+	int ret;
+
+	if (!wrl->backend->adopt)
+		return;
+
+	/* Snapshot of the previous instance saves dumping the kernel state */
+	ret = wrl_snapshot_restore(interface->name, &rate, wrl_interface_adopt_client, interface);
+	if (ret) {
+		wrl_client_table_flush(&interface->clients);
+		source = "kernel";
+		ret = wrl->backend->adopt(interface->name, &rate, wrl_interface_adopt_client, interface);
+	}
+
+	if (ret) {
+		/* Incomplete state is rebuilt from scratch */
+		if (ret != -ENOENT && ret != -ENODEV)
+			MSG(INFO, "Not adopting shaping of interface %s (%d)\n", interface->name, ret);
+		wrl_client_table_flush(&interface->clients);
+		return;
+	}
+
+	interface->rate = rate;
+	interface->rate.applied = 1;
+	interface->kernel_rate = rate;
+	interface->installed = 1;
+
+	MSG(INFO, "Adopted shaping of interface %s with %u clients from %s\n",
+	    interface->name, interface->clients.num_clients, source);
+}
+
+struct wrl_client *
+wrl_client_connected(struct wrl_data *wrl, struct wrl_interface *wrl_iface, uint8_t *mac)
+{
+	struct wrl_client *client;
+	uint8_t allocate = 0;
+
+	/* Get Client */
+	client = wrl_client_get(&wrl_iface->clients, mac, &allocate);
+	if (!client) {
+		MSG(ERROR, "Failed to get client\n");
+		return NULL;
+	}
+
+	/* Update policy */
+	if (wrl_config_client_update(&wrl->config, wrl_iface, client)) {
+		MSG(INFO, "Update rate-limits for client %02x:%02x:%02x:%02x:%02x:%02x rx=%d tx=%d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], client->rate.down, client->rate.up);
+	}
+
+	/* Returning clients might be queued for removal */
+	if (allocate || !client->connected) {
+		MSG(DEBUG, "New client, scheudling rate update\n");
+		wrl_client_rate_applied(client, 0);
+		client->connected_at = wrl_stats_now();
+
+		/* Stations associate with the default weight */
+		client->airtime.applied = !client->airtime.weight;
+
+		/* Stations moving between interfaces of the AP keep their shaping */
+		wrl_roam_connected(wrl, wrl_iface, client);
+	}
+
+	MSG(DEBUG, "Client %02x:%02x:%02x:%02x:%02x:%02x\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+	client->generation = wrl_iface->clients.generation;
+	client->connected = 1;
+
+	return client;
+}
+
+void
+wrl_client_departed(struct wrl_data *wrl, struct wrl_interface *wrl_iface, struct wrl_client *client)
+{
+	uint8_t *mac = client->address;
+
+	MSG(DEBUG, "Client %02x:%02x:%02x:%02x:%02x:%02x left interface %s\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], wrl_iface->name);
+
+	if (!client->installed && !client->pending) {
+		wrl_client_free(&wrl_iface->clients, client);
+		return;
+	}
+
+	/* Keep the client until its classes and filters are removed */
+	client->connected = 0;
+	wrl_client_rate_applied(client, 0);
+	wrl_schedule_apply(wrl, 0);
+}
+
+void
+wrl_client_disconnected(struct wrl_data *wrl, struct wrl_interface *wrl_iface, uint8_t *mac)
+{
+	struct wrl_client *client;
+
+	client = wrl_client_get(&wrl_iface->clients, mac, NULL);
+	if (!client || !client->connected) {
+		MSG(DEBUG, "Client not found\n");
+		return;
+	}
+
+	wrl_client_departed(wrl, wrl_iface, client);
+}
+
+void
+wrl_client_list_start(struct wrl_interface *interface)
+{
+	/* Stations connecting from now on are part of this generation */
+	interface->clients.generation++;
+}
+
+void
+wrl_client_list_done(struct wrl_data *wrl, struct wrl_interface *interface)
+{
+	struct wrl_client *client, *tmp;
+
+	/* Clients neither listed nor connected since the list was requested have left */
+	wrl_client_for_each_safe(client, tmp, &interface->clients) {
+		if (!client->connected || client->generation == interface->clients.generation)
+			continue;
+		wrl_client_departed(wrl, interface, client);
+	}
+}
@@ -3,26 +3,81 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <libubus.h>
+#include <libubox/uloop.h>
 
 #include "client.h"
+#include "group.h"
 #include "list.h"
 #include "rate.h"
+#include "stats.h"
 
-#define WRL_INTERFACE_NUM_CLIENTS 256
+struct wrl_config_interface;
+struct wrl_config_client;
+struct wrl_data;
 
 struct wrl_interface {
 	struct list_head head;
 
 	char name[32];
-	struct wrl_client clients[WRL_INTERFACE_NUM_CLIENTS];
+	struct wrl_client_table clients;
 	struct wrl_rate rate;
 
+	/* Shaping tree present in the kernel, with these rates */
+	uint8_t installed;
+	struct wrl_rate kernel_rate;
+	struct wrl_backoff backoff;
+
+	/* Group the trees are nested in, as configured and as installed */
+	struct wrl_group_ref group;
+	struct wrl_group_ref kernel_group;
+
+	/* Guarantees of clients follow their usage */
+	uint8_t rebalance;
+
+	/* Driver rejected airtime weights, not retried */
+	uint8_t airtime_unsupported;
+
+	/* Counters of the interface aggregate, sampled at usage_updated */
+	struct wrl_usage usage;
+	uint64_t usage_updated;
+
+	/* Cached from hostapd, refreshed when hostapd restarts */
+	char ssid[33];
+	uint8_t ssid_valid;
+
+	/* Policies resolved for this interface at a config generation */
+	struct {
+		uint32_t generation;
+		struct wrl_config_interface *interface;
+		struct wrl_config_client *client;
+	} config;
+
 	struct {
 		uint32_t id;
 
+		/* Outstanding get_status or get_clients request */
 		struct ubus_request req;
 		uint8_t req_pending;
+		uint64_t req_start;
+		struct uloop_timeout timeout;
+
+		/* Station events of the hostapd object */
+		struct ubus_subscriber subscriber;
 	} ubus;
 
 	uint8_t missing;
+
+	/* Time from association until the client limit was in place */
+	struct wrl_stats_histogram enforcement;
 };
+
+struct wrl_interface *wrl_interface_alloc(const char *name);
+struct wrl_interface *wrl_interface_get(struct wrl_data *wrl, const char *name);
+void wrl_interface_adopt(struct wrl_data *wrl, struct wrl_interface *interface);
+
+/* Client list reconciliation, lists are bracketed by start and done */
+void wrl_client_list_start(struct wrl_interface *interface);
+void wrl_client_list_done(struct wrl_data *wrl, struct wrl_interface *interface);
+struct wrl_client *wrl_client_connected(struct wrl_data *wrl, struct wrl_interface *wrl_iface, uint8_t *mac);
+void wrl_client_departed(struct wrl_data *wrl, struct wrl_interface *wrl_iface, struct wrl_client *client);
+void wrl_client_disconnected(struct wrl_data *wrl, struct wrl_interface *wrl_iface, uint8_t *mac);
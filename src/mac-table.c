@@ -0,0 +1,252 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "log.h"
+#include "mac.h"
+#include "mac-table.h"
+
+#define WRL_MAC_TABLE_MIN_BITS 4
+
+/* Linear probing stays short below 80% load */
+#define WRL_MAC_TABLE_CAPACITY(bits) ((1U << (bits)) / 5 * 4)
+
+void
+wrl_mac_table_init(struct wrl_mac_table *table)
+{
+	memset(table, 0, sizeof(*table));
+}
+
+void
+wrl_mac_table_free(struct wrl_mac_table *table)
+{
+	free(table->entries);
+	wrl_mac_table_init(table);
+}
+
+void
+wrl_mac_table_swap(struct wrl_mac_table *a, struct wrl_mac_table *b)
+{
+	struct wrl_mac_table tmp = *a;
+
+	*a = *b;
+	*b = tmp;
+}
+
+size_t
+wrl_mac_table_memory(struct wrl_mac_table *table)
+{
+	if (!table->entries)
+		return 0;
+
+	return (1U << table->bits) * sizeof(*table->entries);
+}
+
+static uint32_t
+wrl_mac_table_count_changed(struct wrl_mac_table *table, struct wrl_mac_table *other, int compare)
+{
+	uint32_t size = table->entries ? 1U << table->bits : 0;
+	struct wrl_mac_table_entry *match;
+	uint32_t changes = 0;
+
+	for (uint32_t i = 0; i < size; i++) {
+		if (wrl_mac_is_zero(table->entries[i].address))
+			continue;
+
+		match = wrl_mac_table_get(other, table->entries[i].address);
+		if (!match || (compare && (match->down != table->entries[i].down || match->up != table->entries[i].up)))
+			changes++;
+	}
+
+	return changes;
+}
+
+/* Entries added, changed or removed going from one table to the other */
+uint32_t
+wrl_mac_table_changes(struct wrl_mac_table *from, struct wrl_mac_table *to)
+{
+	return wrl_mac_table_count_changed(to, from, 1) + wrl_mac_table_count_changed(from, to, 0);
+}
+
+static struct wrl_mac_table_entry *
+wrl_mac_table_find(struct wrl_mac_table *table, const uint8_t *mac)
+{
+	uint32_t mask = (1U << table->bits) - 1;
+	uint32_t pos = wrl_mac_hash(mac, table->bits);
+	struct wrl_mac_table_entry *entry;
+
+	/* Terminates at the first empty entry, the table is never full */
+	while (1) {
+		entry = &table->entries[pos];
+		if (wrl_mac_is_zero(entry->address) || memcmp(entry->address, mac, 6) == 0)
+			return entry;
+
+		pos = (pos + 1) & mask;
+	}
+}
+
+static int
+wrl_mac_table_resize(struct wrl_mac_table *table, uint32_t bits)
+{
+	struct wrl_mac_table_entry *entries = table->entries;
+	uint32_t size = table->entries ? 1U << table->bits : 0;
+
+	table->entries = calloc(1U << bits, sizeof(*table->entries));
+	if (!table->entries) {
+		table->entries = entries;
+		return -ENOMEM;
+	}
+
+	table->bits = bits;
+	for (uint32_t i = 0; i < size; i++) {
+		if (!wrl_mac_is_zero(entries[i].address))
+			*wrl_mac_table_find(table, entries[i].address) = entries[i];
+	}
+
+	free(entries);
+
+	return 0;
+}
+
+int
+wrl_mac_table_reserve(struct wrl_mac_table *table, uint32_t num_entries)
+{
+	uint32_t bits = table->entries ? table->bits : WRL_MAC_TABLE_MIN_BITS;
+
+	while (WRL_MAC_TABLE_CAPACITY(bits) < num_entries)
+		bits++;
+
+	if (table->entries && bits == table->bits)
+		return 0;
+
+	return wrl_mac_table_resize(table, bits);
+}
+
+struct wrl_mac_table_entry *
+wrl_mac_table_get(struct wrl_mac_table *table, const uint8_t *mac)
+{
+	struct wrl_mac_table_entry *entry;
+
+	if (!table->num_entries)
+		return NULL;
+
+	entry = wrl_mac_table_find(table, mac);
+	if (wrl_mac_is_zero(entry->address))
+		return NULL;
+
+	return entry;
+}
+
+int
+wrl_mac_table_set(struct wrl_mac_table *table, const uint8_t *mac, uint32_t down, uint32_t up)
+{
+	struct wrl_mac_table_entry *entry;
+	int ret;
+
+	/* Zero address marks empty entries */
+	if (wrl_mac_is_zero(mac))
+		return -EINVAL;
+
+	ret = wrl_mac_table_reserve(table, table->num_entries + 1);
+	if (ret)
+		return ret;
+
+	entry = wrl_mac_table_find(table, mac);
+	if (wrl_mac_is_zero(entry->address)) {
+		memcpy(entry->address, mac, 6);
+		table->num_entries++;
+	}
+
+	entry->down = down;
+	entry->up = up;
+
+	return 0;
+}
+
+int
+wrl_mac_table_remove(struct wrl_mac_table *table, const uint8_t *mac)
+{
+	uint32_t mask = (1U << table->bits) - 1;
+	struct wrl_mac_table_entry *entry;
+	uint32_t pos, next, home;
+
+	entry = wrl_mac_table_get(table, mac);
+	if (!entry)
+		return -ENOENT;
+
+	/* Shift back entries of the probe sequence instead of leaving a tombstone */
+	pos = entry - table->entries;
+	memset(entry, 0, sizeof(*entry));
+	next = (pos + 1) & mask;
+	while (!wrl_mac_is_zero(table->entries[next].address)) {
+		home = wrl_mac_hash(table->entries[next].address, table->bits);
+
+		/* Entry may only move if its home slot is not between the gap and itself */
+		if (((next - home) & mask) >= ((next - pos) & mask)) {
+			table->entries[pos] = table->entries[next];
+			memset(&table->entries[next], 0, sizeof(table->entries[next]));
+			pos = next;
+		}
+
+		next = (next + 1) & mask;
+	}
+
+	table->num_entries--;
+
+	return 0;
+}
+
+int
+wrl_mac_table_load(struct wrl_mac_table *table, const char *path)
+{
+	char line[128], mac_string[18];
+	unsigned int down, up;
+	int num_lines = 0;
+	int line_number = 0;
+	uint8_t mac[6];
+	FILE *f;
+	int ret;
+
+	f = fopen(path, "r");
+	if (!f) {
+		MSG(ERROR, "Failed to open MAC table %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	/* Size the table once instead of growing it while loading */
+	while (fgets(line, sizeof(line), f))
+		num_lines++;
+
+	ret = wrl_mac_table_reserve(table, table->num_entries + num_lines);
+	if (ret)
+		goto out;
+
+	rewind(f);
+	while (fgets(line, sizeof(line), f)) {
+		line_number++;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (sscanf(line, "%17s %u %u", mac_string, &down, &up) != 3 ||
+		    !wrl_mac_from_string(mac_string, mac)) {
+			MSG(WARN, "Skipping invalid line %d of MAC table %s\n", line_number, path);
+			continue;
+		}
+
+		ret = wrl_mac_table_set(table, mac, down, up);
+		if (ret)
+			goto out;
+	}
+
+	ret = table->num_entries;
+
+out:
+	fclose(f);
+	return ret;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/* Per-MAC rate overrides, compact enough for 100k subscribers */
+struct wrl_mac_table_entry {
+	uint8_t address[6];
+	uint32_t down;
+	uint32_t up;
+} __attribute__((aligned(4)));
+
+struct wrl_mac_table {
+	/* Open addressing, empty entries have a zero address */
+	struct wrl_mac_table_entry *entries;
+	uint32_t bits;
+	uint32_t num_entries;
+};
+
+void wrl_mac_table_init(struct wrl_mac_table *table);
+void wrl_mac_table_free(struct wrl_mac_table *table);
+void wrl_mac_table_swap(struct wrl_mac_table *a, struct wrl_mac_table *b);
+int wrl_mac_table_reserve(struct wrl_mac_table *table, uint32_t num_entries);
+size_t wrl_mac_table_memory(struct wrl_mac_table *table);
+uint32_t wrl_mac_table_changes(struct wrl_mac_table *from, struct wrl_mac_table *to);
+
+struct wrl_mac_table_entry *wrl_mac_table_get(struct wrl_mac_table *table, const uint8_t *mac);
+int wrl_mac_table_set(struct wrl_mac_table *table, const uint8_t *mac, uint32_t down, uint32_t up);
+int wrl_mac_table_remove(struct wrl_mac_table *table, const uint8_t *mac);
+
+/* Read "<mac> <down> <up>" lines, returns the number of entries or a negative error */
+int wrl_mac_table_load(struct wrl_mac_table *table, const char *path);
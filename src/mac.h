@@ -48,3 +48,15 @@ wrl_mac_is_zero(const uint8_t *mac)
 
 	return 1;
 }
+
+static inline uint32_t
+wrl_mac_hash(const uint8_t *mac, uint32_t bits)
+{
+	uint64_t key = 0;
+
+	for (int i = 0; i < 6; i++)
+		key = (key << 8) | mac[i];
+
+	/* Fibonacci hashing, the top bits are the best mixed ones */
+	return (key * 0x9E3779B97F4A7C15ULL) >> (64 - bits);
+}
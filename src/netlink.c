@@ -0,0 +1,378 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "log.h"
+#include "netlink.h"
+#include "stats.h"
+
+#define WRL_NL_RECV_SIZE 32768
+#define WRL_NL_RCVBUF_SIZE (1024 * 1024)
+
+static uint8_t wrl_nl_recv_buf[WRL_NL_RECV_SIZE] __attribute__((aligned(4)));
+
+int
+wrl_nl_open(struct wrl_nl *nl, int protocol)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+	};
+	socklen_t addr_len = sizeof(addr);
+	int rcvbuf = WRL_NL_RCVBUF_SIZE;
+	int one = 1;
+
+	nl->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
+	if (nl->fd < 0) {
+		MSG(ERROR, "Failed to open netlink socket: %s\n", strerror(errno));
+		return -errno;
+	}
+
+	/* Ask for the failing attribute in error messages */
+	setsockopt(nl->fd, SOL_NETLINK, NETLINK_EXT_ACK, &one, sizeof(one));
+
+	/* Batches are acknowledged at once, keep errors small and leave room for them */
+	setsockopt(nl->fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+	setsockopt(nl->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	if (bind(nl->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    getsockname(nl->fd, (struct sockaddr *)&addr, &addr_len) < 0) {
+		MSG(ERROR, "Failed to bind netlink socket: %s\n", strerror(errno));
+		close(nl->fd);
+		nl->fd = -1;
+		return -errno;
+	}
+
+	nl->portid = addr.nl_pid;
+	nl->seq = 0;
+
+	return 0;
+}
+
+void
+wrl_nl_close(struct wrl_nl *nl)
+{
+	if (nl->fd < 0)
+		return;
+
+	close(nl->fd);
+	nl->fd = -1;
+}
+
+void *
+wrl_nl_msg_init(struct wrl_nl_msg *msg, uint16_t type, uint16_t flags, size_t hdrlen)
+{
+	memset(msg->buf, 0, NLMSG_SPACE(hdrlen));
+	msg->overflow = 0;
+
+	msg->nlh.nlmsg_len = NLMSG_LENGTH(hdrlen);
+	msg->nlh.nlmsg_type = type;
+	msg->nlh.nlmsg_flags = NLM_F_REQUEST | flags;
+
+	return NLMSG_DATA(&msg->nlh);
+}
+
+int
+wrl_nl_attr_put(struct wrl_nl_msg *msg, uint16_t type, const void *data, size_t len)
+{
+	struct nlattr *attr;
+	size_t offset = NLMSG_ALIGN(msg->nlh.nlmsg_len);
+
+	if (offset + NLA_HDRLEN + NLA_ALIGN(len) > sizeof(msg->buf)) {
+		msg->overflow = 1;
+		return -ENOBUFS;
+	}
+
+	attr = (struct nlattr *)(msg->buf + offset);
+	attr->nla_type = type;
+	attr->nla_len = NLA_HDRLEN + len;
+	if (len)
+		memcpy(wrl_nl_attr_data(attr), data, len);
+	memset((uint8_t *)wrl_nl_attr_data(attr) + len, 0, NLA_ALIGN(len) - len);
+
+	msg->nlh.nlmsg_len = offset + NLA_HDRLEN + NLA_ALIGN(len);
+
+	return 0;
+}
+
+int
+wrl_nl_attr_put_u16(struct wrl_nl_msg *msg, uint16_t type, uint16_t value)
+{
+	return wrl_nl_attr_put(msg, type, &value, sizeof(value));
+}
+
+int
+wrl_nl_attr_put_u32(struct wrl_nl_msg *msg, uint16_t type, uint32_t value)
+{
+	return wrl_nl_attr_put(msg, type, &value, sizeof(value));
+}
+
+int
+wrl_nl_attr_put_u64(struct wrl_nl_msg *msg, uint16_t type, uint64_t value)
+{
+	return wrl_nl_attr_put(msg, type, &value, sizeof(value));
+}
+
+int
+wrl_nl_attr_put_str(struct wrl_nl_msg *msg, uint16_t type, const char *str)
+{
+	return wrl_nl_attr_put(msg, type, str, strlen(str) + 1);
+}
+
+struct nlattr *
+wrl_nl_nest_start(struct wrl_nl_msg *msg, uint16_t type)
+{
+	struct nlattr *nest;
+
+	nest = (struct nlattr *)(msg->buf + NLMSG_ALIGN(msg->nlh.nlmsg_len));
+	if (wrl_nl_attr_put(msg, type | NLA_F_NESTED, NULL, 0))
+		return NULL;
+
+	return nest;
+}
+
+void
+wrl_nl_nest_end(struct wrl_nl_msg *msg, struct nlattr *nest)
+{
+	if (!nest)
+		return;
+
+	nest->nla_len = msg->buf + msg->nlh.nlmsg_len - (uint8_t *)nest;
+}
+
+void
+wrl_nl_attr_parse(struct nlattr **tb, int max, void *data, int len)
+{
+	struct nlattr *attr = data;
+	uint16_t type;
+
+	memset(tb, 0, sizeof(struct nlattr *) * (max + 1));
+
+	while (len >= NLA_HDRLEN && attr->nla_len >= NLA_HDRLEN && attr->nla_len <= len) {
+		type = attr->nla_type & NLA_TYPE_MASK;
+		if (type <= max)
+			tb[type] = attr;
+
+		len -= NLA_ALIGN(attr->nla_len);
+		attr = (struct nlattr *)((uint8_t *)attr + NLA_ALIGN(attr->nla_len));
+	}
+}
+
+static int
+wrl_nl_send(struct wrl_nl *nl, struct wrl_nl_msg *msg)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+	};
+
+	if (msg->overflow) {
+		MSG(ERROR, "Netlink message exceeds buffer size\n");
+		return -ENOBUFS;
+	}
+
+	msg->nlh.nlmsg_seq = ++nl->seq;
+	msg->nlh.nlmsg_pid = nl->portid;
+
+	if (sendto(nl->fd, msg->buf, msg->nlh.nlmsg_len, 0, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		MSG(ERROR, "Failed to send netlink message: %s\n", strerror(errno));
+		return -errno;
+	}
+
+	return 0;
+}
+
+static int
+wrl_nl_recv(struct wrl_nl *nl, uint32_t seq, wrl_nl_cb cb, void *priv)
+{
+	uint8_t *buf = wrl_nl_recv_buf;
+	struct nlmsgerr *err;
+	struct nlmsghdr *nlh;
+	ssize_t len;
+	int ret;
+
+	while (1) {
+		len = recv(nl->fd, buf, WRL_NL_RECV_SIZE, 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			MSG(ERROR, "Failed to receive netlink message: %s\n", strerror(errno));
+			return -errno;
+		}
+
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			/* Stale reply of an earlier request */
+			if (nlh->nlmsg_seq != seq)
+				continue;
+
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return 0;
+
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				err = NLMSG_DATA(nlh);
+				return err->error;
+			}
+
+			if (!cb)
+				continue;
+
+			ret = cb(nlh, priv);
+			if (ret)
+				return ret;
+		}
+	}
+}
+
+int
+wrl_nl_request(struct wrl_nl *nl, struct wrl_nl_msg *msg)
+{
+	int ret;
+
+	msg->nlh.nlmsg_flags |= NLM_F_ACK;
+
+	wrl_stats.counters.backend_commands++;
+
+	ret = wrl_nl_send(nl, msg);
+	if (!ret)
+		ret = wrl_nl_recv(nl, nl->seq, NULL, NULL);
+
+	if (ret)
+		wrl_stats.counters.backend_failures++;
+
+	return ret;
+}
+
+int
+wrl_nl_dump(struct wrl_nl *nl, struct wrl_nl_msg *msg, wrl_nl_cb cb, void *priv)
+{
+	int ret;
+
+	msg->nlh.nlmsg_flags |= NLM_F_DUMP;
+
+	ret = wrl_nl_send(nl, msg);
+	if (ret)
+		return ret;
+
+	return wrl_nl_recv(nl, nl->seq, cb, priv);
+}
+
+void
+wrl_nl_batch_add(struct wrl_nl *nl, struct wrl_nl_batch *batch, struct wrl_nl_msg *msg, int *ret, int ignore_error)
+{
+	struct nlmsghdr *nlh;
+
+	if (msg->overflow) {
+		MSG(ERROR, "Netlink message exceeds buffer size\n");
+		if (ret && !*ret)
+			*ret = -ENOBUFS;
+		return;
+	}
+
+	if (batch->len + NLMSG_ALIGN(msg->nlh.nlmsg_len) > sizeof(batch->buf) ||
+	    batch->count == WRL_NL_BATCH_MSGS)
+		wrl_nl_batch_flush(nl, batch);
+
+	nlh = (struct nlmsghdr *)(batch->buf + batch->len);
+	memcpy(nlh, msg->buf, msg->nlh.nlmsg_len);
+	nlh->nlmsg_flags |= NLM_F_ACK;
+	nlh->nlmsg_seq = ++nl->seq;
+	nlh->nlmsg_pid = nl->portid;
+
+	if (!batch->count)
+		batch->seq = nlh->nlmsg_seq;
+
+	batch->slots[batch->count].ret = ret;
+	batch->slots[batch->count].ignore_error = ignore_error;
+	batch->slots[batch->count].acked = 0;
+	batch->count++;
+	batch->len += NLMSG_ALIGN(nlh->nlmsg_len);
+}
+
+static void
+wrl_nl_batch_result(struct wrl_nl_batch_slot *slot, int error)
+{
+	if (!error || error == slot->ignore_error)
+		return;
+
+	/* Best effort messages are expected to fail */
+	if (slot->ret)
+		wrl_stats.counters.backend_failures++;
+
+	/* Keep the first error of a slot owner */
+	if (slot->ret && !*slot->ret)
+		*slot->ret = error;
+}
+
+int
+wrl_nl_batch_flush(struct wrl_nl *nl, struct wrl_nl_batch *batch)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+	};
+	uint8_t *buf = wrl_nl_recv_buf;
+	struct nlmsgerr *err;
+	struct nlmsghdr *nlh;
+	int acked = 0;
+	uint32_t idx;
+	ssize_t len;
+	int ret = 0;
+	int i;
+
+	if (!batch->count)
+		return 0;
+
+	wrl_stats.counters.backend_commands += batch->count;
+
+	MSG(DEBUG, "Sending netlink batch of %d messages (%zu bytes)\n", batch->count, batch->len);
+
+	if (sendto(nl->fd, batch->buf, batch->len, 0, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		ret = -errno;
+		MSG(ERROR, "Failed to send netlink batch: %s\n", strerror(errno));
+		goto out;
+	}
+
+	/* Collect one acknowledgement per message */
+	while (acked < batch->count) {
+		len = recv(nl->fd, buf, WRL_NL_RECV_SIZE, 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			MSG(ERROR, "Failed to receive netlink batch acknowledgement: %s\n", strerror(errno));
+			goto out;
+		}
+
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			idx = nlh->nlmsg_seq - batch->seq;
+			if (nlh->nlmsg_type != NLMSG_ERROR || idx >= batch->count)
+				continue;
+
+			if (batch->slots[idx].acked)
+				continue;
+
+			err = NLMSG_DATA(nlh);
+			wrl_nl_batch_result(&batch->slots[idx], err->error);
+			batch->slots[idx].acked = 1;
+			acked++;
+		}
+	}
+
+out:
+	/* Unacknowledged messages share the transport error */
+	if (ret) {
+		for (i = 0; i < batch->count; i++) {
+			if (!batch->slots[i].acked)
+				wrl_nl_batch_result(&batch->slots[i], ret);
+		}
+	}
+
+	batch->count = 0;
+	batch->len = 0;
+
+	return ret;
+}
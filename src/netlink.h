@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <linux/netlink.h>
+
+#define WRL_NL_MSG_SIZE 4096
+#define WRL_NL_BATCH_SIZE 65536
+#define WRL_NL_BATCH_MSGS 1024
+
+struct wrl_nl {
+	int fd;
+	uint32_t portid;
+	uint32_t seq;
+};
+
+struct wrl_nl_msg {
+	union {
+		struct nlmsghdr nlh;
+		uint8_t buf[WRL_NL_MSG_SIZE];
+	};
+
+	uint8_t overflow;
+};
+
+struct wrl_nl_batch_slot {
+	int *ret;
+	int ignore_error;
+	uint8_t acked;
+};
+
+struct wrl_nl_batch {
+	uint8_t buf[WRL_NL_BATCH_SIZE] __attribute__((aligned(4)));
+	size_t len;
+
+	/* Sequence number of the first queued message */
+	uint32_t seq;
+	int count;
+	struct wrl_nl_batch_slot slots[WRL_NL_BATCH_MSGS];
+};
+
+typedef int (*wrl_nl_cb)(struct nlmsghdr *nlh, void *priv);
+
+/* Socket */
+int wrl_nl_open(struct wrl_nl *nl, int protocol);
+void wrl_nl_close(struct wrl_nl *nl);
+
+/* Message construction */
+void *wrl_nl_msg_init(struct wrl_nl_msg *msg, uint16_t type, uint16_t flags, size_t hdrlen);
+int wrl_nl_attr_put(struct wrl_nl_msg *msg, uint16_t type, const void *data, size_t len);
+int wrl_nl_attr_put_u16(struct wrl_nl_msg *msg, uint16_t type, uint16_t value);
+int wrl_nl_attr_put_u32(struct wrl_nl_msg *msg, uint16_t type, uint32_t value);
+int wrl_nl_attr_put_u64(struct wrl_nl_msg *msg, uint16_t type, uint64_t value);
+int wrl_nl_attr_put_str(struct wrl_nl_msg *msg, uint16_t type, const char *str);
+struct nlattr *wrl_nl_nest_start(struct wrl_nl_msg *msg, uint16_t type);
+void wrl_nl_nest_end(struct wrl_nl_msg *msg, struct nlattr *nest);
+
+/* Message parsing */
+void wrl_nl_attr_parse(struct nlattr **tb, int max, void *data, int len);
+
+static inline void *
+wrl_nl_attr_data(const struct nlattr *attr)
+{
+	return (uint8_t *)attr + NLA_HDRLEN;
+}
+
+static inline int
+wrl_nl_attr_len(const struct nlattr *attr)
+{
+	return attr->nla_len - NLA_HDRLEN;
+}
+
+/* Transactions */
+int wrl_nl_request(struct wrl_nl *nl, struct wrl_nl_msg *msg);
+int wrl_nl_dump(struct wrl_nl *nl, struct wrl_nl_msg *msg, wrl_nl_cb cb, void *priv);
+
+/* Batches */
+void wrl_nl_batch_add(struct wrl_nl *nl, struct wrl_nl_batch *batch, struct wrl_nl_msg *msg, int *ret, int ignore_error);
+int wrl_nl_batch_flush(struct wrl_nl *nl, struct wrl_nl_batch *batch);
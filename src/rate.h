@@ -9,3 +9,52 @@ struct wrl_rate{
 
 	uint8_t applied;
 };
+
+/* Take new rates, returning to the rates still in the kernel needs no change. Returns 1 on change. */
+static inline int
+wrl_rate_set(struct wrl_rate *rate, const struct wrl_rate *kernel_rate, int installed, uint32_t down, uint32_t up)
+{
+	if (down == rate->down && up == rate->up)
+		return 0;
+
+	rate->down = down;
+	rate->up = up;
+	rate->applied = installed && down == kernel_rate->down && up == kernel_rate->up;
+
+	return 1;
+}
+
+/* Retry state of failed shaping operations */
+struct wrl_backoff {
+	/* Monotonic time in usec before which no retry is made */
+	uint64_t retry_at;
+	uint8_t failures;
+};
+
+/* Airtime weight of a station, applied through nl80211 */
+struct wrl_airtime {
+	/* 0 keeps the driver default */
+	uint16_t weight;
+
+	uint8_t applied;
+
+	/* Kept apart from the shaping of the station, neither delays the other */
+	struct wrl_backoff backoff;
+};
+
+/* Class counters of one direction */
+struct wrl_counters {
+	uint64_t bytes;
+	uint64_t packets;
+	uint32_t drops;
+	uint32_t overlimits;
+	uint32_t backlog;
+
+	/* Smoothed throughput in kbit/s */
+	uint32_t rate;
+};
+
+struct wrl_usage {
+	struct wrl_counters down;
+	struct wrl_counters up;
+};
@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "backend.h"
+#include "client.h"
+#include "interface.h"
+#include "log.h"
+#include "wrl.h"
+
+/* Clients turn active above and idle below these rates in kbit/s */
+#define WRL_REBALANCE_ACTIVE_RATE	128
+#define WRL_REBALANCE_IDLE_RATE		32
+
+/* Guarantee of idle clients and reserve of the default class in kbit/s */
+#define WRL_REBALANCE_MIN_RATE		64
+
+/* Guarantees are only changed by more than 1/WRL_REBALANCE_HYSTERESIS */
+#define WRL_REBALANCE_HYSTERESIS	8
+
+struct wrl_rebalance_share {
+	struct wrl_client *client;
+	uint32_t ceil;
+};
+
+/* Active clients of the interface being rebalanced, grown on demand and reused */
+static struct {
+	struct wrl_rebalance_share *shares;
+	uint32_t num_shares;
+} wrl_rebalance_state;
+
+static uint32_t *
+wrl_rebalance_rate(struct wrl_rate *rate, enum wrl_direction direction)
+{
+	return direction == WRL_DIRECTION_DOWN ? &rate->down : &rate->up;
+}
+
+static int
+wrl_rebalance_share_cmp(const void *a, const void *b)
+{
+	const struct wrl_rebalance_share *share_a = a, *share_b = b;
+
+	if (share_a->ceil == share_b->ceil)
+		return 0;
+
+	return share_a->ceil < share_b->ceil ? -1 : 1;
+}
+
+static int
+wrl_rebalance_client_active(struct wrl_client *client, enum wrl_direction direction)
+{
+	struct wrl_counters *counters = direction == WRL_DIRECTION_DOWN ? &client->usage.down : &client->usage.up;
+	uint8_t bit = 1 << direction;
+
+	if (counters->rate >= WRL_REBALANCE_ACTIVE_RATE)
+		client->active |= bit;
+	else if (counters->rate < WRL_REBALANCE_IDLE_RATE)
+		client->active &= ~bit;
+
+	return !!(client->active & bit);
+}
+
+static int
+wrl_rebalance_client_set(struct wrl_client *client, enum wrl_direction direction, uint32_t guarantee)
+{
+	uint32_t *current = wrl_rebalance_rate(&client->guarantee, direction);
+	uint32_t delta;
+
+	delta = guarantee > *current ? guarantee - *current : *current - guarantee;
+	if (!delta || (*current && guarantee && delta * WRL_REBALANCE_HYSTERESIS <= *current))
+		return 0;
+
+	*current = guarantee;
+	client->guarantee.applied = 0;
+	wrl_client_changed(client);
+
+	return 1;
+}
+
+static int
+wrl_rebalance_direction(struct wrl_interface *interface, enum wrl_direction direction)
+{
+	uint32_t capacity = *wrl_rebalance_rate(&interface->rate, direction);
+	struct wrl_rebalance_share *shares;
+	uint32_t num_active = 0, num_idle = 0;
+	uint64_t available, reserved;
+	struct wrl_client *client;
+	uint32_t guarantee, ceil;
+	int changed = 0;
+	uint32_t i;
+
+	if (interface->rebalance && capacity && interface->clients.num_clients > wrl_rebalance_state.num_shares) {
+		shares = realloc(wrl_rebalance_state.shares, interface->clients.num_clients * sizeof(*shares));
+		if (!shares)
+			return 0;
+
+		wrl_rebalance_state.shares = shares;
+		wrl_rebalance_state.num_shares = interface->clients.num_clients;
+	}
+	shares = wrl_rebalance_state.shares;
+
+	wrl_client_for_each(client, &interface->clients) {
+		if (!client->connected || !client->installed)
+			continue;
+
+		ceil = wrl_backend_rate(*wrl_rebalance_rate(&client->rate, direction));
+
+		/* Without an interface limit there is nothing to share */
+		if (!interface->rebalance || !capacity) {
+			changed |= wrl_rebalance_client_set(client, direction, 0);
+			continue;
+		}
+
+		if (!wrl_rebalance_client_active(client, direction)) {
+			changed |= wrl_rebalance_client_set(client, direction,
+							    ceil < WRL_REBALANCE_MIN_RATE ? ceil : WRL_REBALANCE_MIN_RATE);
+			num_idle++;
+			continue;
+		}
+
+		shares[num_active].client = client;
+		shares[num_active].ceil = ceil;
+		num_active++;
+	}
+
+	if (!num_active)
+		return changed;
+
+	/* Idle clients and the default class keep a small reserve */
+	reserved = (uint64_t)(num_idle + 1) * WRL_REBALANCE_MIN_RATE;
+	available = capacity > reserved ? capacity - reserved : 0;
+
+	/* Max-min fair share, clients limited below their share leave the rest to others */
+	qsort(shares, num_active, sizeof(*shares), wrl_rebalance_share_cmp);
+	for (i = 0; i < num_active; i++) {
+		guarantee = available / (num_active - i);
+		if (guarantee > shares[i].ceil)
+			guarantee = shares[i].ceil;
+		if (guarantee < WRL_REBALANCE_MIN_RATE)
+			guarantee = shares[i].ceil < WRL_REBALANCE_MIN_RATE ? shares[i].ceil : WRL_REBALANCE_MIN_RATE;
+
+		available = available > guarantee ? available - guarantee : 0;
+		changed |= wrl_rebalance_client_set(shares[i].client, direction, guarantee);
+	}
+
+	return changed;
+}
+
+void
+wrl_rebalance(struct wrl_data *wrl)
+{
+	struct wrl_interface *interface;
+	int changed = 0;
+
+	/* Usage is only known for backends providing class counters */
+	if (!wrl->backend->counters || wrl->full_purge != WRL_PURGE_NONE)
+		return;
+
+	list_for_each_entry(interface, &wrl->interfaces, head) {
+		if (!interface->rate.applied || (interface->rebalance && !interface->usage_updated))
+			continue;
+
+		if (wrl_rebalance_direction(interface, WRL_DIRECTION_DOWN) |
+		    wrl_rebalance_direction(interface, WRL_DIRECTION_UP)) {
+			MSG(DEBUG, "Rebalanced guarantees of interface %s\n", interface->name);
+			changed = 1;
+		}
+	}
+
+	if (changed)
+		wrl_schedule_apply(wrl, 0);
+}
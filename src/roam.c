@@ -0,0 +1,280 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "backend.h"
+#include "client.h"
+#include "interface.h"
+#include "log.h"
+#include "roam.h"
+#include "stats.h"
+#include "wrl.h"
+
+/* Entry of the station on the member of a group at a slot */
+static struct wrl_client *
+wrl_roam_client_get(struct wrl_data *wrl, const char *group, const struct wrl_client_ref *ref,
+		    const uint8_t *mac, struct wrl_interface **member)
+{
+	struct wrl_interface *interface;
+	struct wrl_client *client;
+
+	list_for_each_entry(interface, &wrl->interfaces, head) {
+		if (interface->kernel_group.slot != ref->slot ||
+		    strncmp(interface->kernel_group.name, group, sizeof(interface->kernel_group.name)))
+			continue;
+
+		client = wrl_client_get(&interface->clients, mac, NULL);
+		if (!client || client->id != ref->id)
+			return NULL;
+
+		if (member)
+			*member = interface;
+		return client;
+	}
+
+	return NULL;
+}
+
+/* Entry on another member still relying on the filters or the class of the client */
+static int
+wrl_roam_client_used(struct wrl_data *wrl, struct wrl_interface *interface, struct wrl_client *client)
+{
+	struct wrl_client_ref ref = {
+		.slot = interface->kernel_group.slot,
+		.id = client->id,
+	};
+	struct wrl_interface *member;
+	struct wrl_client *other;
+
+	if (!ref.slot)
+		return 0;
+
+	list_for_each_entry(member, &wrl->interfaces, head) {
+		if (member == interface || !member->kernel_group.slot ||
+		    strncmp(member->kernel_group.name, interface->kernel_group.name, sizeof(member->kernel_group.name)))
+			continue;
+
+		other = wrl_client_get(&member->clients, client->address, NULL);
+		if (!other)
+			continue;
+
+		if ((client->roamed && wrl_client_ref_equal(&other->from, &ref)) ||
+		    (client->lent && wrl_client_ref_equal(&other->home, &ref)))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int
+wrl_roam_migratable(struct wrl_interface *interface, struct wrl_interface *other,
+		    struct wrl_client *client, struct wrl_client *previous)
+{
+	/* Classes are shared within the trees of a group only */
+	if (!interface->installed || !interface->kernel_group.slot ||
+	    !wrl_group_ref_equal(&interface->group, &interface->kernel_group) ||
+	    !other->installed || !other->kernel_group.slot ||
+	    strncmp(interface->kernel_group.name, other->kernel_group.name, sizeof(interface->kernel_group.name)))
+		return 0;
+
+	if (!previous->installed || previous->pending)
+		return 0;
+
+	/* Returning to the member the class was created on */
+	if (client->lent)
+		return previous->home.slot == interface->kernel_group.slot && previous->home.id == client->id;
+
+	return !client->installed && !client->pending && !client->from.slot;
+}
+
+void
+wrl_roam_connected(struct wrl_data *wrl, struct wrl_interface *interface, struct wrl_client *client)
+{
+	struct wrl_client *previous = NULL;
+	struct wrl_interface *other;
+	uint8_t *mac = client->address;
+
+	/* Stations roam between the BSSs of an SSID */
+	if (!interface->ssid_valid)
+		return;
+
+	list_for_each_entry(other, &wrl->interfaces, head) {
+		if (other == interface || !other->ssid_valid || strcmp(other->ssid, interface->ssid))
+			continue;
+
+		/* Entries left by earlier roams hold no filters of the station */
+		previous = wrl_client_get(&other->clients, mac, NULL);
+		if (previous && (previous->connected || previous->installed) && !previous->roamed && !previous->lent)
+			break;
+		previous = NULL;
+	}
+
+	if (!previous)
+		return;
+
+	MSG(INFO, "Client %02x:%02x:%02x:%02x:%02x:%02x roamed from %s to %s\n",
+	    mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], other->name, interface->name);
+	wrl_stats.counters.roams++;
+
+	/* Same station, rebalancing continues from its usage */
+	client->usage = previous->usage;
+
+	if (wrl_roam_migratable(interface, other, client, previous)) {
+		client->from.slot = other->kernel_group.slot;
+		client->from.id = previous->id;
+		client->home = previous->home.slot ? previous->home : client->from;
+
+		if (client->home.slot == interface->kernel_group.slot && client->home.id == client->id)
+			memset(&client->home, 0, sizeof(client->home));
+
+		previous->roamed = 1;
+	}
+
+	/* Gone from the previous interface, whether hostapd reported it yet or not */
+	if (previous->connected)
+		wrl_client_departed(wrl, other, previous);
+}
+
+static int
+wrl_roam_client_sync(struct wrl_data *wrl, struct wrl_interface *interface, struct wrl_client *client)
+{
+	const char *group = interface->kernel_group.name;
+	struct wrl_client *other;
+
+	/* Entry to migrate from vanished, the client starts over with a class of its own */
+	if (client->from.slot) {
+		other = wrl_roam_client_get(wrl, group, &client->from, client->address, NULL);
+		if (!other || !other->roamed || !other->installed) {
+			memset(&client->from, 0, sizeof(client->from));
+			memset(&client->home, 0, sizeof(client->home));
+			wrl_client_rate_applied(client, 0);
+			return 1;
+		}
+	}
+
+	/* Class went with the trees of the member it was created on */
+	if (client->home.slot) {
+		other = wrl_roam_client_get(wrl, group, &client->home, client->address, NULL);
+		if (!other || !other->installed || (!other->roamed && !other->lent)) {
+			memset(&client->from, 0, sizeof(client->from));
+			memset(&client->home, 0, sizeof(client->home));
+
+			/* Departed clients still remove their filters */
+			if (client->connected) {
+				client->installed = 0;
+				wrl_client_rate_applied(client, 0);
+			}
+			return 1;
+		}
+	}
+
+	/* Nothing relies on the entry anymore, it is shaped like any other */
+	if ((client->roamed || client->lent) && !wrl_roam_client_used(wrl, interface, client)) {
+		/* Filters were moved away, the class is recreated along with them */
+		if (client->lent && client->connected)
+			client->installed = 0;
+
+		client->roamed = 0;
+		client->lent = 0;
+		wrl_client_rate_applied(client, 0);
+		return 1;
+	}
+
+	return 0;
+}
+
+void
+wrl_roam_sync(struct wrl_data *wrl)
+{
+	struct wrl_interface *interface;
+	struct wrl_client *client;
+	int changed;
+
+	/* Dropping a reference can leave the entry it pointed to unused in turn */
+	do {
+		changed = 0;
+		list_for_each_entry(interface, &wrl->interfaces, head) {
+			/* Clients outside of groups are reset along with their trees */
+			if (!interface->kernel_group.slot)
+				continue;
+
+			wrl_client_for_each(client, &interface->clients) {
+				if (client->from.slot || client->home.slot || client->roamed || client->lent)
+					changed |= wrl_roam_client_sync(wrl, interface, client);
+			}
+		}
+	} while (changed);
+}
+
+void
+wrl_roam_moved(struct wrl_data *wrl, struct wrl_op *op, struct wrl_client *client)
+{
+	struct wrl_interface *interface;
+	struct wrl_client *previous;
+
+	wrl_stats.counters.migrations++;
+
+	memset(&client->from, 0, sizeof(client->from));
+	client->lent = 0;
+
+	previous = wrl_roam_client_get(wrl, op->group.name, &op->from, op->address, &interface);
+	if (!previous)
+		return;
+
+	previous->roamed = 0;
+
+	/* Creator of the class keeps it while in use */
+	if (wrl_client_ref_equal(&op->home, &op->from)) {
+		previous->lent = 1;
+		return;
+	}
+
+	/* Filters went with the station, the class stays with its creator */
+	previous->installed = 0;
+	memset(&previous->home, 0, sizeof(previous->home));
+	if (!previous->connected && !previous->pending)
+		wrl_client_free(&interface->clients, previous);
+}
+
+void
+wrl_roam_released(struct wrl_data *wrl, struct wrl_op *op)
+{
+	struct wrl_interface *interface;
+	struct wrl_client *owner;
+
+	owner = wrl_roam_client_get(wrl, op->group.name, &op->home, op->address, &interface);
+	if (!owner)
+		return;
+
+	/* Class was removed together with the last filters pointing at it */
+	owner->lent = 0;
+	owner->installed = 0;
+	if (!owner->connected && !owner->pending)
+		wrl_client_free(&interface->clients, owner);
+	else
+		wrl_client_rate_applied(owner, 0);
+}
+
+void
+wrl_roam_usage(struct wrl_data *wrl)
+{
+	struct wrl_interface *interface;
+	struct wrl_client *client, *owner;
+
+	list_for_each_entry(interface, &wrl->interfaces, head) {
+		if (!interface->kernel_group.slot)
+			continue;
+
+		wrl_client_for_each(client, &interface->clients) {
+			if (!client->home.slot || !client->installed)
+				continue;
+
+			owner = wrl_roam_client_get(wrl, interface->kernel_group.name, &client->home, client->address, NULL);
+			if (owner)
+				client->usage = owner->usage;
+		}
+	}
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "backend.h"
+#include "client.h"
+#include "interface.h"
+
+struct wrl_data;
+
+/* Station associated, takes over the shaping of its entry on another interface */
+void wrl_roam_connected(struct wrl_data *wrl, struct wrl_interface *interface, struct wrl_client *client);
+
+/* Drop references to entries gone or changed since the last apply */
+void wrl_roam_sync(struct wrl_data *wrl);
+
+/* Results of migrations and of releasing classes of roamed clients */
+void wrl_roam_moved(struct wrl_data *wrl, struct wrl_op *op, struct wrl_client *client);
+void wrl_roam_released(struct wrl_data *wrl, struct wrl_op *op);
+
+/* Counters of a class in use by a roamed client are read with its creator */
+void wrl_roam_usage(struct wrl_data *wrl);
@@ -0,0 +1,425 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libubox/uloop.h>
+
+#include "backend.h"
+#include "client.h"
+#include "interface.h"
+#include "log.h"
+#include "snapshot.h"
+#include "wrl.h"
+
+#define WRL_SNAPSHOT_MAGIC	0x534c5257	/* "WRLS" */
+#define WRL_SNAPSHOT_VERSION	1
+
+#define WRL_SNAPSHOT_CLIENT_GUARANTEE	(1 << 0)
+
+struct wrl_snapshot_header {
+	uint32_t magic;
+	uint16_t version;
+
+	/* Set in place while a transaction is in flight */
+	uint8_t dirty;
+	uint8_t reserved;
+
+	uint32_t size;
+
+	/* FNV-1a of everything following the header */
+	uint32_t checksum;
+
+	char backend[16];
+	uint32_t num_interfaces;
+};
+
+/* Installed interface, followed by its installed clients */
+struct wrl_snapshot_interface {
+	char name[32];
+
+	/* Recreated devices lost their shaping */
+	uint32_t ifindex;
+	uint32_t ifb_ifindex;
+
+	uint32_t rate_down;
+	uint32_t rate_up;
+	uint32_t num_clients;
+};
+
+struct wrl_snapshot_client {
+	uint8_t address[6];
+	uint16_t airtime_weight;
+	uint32_t id;
+	uint32_t rate_down;
+	uint32_t rate_up;
+	uint32_t guarantee_down;
+	uint32_t guarantee_up;
+	uint8_t flags;
+	uint8_t reserved[3];
+};
+
+static struct {
+	/* Mapping of the current snapshot file, NULL if there is none */
+	struct wrl_snapshot_header *header;
+	size_t size;
+
+	char path[128];
+	uint8_t enabled;
+} wrl_snapshot_state;
+
+static uint32_t
+wrl_snapshot_checksum(const void *data, size_t len)
+{
+	const uint8_t *pos = data;
+	uint32_t hash = 0x811c9dc5;
+
+	while (len--) {
+		hash ^= *pos++;
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+/* Interface record at offset, advanced past its clients. NULL at the end or if truncated */
+static struct wrl_snapshot_interface *
+wrl_snapshot_interface_next(size_t *offset)
+{
+	struct wrl_snapshot_interface *record;
+	size_t size = wrl_snapshot_state.size;
+
+	if (*offset + sizeof(*record) > size)
+		return NULL;
+
+	record = (void *)((uint8_t *)wrl_snapshot_state.header + *offset);
+	if (record->num_clients > (size - *offset - sizeof(*record)) / sizeof(struct wrl_snapshot_client))
+		return NULL;
+
+	*offset += sizeof(*record) + record->num_clients * sizeof(struct wrl_snapshot_client);
+
+	return record;
+}
+
+static int
+wrl_snapshot_validate(const char *backend)
+{
+	struct wrl_snapshot_header *header = wrl_snapshot_state.header;
+	size_t offset = sizeof(*header);
+	uint32_t i;
+
+	if (header->magic != WRL_SNAPSHOT_MAGIC || header->version != WRL_SNAPSHOT_VERSION ||
+	    header->size != wrl_snapshot_state.size)
+		return -EINVAL;
+
+	/* Written by an instance killed in the middle of a transaction */
+	if (header->dirty)
+		return -ESTALE;
+
+	if (strncmp(header->backend, backend, sizeof(header->backend)))
+		return -EINVAL;
+
+	if (header->checksum != wrl_snapshot_checksum(header + 1, header->size - sizeof(*header)))
+		return -EBADMSG;
+
+	for (i = 0; i < header->num_interfaces; i++) {
+		if (!wrl_snapshot_interface_next(&offset))
+			return -EINVAL;
+	}
+
+	return offset == header->size ? 0 : -EINVAL;
+}
+
+static uint32_t
+wrl_snapshot_ifb_ifindex(const char *interface)
+{
+	char ifb_name[IFNAMSIZ];
+
+	if (snprintf(ifb_name, sizeof(ifb_name), "%s" WRL_BACKEND_IFB_SUFFIX, interface) >= IFNAMSIZ)
+		return 0;
+
+	return if_nametoindex(ifb_name);
+}
+
+static void
+wrl_snapshot_unmap(void)
+{
+	if (!wrl_snapshot_state.header)
+		return;
+
+	munmap(wrl_snapshot_state.header, wrl_snapshot_state.size);
+	wrl_snapshot_state.header = NULL;
+	wrl_snapshot_state.size = 0;
+}
+
+static void
+wrl_snapshot_timeout(struct uloop_timeout *timeout)
+{
+	struct wrl_data *wrl = container_of(timeout, struct wrl_data, snapshot);
+
+	/* Retried once the transaction in flight completed */
+	wrl_snapshot_save(wrl);
+}
+
+int
+wrl_snapshot_open(struct wrl_data *wrl, const char *path)
+{
+	struct wrl_snapshot_header *header;
+	struct stat st;
+	int fd, ret;
+
+	snprintf(wrl_snapshot_state.path, sizeof(wrl_snapshot_state.path), "%s", path);
+	wrl_snapshot_state.enabled = 1;
+	wrl->snapshot.cb = wrl_snapshot_timeout;
+
+	fd = open(path, O_RDWR);
+	if (fd < 0)
+		return errno == ENOENT ? 0 : -errno;
+
+	if (fstat(fd, &st) || st.st_size < sizeof(*header)) {
+		close(fd);
+		ret = -EINVAL;
+		goto discard;
+	}
+
+	header = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED) {
+		ret = -errno;
+		goto discard;
+	}
+
+	wrl_snapshot_state.header = header;
+	wrl_snapshot_state.size = st.st_size;
+
+	ret = wrl_snapshot_validate(wrl->backend->name);
+	if (ret)
+		goto discard;
+
+	MSG(INFO, "Loaded snapshot with %u interfaces\n", header->num_interfaces);
+
+	return 0;
+
+discard:
+	MSG(INFO, "Discarding snapshot %s (%d)\n", path, ret);
+	wrl_snapshot_unmap();
+	unlink(path);
+
+	return ret;
+}
+
+void
+wrl_snapshot_close(void)
+{
+	wrl_snapshot_unmap();
+	wrl_snapshot_state.enabled = 0;
+}
+
+int
+wrl_snapshot_restore(const char *interface, struct wrl_rate *rate, wrl_backend_adopt_cb cb, void *priv)
+{
+	struct wrl_backend_client_state state;
+	struct wrl_snapshot_interface *record;
+	struct wrl_snapshot_client *client;
+	size_t offset = sizeof(struct wrl_snapshot_header);
+	uint32_t i;
+	int ret;
+
+	if (!wrl_snapshot_state.header)
+		return -ENOENT;
+
+	/* Own transactions might have touched the interface since */
+	if (wrl_snapshot_state.header->dirty)
+		return -ESTALE;
+
+	while ((record = wrl_snapshot_interface_next(&offset))) {
+		if (!strncmp(record->name, interface, sizeof(record->name)))
+			break;
+	}
+
+	if (!record)
+		return -ENOENT;
+
+	if (if_nametoindex(interface) != record->ifindex ||
+	    wrl_snapshot_ifb_ifindex(interface) != record->ifb_ifindex)
+		return -ESTALE;
+
+	rate->down = record->rate_down;
+	rate->up = record->rate_up;
+
+	client = (struct wrl_snapshot_client *)(record + 1);
+	for (i = 0; i < record->num_clients; i++, client++) {
+		memset(&state, 0, sizeof(state));
+		state.client_id = client->id;
+		memcpy(state.address, client->address, sizeof(state.address));
+		state.rate.down = client->rate_down;
+		state.rate.up = client->rate_up;
+		state.guarantee.down = client->guarantee_down;
+		state.guarantee.up = client->guarantee_up;
+		state.guarantee.applied = !!(client->flags & WRL_SNAPSHOT_CLIENT_GUARANTEE);
+		state.airtime_weight = client->airtime_weight;
+
+		ret = cb(priv, &state);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+void
+wrl_snapshot_dirty(void)
+{
+	if (wrl_snapshot_state.header)
+		wrl_snapshot_state.header->dirty = 1;
+}
+
+void
+wrl_snapshot_schedule(struct wrl_data *wrl)
+{
+	if (!wrl_snapshot_state.enabled || wrl->snapshot.pending)
+		return;
+
+	uloop_timeout_set(&wrl->snapshot, WRL_SNAPSHOT_DELAY);
+}
+
+static void
+wrl_snapshot_fill(struct wrl_data *wrl, struct wrl_snapshot_header *header)
+{
+	struct wrl_snapshot_client *record_client;
+	struct wrl_snapshot_interface *record;
+	struct wrl_interface *interface;
+	struct wrl_client *client;
+	uint8_t *pos;
+
+	header->magic = WRL_SNAPSHOT_MAGIC;
+	header->version = WRL_SNAPSHOT_VERSION;
+	strncpy(header->backend, wrl->backend->name, sizeof(header->backend) - 1);
+
+	pos = (uint8_t *)(header + 1);
+	list_for_each_entry(interface, &wrl->interfaces, head) {
+		/* Group trees are always rebuilt, their members are not adopted */
+		if (!interface->installed || interface->kernel_group.slot)
+			continue;
+
+		record = (struct wrl_snapshot_interface *)pos;
+		pos += sizeof(*record);
+
+		strncpy(record->name, interface->name, sizeof(record->name) - 1);
+		record->ifindex = if_nametoindex(interface->name);
+		record->ifb_ifindex = wrl_snapshot_ifb_ifindex(interface->name);
+		record->rate_down = interface->kernel_rate.down;
+		record->rate_up = interface->kernel_rate.up;
+
+		wrl_client_for_each(client, &interface->clients) {
+			if (!client->installed)
+				continue;
+
+			record_client = (struct wrl_snapshot_client *)pos;
+			pos += sizeof(*record_client);
+
+			memcpy(record_client->address, client->address, sizeof(record_client->address));
+			record_client->id = client->id;
+			record_client->rate_down = client->kernel_rate.down;
+			record_client->rate_up = client->kernel_rate.up;
+			record_client->guarantee_down = client->guarantee.down;
+			record_client->guarantee_up = client->guarantee.up;
+			if (client->guarantee.applied)
+				record_client->flags |= WRL_SNAPSHOT_CLIENT_GUARANTEE;
+
+			/* Unknown weights are restored as default and set again */
+			if (client->airtime.applied)
+				record_client->airtime_weight = client->airtime.weight;
+
+			record->num_clients++;
+		}
+
+		header->num_interfaces++;
+	}
+
+	header->checksum = wrl_snapshot_checksum(header + 1, header->size - sizeof(*header));
+}
+
+int
+wrl_snapshot_save(struct wrl_data *wrl)
+{
+	char path[sizeof(wrl_snapshot_state.path) + 4];
+	struct wrl_snapshot_header *header;
+	struct wrl_interface *interface;
+	struct wrl_client *client;
+	size_t size = sizeof(*header);
+	int fd, ret;
+
+	if (!wrl_snapshot_state.enabled)
+		return 0;
+
+	/* Kernel state is unknown until the transaction completed */
+	if (wrl->transaction_pending)
+		return -EBUSY;
+
+	list_for_each_entry(interface, &wrl->interfaces, head) {
+		if (!interface->installed || interface->kernel_group.slot)
+			continue;
+
+		size += sizeof(struct wrl_snapshot_interface);
+		wrl_client_for_each(client, &interface->clients) {
+			if (client->installed)
+				size += sizeof(struct wrl_snapshot_client);
+		}
+	}
+
+	/* Written aside and renamed, a reader never sees a partial snapshot */
+	snprintf(path, sizeof(path), "%s.tmp", wrl_snapshot_state.path);
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		ret = -errno;
+		MSG(ERROR, "Failed to create snapshot %s: %s\n", path, strerror(errno));
+		return ret;
+	}
+
+	if (ftruncate(fd, size)) {
+		ret = -errno;
+		close(fd);
+		goto error;
+	}
+
+	header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED) {
+		ret = -errno;
+		goto error;
+	}
+
+	header->size = size;
+	wrl_snapshot_fill(wrl, header);
+
+	if (rename(path, wrl_snapshot_state.path)) {
+		ret = -errno;
+		munmap(header, size);
+		goto error;
+	}
+
+	/* Mapping is kept to mark the snapshot dirty in place */
+	wrl_snapshot_unmap();
+	wrl_snapshot_state.header = header;
+	wrl_snapshot_state.size = size;
+
+	MSG(DEBUG, "Saved snapshot of %u interfaces\n", header->num_interfaces);
+
+	return 0;
+
+error:
+	MSG(ERROR, "Failed to write snapshot %s (%d)\n", path, ret);
+	unlink(path);
+
+	return ret;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "backend.h"
+#include "rate.h"
+
+struct wrl_data;
+
+/* tmpfs, a snapshot never outlives the kernel state it describes */
+#define WRL_SNAPSHOT_PATH "/var/run/wireless-rate-limiter.snapshot"
+
+/* Changes are coalesced into a single write after this delay in ms */
+#define WRL_SNAPSHOT_DELAY 1000
+
+int wrl_snapshot_open(struct wrl_data *wrl, const char *path);
+void wrl_snapshot_close(void);
+
+/* Hand the clients of an interface in the snapshot to cb, -ENOENT if not covered */
+int wrl_snapshot_restore(const char *interface, struct wrl_rate *rate, wrl_backend_adopt_cb cb, void *priv);
+
+/* Kernel state is about to change, the snapshot is invalid until saved again */
+void wrl_snapshot_dirty(void);
+
+void wrl_snapshot_schedule(struct wrl_data *wrl);
+int wrl_snapshot_save(struct wrl_data *wrl);
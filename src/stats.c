@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+struct wrl_stats wrl_stats;
+
+static const char * const wrl_stats_stage_names[__WRL_STATS_STAGE_MAX] = {
+	[WRL_STATS_STAGE_TICK] = "tick",
+	[WRL_STATS_STAGE_LOOKUP] = "ubus_lookup",
+	[WRL_STATS_STAGE_GET_CLIENTS] = "get_clients",
+	[WRL_STATS_STAGE_RECONCILE] = "reconcile",
+	[WRL_STATS_STAGE_CONFIG] = "config",
+	[WRL_STATS_STAGE_APPLY] = "apply",
+};
+
+const char *
+wrl_stats_stage_name(enum wrl_stats_stage stage)
+{
+	return wrl_stats_stage_names[stage];
+}
+
+void
+wrl_stats_reset(void)
+{
+	memset(&wrl_stats, 0, sizeof(wrl_stats));
+}
+
+uint64_t
+wrl_stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void
+wrl_stats_histogram_add(struct wrl_stats_histogram *histogram, uint64_t usec)
+{
+	int bucket;
+
+	/* Number of significant bits, 0 usec end up in the first bucket */
+	bucket = usec ? 64 - __builtin_clzll(usec) : 0;
+	if (bucket >= WRL_STATS_HISTOGRAM_BUCKETS)
+		bucket = WRL_STATS_HISTOGRAM_BUCKETS - 1;
+
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	histogram->sum += usec;
+	if (usec > histogram->max)
+		histogram->max = usec > UINT32_MAX ? UINT32_MAX : usec;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * Bucket n counts durations of less than 2^n usec (and at least 2^(n-1)),
+ * the last bucket everything above.
+ */
+#define WRL_STATS_HISTOGRAM_BUCKETS 26
+
+struct wrl_stats_histogram {
+	uint32_t buckets[WRL_STATS_HISTOGRAM_BUCKETS];
+	uint32_t count;
+	uint32_t max;
+	uint64_t sum;
+};
+
+enum wrl_stats_stage {
+	/* Synchronous part of the recurring work */
+	WRL_STATS_STAGE_TICK,
+	/* Discovery of hostapd objects */
+	WRL_STATS_STAGE_LOOKUP,
+	/* get_clients round trip to a hostapd instance */
+	WRL_STATS_STAGE_GET_CLIENTS,
+	/* Reconciliation of a received client list */
+	WRL_STATS_STAGE_RECONCILE,
+	/* Policy resolution after configuration or SSID changes */
+	WRL_STATS_STAGE_CONFIG,
+	/* Shaping transaction, from planning until the backend completed it */
+	WRL_STATS_STAGE_APPLY,
+	__WRL_STATS_STAGE_MAX,
+};
+
+struct wrl_stats {
+	struct wrl_stats_histogram stages[__WRL_STATS_STAGE_MAX];
+
+	struct {
+		uint64_t ticks;
+		uint64_t requests;
+		uint64_t request_failures;
+		uint64_t request_timeouts;
+		uint64_t transactions;
+		uint64_t ops;
+		uint64_t op_failures;
+
+		/* Stations moving between interfaces, and classes kept doing so */
+		uint64_t roams;
+		uint64_t migrations;
+
+		/* Netlink messages or shell commands issued by the backend */
+		uint64_t backend_commands;
+		uint64_t backend_failures;
+	} counters;
+};
+
+extern struct wrl_stats wrl_stats;
+
+const char *wrl_stats_stage_name(enum wrl_stats_stage stage);
+void wrl_stats_reset(void);
+
+/* Monotonic time in usec */
+uint64_t wrl_stats_now(void);
+
+void wrl_stats_histogram_add(struct wrl_stats_histogram *histogram, uint64_t usec);
+
+static inline void
+wrl_stats_stage_done(enum wrl_stats_stage stage, uint64_t start)
+{
+	wrl_stats_histogram_add(&wrl_stats.stages[stage], wrl_stats_now() - start);
+}
@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Copyright (C) 2024 David Bauer <mail@david-bauer.net> */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "backend.h"
+#include "client.h"
+#include "interface.h"
+#include "log.h"
+#include "roam.h"
+#include "stats.h"
+#include "wrl.h"
+
+/* New rate samples are weighted 1/WRL_USAGE_EWMA_WEIGHT */
+#define WRL_USAGE_EWMA_WEIGHT 4
+
+struct wrl_usage_sample {
+	struct wrl_interface *interface;
+
+	/* Time since the previous sample in usec, 0 for the first one */
+	uint64_t elapsed;
+};
+
+static void
+wrl_usage_counters_update(struct wrl_counters *counters, const struct wrl_counters *sample, uint64_t elapsed)
+{
+	uint64_t rate;
+
+	/* Counters restart from zero when a class is recreated */
+	if (elapsed && (counters->bytes || counters->packets) && sample->bytes >= counters->bytes) {
+		/* kbit/s */
+		rate = (sample->bytes - counters->bytes) * 8 * 1000 / elapsed;
+		counters->rate = ((uint64_t)counters->rate * (WRL_USAGE_EWMA_WEIGHT - 1) + rate) / WRL_USAGE_EWMA_WEIGHT;
+	}
+
+	counters->bytes = sample->bytes;
+	counters->packets = sample->packets;
+	counters->drops = sample->drops;
+	counters->overlimits = sample->overlimits;
+	counters->backlog = sample->backlog;
+}
+
+static void
+wrl_usage_counters_cb(void *priv, enum wrl_direction direction, uint32_t client_id,
+		      const struct wrl_counters *counters)
+{
+	struct wrl_usage_sample *sample = priv;
+	struct wrl_client *client;
+	struct wrl_usage *usage;
+
+	if (client_id == WRL_BACKEND_COUNTERS_INTERFACE) {
+		usage = &sample->interface->usage;
+	} else {
+		client = wrl_client_get_by_id(&sample->interface->clients, client_id);
+		if (!client)
+			return;
+		usage = &client->usage;
+	}
+
+	wrl_usage_counters_update(direction == WRL_DIRECTION_DOWN ? &usage->down : &usage->up,
+				  counters, sample->elapsed);
+}
+
+void
+wrl_usage_update(struct wrl_data *wrl)
+{
+	struct wrl_usage_sample sample;
+	struct wrl_interface *interface;
+	uint64_t now;
+	int ret;
+
+	if (!wrl->backend->counters || wrl->full_purge != WRL_PURGE_NONE)
+		return;
+
+	list_for_each_entry(interface, &wrl->interfaces, head) {
+		/* No shaping tree to read from */
+		if (!interface->rate.applied)
+			continue;
+
+		now = wrl_stats_now();
+		sample.interface = interface;
+		sample.elapsed = interface->usage_updated ? now - interface->usage_updated : 0;
+
+		/* A single dump per device covers all clients */
+		ret = wrl->backend->counters(interface->name, &interface->kernel_group, wrl_usage_counters_cb, &sample);
+		if (ret) {
+			MSG(DEBUG, "Failed to read counters of interface %s (%d)\n", interface->name, ret);
+			continue;
+		}
+
+		interface->usage_updated = now;
+	}
+
+	wrl_roam_usage(wrl);
+}
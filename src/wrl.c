@@ -5,82 +5,54 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include <libubox/uloop.h>
 
+#include "airtime.h"
+#include "backend.h"
+#include "group.h"
 #include "interface.h"
 #include "log.h"
 #include "mac.h"
+#include "mac-table.h"
+#include "snapshot.h"
+#include "stats.h"
 #include "wrl.h"
 
-#define WRL_RECURRING_WORK_INTERVAL 1000
-#define WRL_UBUS_HOSTAPD_PATH "hostapd."
-
-static struct blob_buf b;
+/* Full get_clients resync, station changes are tracked by hostapd events */
+#define WRL_RESYNC_INTERVAL 15000
+/* Delay after configuration changes to coalesce subsequent calls */
+#define WRL_CONFIG_SETTLE_INTERVAL 1000
 
-struct wrl_request_clients_priv {
-	struct wrl_data *wrl;
-	struct wrl_interface *wrl_iface;
-};
+/* Class counters are sampled at this interval */
+#define WRL_USAGE_INTERVAL 5000
 
+#define WRL_INTERFACE_MISSING_MAX 3
+#define WRL_UBUS_HOSTAPD_PATH "hostapd."
+/* Time a single hostapd instance has to answer a request */
+#define WRL_UBUS_REQUEST_TIMEOUT 1000
 
-static int
-wrl_execute_command(const char *command)
-{
-	MSG(DEBUG, "Executing command: %s\n", command);
-	return system(command);
-}
+static struct blob_buf b;
 
-static struct wrl_client *
-wrl_client_get(struct wrl_interface *wrl_iface, uint8_t *mac, uint8_t *allocate)
+static void
+wrl_schedule_resync(struct wrl_data *wrl, int timeout)
 {
-	struct wrl_client *client, *free_client = NULL;
-
-	for (int i = 0; i < WRL_INTERFACE_NUM_CLIENTS; i++) {
-		client = &wrl_iface->clients[i];
-
-		if (memcmp(client->address, mac, 6) == 0) {
-			return client;
-		}
-
-		if (wrl_mac_is_zero(client->address) && allocate && !free_client) {
-			free_client = client;
-			free_client->id = i;
-		}
-	}
-
-	if (!allocate) {
-		MSG(ERROR, "Client not found\n");
-		return NULL;
-	}
-
-	if (!free_client) {
-		MSG(ERROR, "No free client found\n");
-		if (allocate)
-			*allocate = 0;
-		return NULL;
-	}
-
-	MSG(DEBUG, "Allocating new client\n");
-	*allocate = 1;
-	memcpy(free_client->address, mac, 6);
-	return free_client;
+	uloop_timeout_set(&wrl->recurring, timeout);
 }
 
 static void
 wrl_ubus_get_clients_cb(struct ubus_request *req, int type, struct blob_attr *msg)
 {
-	struct wrl_request_clients_priv *priv = req->priv;
-	struct wrl_interface *wrl_iface;
-	struct wrl_data *wrl;
-	struct wrl_client *client;
+	struct wrl_data *wrl = container_of(req->ctx, struct wrl_data, ubus.ctx);
+	struct wrl_interface *wrl_iface = req->priv;
 	const char *mac_string;
+	uint64_t start;
 	uint8_t mac[6];
-	uint8_t allocate = 0;
 
 	struct blob_attr *cur;
 	int remaining;
-	int i;
 
 	enum {
 		MSG_CLIENTS,
@@ -91,11 +63,12 @@ wrl_ubus_get_clients_cb(struct ubus_request *req, int type, struct blob_attr *ms
 	};
 	struct blob_attr *tb[__MSG_MAX];
 
-	wrl = priv->wrl;
-	wrl_iface = priv->wrl_iface;
-
 	MSG(DEBUG, "Received list of clients for Interface %s\n", wrl_iface->name);
 
+	/* Reply arrived, the remainder is processing */
+	wrl_stats_stage_done(WRL_STATS_STAGE_GET_CLIENTS, wrl_iface->ubus.req_start);
+	start = wrl_stats_now();
+
 	blobmsg_parse(policy, __MSG_MAX, tb, blob_data(msg), blob_len(msg));
 
 	if (!tb[MSG_CLIENTS]) {
@@ -103,11 +76,6 @@ wrl_ubus_get_clients_cb(struct ubus_request *req, int type, struct blob_attr *ms
 		return;
 	}
 
-	/* Mark all clients as gone */
-	for (i = 0; i < WRL_INTERFACE_NUM_CLIENTS; i++) {
-		wrl_iface->clients[i].connected = 0;
-	}
-
 	blobmsg_for_each_attr(cur, tb[MSG_CLIENTS], remaining) {
 		mac_string = blobmsg_name(cur);
 		MSG(DEBUG, "Client mac=%s interface=%s\n", mac_string, wrl_iface->name);
@@ -116,35 +84,107 @@ wrl_ubus_get_clients_cb(struct ubus_request *req, int type, struct blob_attr *ms
 			continue;
 		}
 
-		/* Get Client */
-		client = wrl_client_get(wrl_iface, mac, &allocate);
-		if (!client) {
-			MSG(ERROR, "Failed to get client\n");
-			continue;
-		}
+		wrl_client_connected(wrl, wrl_iface, mac);
+	}
 
-		/* Update policy */
-		if (wrl_config_client_update(&wrl->config, wrl_iface, client)) {
-			MSG(INFO, "Update rate-limits for client %02x:%02x:%02x:%02x:%02x:%02x rx=%d tx=%d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], client->rate.down, client->rate.up);
-		}
+	wrl_client_list_done(wrl, wrl_iface);
 
-		if (allocate) {
-			MSG(DEBUG, "New client, scheudling rate update\n");
-			client->rate.applied = 0;
-		}
+	wrl_stats_stage_done(WRL_STATS_STAGE_RECONCILE, start);
+}
 
-		MSG(DEBUG, "Client %02x:%02x:%02x:%02x:%02x:%02x\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-		client->connected = 1;
+enum {
+	WRL_UBUS_HOSTAPD_NOTIFY_ADDRESS,
+	__WRL_UBUS_HOSTAPD_NOTIFY_MAX,
+};
+
+static const struct blobmsg_policy wrl_ubus_hostapd_notify_policy[] = {
+	[WRL_UBUS_HOSTAPD_NOTIFY_ADDRESS] = { .name = "address", .type = BLOBMSG_TYPE_STRING },
+};
+
+static int
+wrl_ubus_hostapd_notify(struct ubus_context *ctx, struct ubus_object *obj,
+			struct ubus_request_data *req, const char *method,
+			struct blob_attr *msg)
+{
+	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
+	struct wrl_interface *wrl_iface = container_of(obj, struct wrl_interface, ubus.subscriber.obj);
+	struct blob_attr *tb[__WRL_UBUS_HOSTAPD_NOTIFY_MAX];
+	uint8_t mac[6];
+
+	blobmsg_parse(wrl_ubus_hostapd_notify_policy, __WRL_UBUS_HOSTAPD_NOTIFY_MAX, tb, blob_data(msg), blob_len(msg));
+
+	if (!tb[WRL_UBUS_HOSTAPD_NOTIFY_ADDRESS])
+		return UBUS_STATUS_OK;
+
+	if (wrl_mac_from_string(blobmsg_get_string(tb[WRL_UBUS_HOSTAPD_NOTIFY_ADDRESS]), mac) == NULL)
+		return UBUS_STATUS_OK;
+
+	MSG(DEBUG, "Event %s for client %s on interface %s\n", method, wrl_mac_to_string(mac, NULL), wrl_iface->name);
+
+	if (!strcmp(method, "assoc") || !strcmp(method, "sta-authorized")) {
+		/* Enforce limits right away instead of waiting for the next resync */
+		if (wrl_client_connected(wrl, wrl_iface, mac))
+			wrl_schedule_apply(wrl, 0);
+	} else if (!strcmp(method, "disassoc") || !strcmp(method, "deauth")) {
+		wrl_client_disconnected(wrl, wrl_iface, mac);
 	}
 
-	/* Zero all clients that are not connected */
-	for (i = 0; i < WRL_INTERFACE_NUM_CLIENTS; i++) {
-		client = &wrl_iface->clients[i];
-		if (client->connected)
-			continue;
-		client = &wrl_iface->clients[i];
-		memset(client, 0, sizeof(struct wrl_client));
+	/* Never deny association requests */
+	return UBUS_STATUS_OK;
+}
+
+static void
+wrl_ubus_hostapd_remove(struct ubus_context *ctx, struct ubus_subscriber *subscriber, uint32_t id)
+{
+	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
+	struct wrl_interface *interface = container_of(subscriber, struct wrl_interface, ubus.subscriber);
+
+	MSG(INFO, "Interface %s removed from ubus\n", interface->name);
+
+	/* Drop the interface on the next resync unless it reappears */
+	interface->missing = WRL_INTERFACE_MISSING_MAX - 1;
+	wrl_schedule_resync(wrl, 0);
+}
+
+static void
+wrl_ubus_request_done(struct wrl_data *wrl, struct wrl_interface *interface)
+{
+	uloop_timeout_cancel(&interface->ubus.timeout);
+	interface->ubus.req_pending = 0;
+
+	/* Apply the changes of all interfaces at once */
+	if (--wrl->ubus.requests_pending == 0)
+		wrl_schedule_apply(wrl, 0);
+}
+
+static void
+wrl_ubus_request_timeout(struct uloop_timeout *timeout)
+{
+	struct wrl_interface *interface = container_of(timeout, struct wrl_interface, ubus.timeout);
+	struct wrl_data *wrl = container_of(interface->ubus.req.ctx, struct wrl_data, ubus.ctx);
+
+	MSG(WARN, "Request to interface %s timed out\n", interface->name);
+	wrl_stats.counters.request_timeouts++;
+
+	ubus_abort_request(&wrl->ubus.ctx, &interface->ubus.req);
+	wrl_ubus_request_done(wrl, interface);
+}
+
+static void
+wrl_interface_free(struct wrl_data *wrl, struct wrl_interface *interface)
+{
+	if (interface->ubus.req_pending) {
+		ubus_abort_request(&wrl->ubus.ctx, &interface->ubus.req);
+		wrl_ubus_request_done(wrl, interface);
 	}
+
+	ubus_unregister_subscriber(&wrl->ubus.ctx, &interface->ubus.subscriber);
+	wrl_client_table_free(&interface->clients);
+
+	/* Releases of its clients can't be reported anymore */
+	wrl->report.reset = 1;
+	list_del(&interface->head);
+	free(interface);
 }
 
 static void
@@ -165,58 +205,164 @@ wrl_ubus_interfaces_update_cb(struct ubus_context *ctx, struct ubus_object_data
 	list_for_each_entry(interface, &wrl->interfaces, head) {
 		if (strcmp(interface->name, path + strlen(WRL_UBUS_HOSTAPD_PATH)) == 0) {
 			if (interface->ubus.id != id) {
-				/* Delete interface */
+				/* hostapd restarted, rediscover clients and shaping */
 				MSG(INFO, "Interface %s changed ID from %d to %d\n", interface->name, interface->ubus.id, id);
-				memset(interface, 0, sizeof(struct wrl_interface));
+				wrl_client_table_flush(&interface->clients);
+				interface->rate.applied = 0;
+				interface->installed = 0;
+				interface->ssid_valid = 0;
+				found = 1;
 				break;
 			}
-			found = 1;
-			break;
+			interface->missing = 0;
+			return;
 		}
 	}
 
 	if (!found) {
 		MSG(INFO, "New interface %s found\n", path + strlen(WRL_UBUS_HOSTAPD_PATH));
-		interface = calloc(1, sizeof(struct wrl_interface));
+		interface = wrl_interface_alloc(path + strlen(WRL_UBUS_HOSTAPD_PATH));
 		if (!interface) {
 			MSG(ERROR, "Failed to allocate memory for new interface\n");
 			return;
 		}
 
-		INIT_LIST_HEAD(&interface->head);
+		interface->ubus.timeout.cb = wrl_ubus_request_timeout;
 
-		/* Update metdata from ubus */
-		strncpy(interface->name, path + strlen(WRL_UBUS_HOSTAPD_PATH), sizeof(interface->name));
+		interface->ubus.subscriber.cb = wrl_ubus_hostapd_notify;
+		interface->ubus.subscriber.remove_cb = wrl_ubus_hostapd_remove;
+		if (ubus_register_subscriber(ctx, &interface->ubus.subscriber)) {
+			MSG(ERROR, "Failed to register subscriber for interface %s\n", interface->name);
+			free(interface);
+			return;
+		}
 
 		list_add_tail(&interface->head, &wrl->interfaces);
+
+		/* Keep shaping left by an earlier instance */
+		wrl_interface_adopt(wrl, interface);
 	}
 
 	interface->ubus.id = id;
 	interface->missing = 0;
+
+	/* Subscribe to station events */
+	if (ubus_subscribe(ctx, &interface->ubus.subscriber, id))
+		MSG(ERROR, "Failed to subscribe to interface %s\n", interface->name);
+}
+
+static void
+wrl_ubus_get_status_cb(struct ubus_request *req, int type, struct blob_attr *msg)
+{
+	struct wrl_interface *wrl_iface = req->priv;
+
+	enum {
+		MSG_SSID,
+		__MSG_MAX,
+	};
+	static struct blobmsg_policy policy[__MSG_MAX] = {
+		[MSG_SSID] = { "ssid", BLOBMSG_TYPE_STRING },
+	};
+	struct blob_attr *tb[__MSG_MAX];
+
+	blobmsg_parse(policy, __MSG_MAX, tb, blob_data(msg), blob_len(msg));
+
+	if (!tb[MSG_SSID]) {
+		MSG(ERROR, "No SSID found for interface %s\n", wrl_iface->name);
+		return;
+	}
+
+	strncpy(wrl_iface->ssid, blobmsg_get_string(tb[MSG_SSID]), sizeof(wrl_iface->ssid) - 1);
+	wrl_iface->ssid_valid = 1;
+
+	/* SSID selectors have to be matched again */
+	wrl_iface->config.generation = 0;
+
+	MSG(DEBUG, "Interface %s has SSID %s\n", wrl_iface->name, wrl_iface->ssid);
+}
+
+static void wrl_ubus_request_complete(struct ubus_request *req, int ret);
+
+static int
+wrl_ubus_request(struct wrl_data *wrl, struct wrl_interface *interface,
+		 const char *method, ubus_data_handler_t data_cb)
+{
+	int ret;
+
+	blob_buf_init(&b, 0);
+
+	ret = ubus_invoke_async(&wrl->ubus.ctx, interface->ubus.id, method, b.head, &interface->ubus.req);
+	if (ret) {
+		MSG(ERROR, "Failed to request %s from interface %s: %s\n", method, interface->name, ubus_strerror(ret));
+		return ret;
+	}
+
+	interface->ubus.req.data_cb = data_cb;
+	interface->ubus.req.complete_cb = wrl_ubus_request_complete;
+	interface->ubus.req.priv = interface;
+	interface->ubus.req_start = wrl_stats_now();
+	ubus_complete_request_async(&wrl->ubus.ctx, &interface->ubus.req);
+
+	wrl_stats.counters.requests++;
+
+	uloop_timeout_set(&interface->ubus.timeout, WRL_UBUS_REQUEST_TIMEOUT);
+
+	return 0;
+}
+
+static int
+wrl_ubus_request_clients(struct wrl_data *wrl, struct wrl_interface *interface)
+{
+	MSG(DEBUG, "Requesting clients for interface %s\n", interface->name);
+
+	wrl_client_list_start(interface);
+
+	return wrl_ubus_request(wrl, interface, "get_clients", wrl_ubus_get_clients_cb);
 }
 
+static void
+wrl_ubus_request_complete(struct ubus_request *req, int ret)
+{
+	struct wrl_data *wrl = container_of(req->ctx, struct wrl_data, ubus.ctx);
+	struct wrl_interface *interface = req->priv;
+	int status = req->data_cb == wrl_ubus_get_status_cb;
+
+	uloop_timeout_cancel(&interface->ubus.timeout);
+
+	if (ret) {
+		MSG(ERROR, "Request to interface %s failed: %s\n", interface->name, ubus_strerror(ret));
+		wrl_stats.counters.request_failures++;
+	}
+
+	/* Status is only the first step, clients are requested with the SSID known */
+	if (status) {
+		wrl_config_interface_update(&wrl->config, interface);
+		if (!wrl_ubus_request_clients(wrl, interface))
+			return;
+	}
+
+	wrl_ubus_request_done(wrl, interface);
+}
 
 static void
 wrl_ubus_interfaces_update(struct wrl_data *wrl)
 {
 	struct wrl_interface *interface, *tmp;
-	struct wrl_request_clients_priv priv = {
-		.wrl = wrl,
-	};
+	uint64_t start;
+	int ret;
 
 	list_for_each_entry_safe(interface, tmp, &wrl->interfaces, head) {
 		interface->missing++;
 
-		if (interface->missing >= 3) {
+		if (interface->missing >= WRL_INTERFACE_MISSING_MAX) {
 			MSG(WARN, "Interface %s missing, removing\n", interface->name);
-			list_del_init(&interface->head);
-			free(interface);
+			wrl_interface_free(wrl, interface);
 		}
 	}
 
+	start = wrl_stats_now();
 	ubus_lookup(&wrl->ubus.ctx, "hostapd.*", wrl_ubus_interfaces_update_cb, wrl);
-
-	blob_buf_init(&b, 0);
+	wrl_stats_stage_done(WRL_STATS_STAGE_LOOKUP, start);
 
 	/* Update interface */
 	list_for_each_entry(interface, &wrl->interfaces, head) {
@@ -226,16 +372,24 @@ wrl_ubus_interfaces_update(struct wrl_data *wrl)
 			interface->rate.applied = 0;
 		}
 
-		/* Request Clients */
-		MSG(DEBUG, "Requesting clients for interface %s\n", interface->name);
 		if (interface->ubus.req_pending) {
 			MSG(DEBUG, "Request already pending for interface %s\n", interface->name);
 			continue;
 		}
 
-		priv.wrl_iface = interface;
-		ubus_invoke(&wrl->ubus.ctx, interface->ubus.id, "get_clients", b.head, wrl_ubus_get_clients_cb, &priv, 1000);
-		interface->ubus.req_pending = 0;
+		/* All interfaces are queried in parallel, SSID only once per hostapd instance */
+		if (!interface->ssid_valid) {
+			memset(interface->ssid, 0, sizeof(interface->ssid));
+			ret = wrl_ubus_request(wrl, interface, "get_status", wrl_ubus_get_status_cb);
+		} else {
+			ret = wrl_ubus_request_clients(wrl, interface);
+		}
+
+		if (ret)
+			continue;
+
+		interface->ubus.req_pending = 1;
+		wrl->ubus.requests_pending++;
 	}
 }
 
@@ -257,50 +411,65 @@ wrl_ubus_clear_config(struct ubus_context *ctx, struct ubus_object *obj,
 	wrl_config_interface_purge(&wrl->config);
 	MSG(INFO, "Clearing Client configuration\n");
 	wrl_config_client_purge(&wrl->config);
+	MSG(INFO, "Clearing MAC configuration\n");
+	wrl_config_mac_purge(&wrl->config);
+	MSG(INFO, "Clearing Group configuration\n");
+	wrl_config_group_purge(&wrl->config);
+
+	wrl_schedule_resync(wrl, WRL_CONFIG_SETTLE_INTERVAL);
 
 	return UBUS_STATUS_OK;
 }
 
 enum {
 	WRL_UBUS_SET_CLIENT_INTERFACE,
+	WRL_UBUS_SET_CLIENT_SSID,
 	WRL_UBUS_SET_CLIENT_DOWN,
 	WRL_UBUS_SET_CLIENT_UP,
+	WRL_UBUS_SET_CLIENT_AIRTIME,
 	__WRL_UBUS_SET_CLIENT_MAX,
 };
 
 static const struct blobmsg_policy wrl_ubus_set_client_policy[] = {
 	[WRL_UBUS_SET_CLIENT_INTERFACE] = { .name = "interface", .type = BLOBMSG_TYPE_STRING },
+	[WRL_UBUS_SET_CLIENT_SSID] = { .name = "ssid", .type = BLOBMSG_TYPE_STRING },
 	[WRL_UBUS_SET_CLIENT_DOWN] = { .name = "down", .type = BLOBMSG_TYPE_INT32 },
 	[WRL_UBUS_SET_CLIENT_UP] = { .name = "up", .type = BLOBMSG_TYPE_INT32 },
+	[WRL_UBUS_SET_CLIENT_AIRTIME] = { .name = "airtime", .type = BLOBMSG_TYPE_INT32 },
 };
 
+/* Policy changes go to the staged config between begin_config and commit_config */
+static struct wrl_config *
+wrl_ubus_config(struct wrl_data *wrl)
+{
+	return wrl->staging_active ? &wrl->staging : &wrl->config;
+}
+
+/* Shared by set_client_config and the client policies of set_config */
 static int
-wrl_ubus_set_client_config(struct ubus_context *ctx, struct ubus_object *obj,
-			   struct ubus_request_data *req, const char *method,
-			   struct blob_attr *msg)
+wrl_ubus_client_policy_set(struct wrl_config *config, struct blob_attr **tb)
 {
-	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
 	struct wrl_config_client_selectors client_selectors = {};
-	struct blob_attr *tb[__WRL_UBUS_SET_CLIENT_MAX];
 	struct wrl_config_client *client;
 	int create;
-	int ret;
 
-	ret = blobmsg_parse(wrl_ubus_set_client_policy, __WRL_UBUS_SET_CLIENT_MAX, tb, blob_data(msg), blob_len(msg));
-	if (ret) {
-		MSG(ERROR, "Failed to parse message\n");
+	if (!tb[WRL_UBUS_SET_CLIENT_DOWN] || !tb[WRL_UBUS_SET_CLIENT_UP]) {
+		MSG(ERROR, "Missing arguments\n");
 		return UBUS_STATUS_INVALID_ARGUMENT;
 	}
 
-	if (!tb[WRL_UBUS_SET_CLIENT_DOWN] || !tb[WRL_UBUS_SET_CLIENT_UP]) {
-		MSG(ERROR, "Missing arguments\n");
+	if (tb[WRL_UBUS_SET_CLIENT_AIRTIME] && blobmsg_get_u32(tb[WRL_UBUS_SET_CLIENT_AIRTIME]) > UINT16_MAX) {
+		MSG(ERROR, "Airtime weight out of range\n");
 		return UBUS_STATUS_INVALID_ARGUMENT;
 	}
 
 	if (tb[WRL_UBUS_SET_CLIENT_INTERFACE])
 		strncpy(client_selectors.interface, blobmsg_data(tb[WRL_UBUS_SET_CLIENT_INTERFACE]), sizeof(client_selectors.interface));
 
-	client = wrl_config_client_get(&wrl->config, &client_selectors, &create);
+	if (tb[WRL_UBUS_SET_CLIENT_SSID])
+		strncpy(client_selectors.ssid, blobmsg_data(tb[WRL_UBUS_SET_CLIENT_SSID]), sizeof(client_selectors.ssid) - 1);
+
+	client = wrl_config_client_get(config, &client_selectors, &create);
 	if (!client) {
 		MSG(ERROR, "Failed to get client\n");
 		return UBUS_STATUS_UNKNOWN_ERROR;
@@ -309,8 +478,35 @@ wrl_ubus_set_client_config(struct ubus_context *ctx, struct ubus_object *obj,
 	client->rate.down = blobmsg_get_u32(tb[WRL_UBUS_SET_CLIENT_DOWN]);
 	client->rate.up = blobmsg_get_u32(tb[WRL_UBUS_SET_CLIENT_UP]);
 
+	if (tb[WRL_UBUS_SET_CLIENT_AIRTIME])
+		client->airtime_weight = blobmsg_get_u32(tb[WRL_UBUS_SET_CLIENT_AIRTIME]);
+
+	return UBUS_STATUS_OK;
+}
+
+static int
+wrl_ubus_set_client_config(struct ubus_context *ctx, struct ubus_object *obj,
+			   struct ubus_request_data *req, const char *method,
+			   struct blob_attr *msg)
+{
+	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
+	struct blob_attr *tb[__WRL_UBUS_SET_CLIENT_MAX];
+	int ret;
+
+	ret = blobmsg_parse(wrl_ubus_set_client_policy, __WRL_UBUS_SET_CLIENT_MAX, tb, blob_data(msg), blob_len(msg));
+	if (ret) {
+		MSG(ERROR, "Failed to parse message\n");
+		return UBUS_STATUS_INVALID_ARGUMENT;
+	}
+
+	ret = wrl_ubus_client_policy_set(wrl_ubus_config(wrl), tb);
+	if (ret || wrl->staging_active)
+		return ret;
+
 	wrl->full_purge = WRL_PURGE_NONE;
 
+	wrl_schedule_resync(wrl, WRL_CONFIG_SETTLE_INTERVAL);
+
 	return UBUS_STATUS_OK;
 }
 
@@ -329,8 +525,10 @@ wrl_ubus_get_client_config(struct ubus_context *ctx, struct ubus_object *obj,
 	list_for_each_entry(client, &wrl->config.clients, head) {
 		t = blobmsg_open_table(&b, "client");
 		blobmsg_add_string(&b, "interface", client->selectors.interface);
+		blobmsg_add_string(&b, "ssid", client->selectors.ssid);
 		blobmsg_add_u32(&b, "down", client->rate.down);
 		blobmsg_add_u32(&b, "up", client->rate.up);
+		blobmsg_add_u32(&b, "airtime", client->airtime_weight);
 		blobmsg_close_table(&b, t);
 	}
 	blobmsg_close_array(&b, a);
@@ -342,44 +540,51 @@ wrl_ubus_get_client_config(struct ubus_context *ctx, struct ubus_object *obj,
 
 enum {
 	WRL_UBUS_SET_INTERFACE_INTERFACE,
+	WRL_UBUS_SET_INTERFACE_SSID,
 	WRL_UBUS_SET_INTERFACE_DOWN,
 	WRL_UBUS_SET_INTERFACE_UP,
+	WRL_UBUS_SET_INTERFACE_MAX_CLIENTS,
+	WRL_UBUS_SET_INTERFACE_REBALANCE,
+	WRL_UBUS_SET_INTERFACE_GROUP,
 	__WRL_UBUS_SET_INTERFACE_MAX,
 };
 
 static const struct blobmsg_policy wrl_ubus_set_interface_policy[] = {
 	[WRL_UBUS_SET_INTERFACE_INTERFACE] = { .name = "interface", .type = BLOBMSG_TYPE_STRING },
+	[WRL_UBUS_SET_INTERFACE_SSID] = { .name = "ssid", .type = BLOBMSG_TYPE_STRING },
 	[WRL_UBUS_SET_INTERFACE_DOWN] = { .name = "down", .type = BLOBMSG_TYPE_INT32 },
 	[WRL_UBUS_SET_INTERFACE_UP] = { .name = "up", .type = BLOBMSG_TYPE_INT32 },
+	[WRL_UBUS_SET_INTERFACE_MAX_CLIENTS] = { .name = "max_clients", .type = BLOBMSG_TYPE_INT32 },
+	[WRL_UBUS_SET_INTERFACE_REBALANCE] = { .name = "rebalance", .type = BLOBMSG_TYPE_BOOL },
+	[WRL_UBUS_SET_INTERFACE_GROUP] = { .name = "group", .type = BLOBMSG_TYPE_STRING },
 };
 
+/* Shared by set_interface_config and the interface policies of set_config */
 static int
-wrl_ubus_set_interface_config(struct ubus_context *ctx, struct ubus_object *obj,
-			      struct ubus_request_data *req, const char *method,
-			      struct blob_attr *msg)
+wrl_ubus_interface_policy_set(struct wrl_config *config, struct blob_attr **tb)
 {
-	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
 	struct wrl_config_interface_selectors interface_selectors = {};
-	struct blob_attr *tb[__WRL_UBUS_SET_CLIENT_MAX];
 	struct wrl_config_interface *interface;
 	int create;
-	int ret;
 
-	ret = blobmsg_parse(wrl_ubus_set_interface_policy, __WRL_UBUS_SET_INTERFACE_MAX, tb, blob_data(msg), blob_len(msg));
-	if (ret) {
-		MSG(ERROR, "Failed to parse message\n");
+	if (!tb[WRL_UBUS_SET_INTERFACE_DOWN] || !tb[WRL_UBUS_SET_INTERFACE_UP]) {
+		MSG(ERROR, "Missing arguments\n");
 		return UBUS_STATUS_INVALID_ARGUMENT;
 	}
 
-	if (!tb[WRL_UBUS_SET_INTERFACE_DOWN] || !tb[WRL_UBUS_SET_INTERFACE_UP]) {
-		MSG(ERROR, "Missing arguments\n");
+	if (tb[WRL_UBUS_SET_INTERFACE_GROUP] && blobmsg_get_string(tb[WRL_UBUS_SET_INTERFACE_GROUP])[0] &&
+	    !wrl_group_name_valid(blobmsg_get_string(tb[WRL_UBUS_SET_INTERFACE_GROUP]))) {
+		MSG(ERROR, "Invalid group name\n");
 		return UBUS_STATUS_INVALID_ARGUMENT;
 	}
 
 	if (tb[WRL_UBUS_SET_INTERFACE_INTERFACE])
 		strncpy(interface_selectors.interface, blobmsg_data(tb[WRL_UBUS_SET_INTERFACE_INTERFACE]), sizeof(interface_selectors.interface));
 
-	interface = wrl_config_interface_get(&wrl->config, &interface_selectors, &create);
+	if (tb[WRL_UBUS_SET_INTERFACE_SSID])
+		strncpy(interface_selectors.ssid, blobmsg_data(tb[WRL_UBUS_SET_INTERFACE_SSID]), sizeof(interface_selectors.ssid) - 1);
+
+	interface = wrl_config_interface_get(config, &interface_selectors, &create);
 	if (!interface) {
 		MSG(ERROR, "Failed to get interface\n");
 		return UBUS_STATUS_UNKNOWN_ERROR;
@@ -388,8 +593,41 @@ wrl_ubus_set_interface_config(struct ubus_context *ctx, struct ubus_object *obj,
 	interface->rate.down = blobmsg_get_u32(tb[WRL_UBUS_SET_INTERFACE_DOWN]);
 	interface->rate.up = blobmsg_get_u32(tb[WRL_UBUS_SET_INTERFACE_UP]);
 
+	if (tb[WRL_UBUS_SET_INTERFACE_MAX_CLIENTS])
+		interface->max_clients = blobmsg_get_u32(tb[WRL_UBUS_SET_INTERFACE_MAX_CLIENTS]);
+
+	if (tb[WRL_UBUS_SET_INTERFACE_REBALANCE])
+		interface->rebalance = blobmsg_get_bool(tb[WRL_UBUS_SET_INTERFACE_REBALANCE]);
+
+	if (tb[WRL_UBUS_SET_INTERFACE_GROUP])
+		strncpy(interface->group, blobmsg_get_string(tb[WRL_UBUS_SET_INTERFACE_GROUP]), sizeof(interface->group) - 1);
+
+	return UBUS_STATUS_OK;
+}
+
+static int
+wrl_ubus_set_interface_config(struct ubus_context *ctx, struct ubus_object *obj,
+			      struct ubus_request_data *req, const char *method,
+			      struct blob_attr *msg)
+{
+	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
+	struct blob_attr *tb[__WRL_UBUS_SET_INTERFACE_MAX];
+	int ret;
+
+	ret = blobmsg_parse(wrl_ubus_set_interface_policy, __WRL_UBUS_SET_INTERFACE_MAX, tb, blob_data(msg), blob_len(msg));
+	if (ret) {
+		MSG(ERROR, "Failed to parse message\n");
+		return UBUS_STATUS_INVALID_ARGUMENT;
+	}
+
+	ret = wrl_ubus_interface_policy_set(wrl_ubus_config(wrl), tb);
+	if (ret || wrl->staging_active)
+		return ret;
+
 	wrl->full_purge = WRL_PURGE_NONE;
 
+	wrl_schedule_resync(wrl, WRL_CONFIG_SETTLE_INTERVAL);
+
 	return UBUS_STATUS_OK;
 }
 
@@ -408,8 +646,12 @@ wrl_ubus_get_interface_config(struct ubus_context *ctx, struct ubus_object *obj,
 	list_for_each_entry(interface, &wrl->config.interfaces, head) {
 		t = blobmsg_open_table(&b, "interface");
 		blobmsg_add_string(&b, "interface", interface->selectors.interface);
+		blobmsg_add_string(&b, "ssid", interface->selectors.ssid);
 		blobmsg_add_u32(&b, "down", interface->rate.down);
 		blobmsg_add_u32(&b, "up", interface->rate.up);
+		blobmsg_add_u32(&b, "max_clients", interface->max_clients);
+		blobmsg_add_u8(&b, "rebalance", interface->rebalance);
+		blobmsg_add_string(&b, "group", interface->group);
 		blobmsg_close_table(&b, t);
 	}
 	blobmsg_close_array(&b, a);
@@ -419,71 +661,895 @@ wrl_ubus_get_interface_config(struct ubus_context *ctx, struct ubus_object *obj,
 	return UBUS_STATUS_OK;
 }
 
+enum {
+	WRL_UBUS_SET_GROUP_NAME,
+	WRL_UBUS_SET_GROUP_DOWN,
+	WRL_UBUS_SET_GROUP_UP,
+	__WRL_UBUS_SET_GROUP_MAX,
+};
+
+static const struct blobmsg_policy wrl_ubus_set_group_policy[] = {
+	[WRL_UBUS_SET_GROUP_NAME] = { .name = "name", .type = BLOBMSG_TYPE_STRING },
+	[WRL_UBUS_SET_GROUP_DOWN] = { .name = "down", .type = BLOBMSG_TYPE_INT32 },
+	[WRL_UBUS_SET_GROUP_UP] = { .name = "up", .type = BLOBMSG_TYPE_INT32 },
+};
+
+/* Shared by set_group_config and the group policies of set_config */
 static int
-wrl_ubus_get_interface(struct ubus_context *ctx, struct ubus_object *obj,
-		       struct ubus_request_data *req, const char *method,
-		       struct blob_attr *msg)
+wrl_ubus_group_policy_set(struct wrl_config *config, struct blob_attr **tb)
 {
-	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
-	struct wrl_interface *interface;
-	void *a, *t;
+	struct wrl_config_group *group;
+	const char *name;
+	int create;
 
-	blob_buf_init(&b, 0);
+	if (!tb[WRL_UBUS_SET_GROUP_NAME] || !tb[WRL_UBUS_SET_GROUP_DOWN] || !tb[WRL_UBUS_SET_GROUP_UP]) {
+		MSG(ERROR, "Missing arguments\n");
+		return UBUS_STATUS_INVALID_ARGUMENT;
+	}
 
-	a = blobmsg_open_array(&b, "interfaces");
-	list_for_each_entry(interface, &wrl->interfaces, head) {
-		t = blobmsg_open_table(&b, "interface");
-		blobmsg_add_string(&b, "interface", interface->name);
-		blobmsg_add_u32(&b, "down", interface->rate.down);
-		blobmsg_add_u32(&b, "up", interface->rate.up);
-		blobmsg_add_u8(&b, "applied", interface->rate.applied);
-		blobmsg_close_table(&b, t);
+	name = blobmsg_get_string(tb[WRL_UBUS_SET_GROUP_NAME]);
+	if (!wrl_group_name_valid(name)) {
+		MSG(ERROR, "Invalid group name\n");
+		return UBUS_STATUS_INVALID_ARGUMENT;
 	}
-	blobmsg_close_array(&b, a);
 
-	ubus_send_reply(ctx, req, b.head);
+	group = wrl_config_group_get(config, name, &create);
+	if (!group) {
+		MSG(ERROR, "Failed to get group\n");
+		return UBUS_STATUS_UNKNOWN_ERROR;
+	}
+
+	group->rate.down = blobmsg_get_u32(tb[WRL_UBUS_SET_GROUP_DOWN]);
+	group->rate.up = blobmsg_get_u32(tb[WRL_UBUS_SET_GROUP_UP]);
 
 	return UBUS_STATUS_OK;
 }
 
 static int
-wrl_ubus_get_client(struct ubus_context *ctx, struct ubus_object *obj,
-		    struct ubus_request_data *req, const char *method,
-		    struct blob_attr *msg)
+wrl_ubus_set_group_config(struct ubus_context *ctx, struct ubus_object *obj,
+			  struct ubus_request_data *req, const char *method,
+			  struct blob_attr *msg)
 {
 	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
-	struct wrl_interface *interface;
-	struct wrl_client *client;
-	void *a, *t;
+	struct blob_attr *tb[__WRL_UBUS_SET_GROUP_MAX];
+	int ret;
 
-	blob_buf_init(&b, 0);
+	ret = blobmsg_parse(wrl_ubus_set_group_policy, __WRL_UBUS_SET_GROUP_MAX, tb, blob_data(msg), blob_len(msg));
+	if (ret) {
+		MSG(ERROR, "Failed to parse message\n");
+		return UBUS_STATUS_INVALID_ARGUMENT;
+	}
+
+	ret = wrl_ubus_group_policy_set(wrl_ubus_config(wrl), tb);
+	if (ret || wrl->staging_active)
+		return ret;
+
+	wrl->full_purge = WRL_PURGE_NONE;
+
+	wrl_schedule_resync(wrl, WRL_CONFIG_SETTLE_INTERVAL);
+
+	return UBUS_STATUS_OK;
+}
+
+static int
+wrl_ubus_get_group_config(struct ubus_context *ctx, struct ubus_object *obj,
+			  struct ubus_request_data *req, const char *method,
+			  struct blob_attr *msg)
+{
+	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
+	struct wrl_config_group *config_group;
+	struct wrl_group *group;
+	void *a, *t;
+
+	blob_buf_init(&b, 0);
+
+	a = blobmsg_open_array(&b, "group_config");
+	list_for_each_entry(config_group, &wrl->config.groups, head) {
+		group = wrl_group_get(wrl, config_group->name);
+
+		t = blobmsg_open_table(&b, "group");
+		blobmsg_add_string(&b, "name", config_group->name);
+		blobmsg_add_u32(&b, "down", config_group->rate.down);
+		blobmsg_add_u32(&b, "up", config_group->rate.up);
+		blobmsg_add_u32(&b, "members", group ? group->members : 0);
+		blobmsg_add_u8(&b, "installed", group ? group->installed : 0);
+		blobmsg_close_table(&b, t);
+	}
+	blobmsg_close_array(&b, a);
+
+	ubus_send_reply(ctx, req, b.head);
+
+	return UBUS_STATUS_OK;
+}
+
+enum {
+	WRL_UBUS_MAC_ENTRY_MAC,
+	WRL_UBUS_MAC_ENTRY_DOWN,
+	WRL_UBUS_MAC_ENTRY_UP,
+	__WRL_UBUS_MAC_ENTRY_MAX,
+};
+
+static const struct blobmsg_policy wrl_ubus_mac_entry_policy[] = {
+	[WRL_UBUS_MAC_ENTRY_MAC] = { .name = "mac", .type = BLOBMSG_TYPE_STRING },
+	[WRL_UBUS_MAC_ENTRY_DOWN] = { .name = "down", .type = BLOBMSG_TYPE_INT32 },
+	[WRL_UBUS_MAC_ENTRY_UP] = { .name = "up", .type = BLOBMSG_TYPE_INT32 },
+};
+
+static int
+wrl_ubus_mac_entry_parse(struct blob_attr *attr, uint8_t *mac, uint32_t *down, uint32_t *up)
+{
+	struct blob_attr *tb[__WRL_UBUS_MAC_ENTRY_MAX];
+
+	if (blobmsg_type(attr) != BLOBMSG_TYPE_TABLE)
+		return -1;
+
+	blobmsg_parse(wrl_ubus_mac_entry_policy, __WRL_UBUS_MAC_ENTRY_MAX, tb, blobmsg_data(attr), blobmsg_data_len(attr));
+	if (!tb[WRL_UBUS_MAC_ENTRY_MAC] || !tb[WRL_UBUS_MAC_ENTRY_DOWN] || !tb[WRL_UBUS_MAC_ENTRY_UP])
+		return -1;
+
+	if (!wrl_mac_from_string(blobmsg_get_string(tb[WRL_UBUS_MAC_ENTRY_MAC]), mac) || wrl_mac_is_zero(mac))
+		return -1;
+
+	*down = blobmsg_get_u32(tb[WRL_UBUS_MAC_ENTRY_DOWN]);
+	*up = blobmsg_get_u32(tb[WRL_UBUS_MAC_ENTRY_UP]);
+
+	return 0;
+}
+
+static void
+wrl_mac_config_changed(struct wrl_data *wrl)
+{
+	/* Takes effect with the commit */
+	if (wrl->staging_active)
+		return;
+
+	MSG(INFO, "MAC configuration has %u entries (%zu bytes)\n",
+	    wrl->config.macs.num_entries, wrl_mac_table_memory(&wrl->config.macs));
+
+	wrl->full_purge = WRL_PURGE_NONE;
+
+	wrl_schedule_resync(wrl, WRL_CONFIG_SETTLE_INTERVAL);
+}
+
+enum {
+	WRL_UBUS_SET_MAC_MACS,
+	WRL_UBUS_SET_MAC_REPLACE,
+	__WRL_UBUS_SET_MAC_MAX,
+};
+
+static const struct blobmsg_policy wrl_ubus_set_mac_policy[] = {
+	[WRL_UBUS_SET_MAC_MACS] = { .name = "macs", .type = BLOBMSG_TYPE_ARRAY },
+	[WRL_UBUS_SET_MAC_REPLACE] = { .name = "replace", .type = BLOBMSG_TYPE_BOOL },
+};
+
+static int
+wrl_ubus_set_mac_config(struct ubus_context *ctx, struct ubus_object *obj,
+			struct ubus_request_data *req, const char *method,
+			struct blob_attr *msg)
+{
+	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
+	struct blob_attr *tb[__WRL_UBUS_SET_MAC_MAX];
+	struct wrl_mac_table macs, *table;
+	struct blob_attr *cur;
+	uint32_t down, up, num_entries;
+	uint8_t mac[6];
+	int replace;
+	int remaining;
+	int ret;
+
+	ret = blobmsg_parse(wrl_ubus_set_mac_policy, __WRL_UBUS_SET_MAC_MAX, tb, blob_data(msg), blob_len(msg));
+	if (ret || !tb[WRL_UBUS_SET_MAC_MACS]) {
+		MSG(ERROR, "Failed to parse message\n");
+		return UBUS_STATUS_INVALID_ARGUMENT;
+	}
+
+	replace = tb[WRL_UBUS_SET_MAC_REPLACE] && blobmsg_get_bool(tb[WRL_UBUS_SET_MAC_REPLACE]);
+
+	/* Validate everything first, a bulk update is applied entirely or not at all */
+	num_entries = 0;
+	blobmsg_for_each_attr(cur, tb[WRL_UBUS_SET_MAC_MACS], remaining) {
+		if (wrl_ubus_mac_entry_parse(cur, mac, &down, &up)) {
+			MSG(ERROR, "Invalid MAC entry %u\n", num_entries);
+			return UBUS_STATUS_INVALID_ARGUMENT;
+		}
+		num_entries++;
+	}
+
+	/* A replacement is built aside and swapped in */
+	wrl_mac_table_init(&macs);
+	table = replace ? &macs : &wrl_ubus_config(wrl)->macs;
+
+	if (wrl_mac_table_reserve(table, table->num_entries + num_entries))
+		goto error;
+
+	blobmsg_for_each_attr(cur, tb[WRL_UBUS_SET_MAC_MACS], remaining) {
+		wrl_ubus_mac_entry_parse(cur, mac, &down, &up);
+		if (wrl_mac_table_set(table, mac, down, up))
+			goto error;
+	}
+
+	if (replace)
+		wrl_mac_table_swap(&wrl_ubus_config(wrl)->macs, &macs);
+	wrl_mac_table_free(&macs);
+
+	wrl_mac_config_changed(wrl);
+
+	return UBUS_STATUS_OK;
+
+error:
+	MSG(ERROR, "Failed to allocate MAC configuration\n");
+	wrl_mac_table_free(&macs);
+	return UBUS_STATUS_UNKNOWN_ERROR;
+}
+
+enum {
+	WRL_UBUS_DEL_MAC_MACS,
+	__WRL_UBUS_DEL_MAC_MAX,
+};
+
+static const struct blobmsg_policy wrl_ubus_del_mac_policy[] = {
+	[WRL_UBUS_DEL_MAC_MACS] = { .name = "macs", .type = BLOBMSG_TYPE_ARRAY },
+};
+
+static int
+wrl_ubus_del_mac_config(struct ubus_context *ctx, struct ubus_object *obj,
+			struct ubus_request_data *req, const char *method,
+			struct blob_attr *msg)
+{
+	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
+	struct blob_attr *tb[__WRL_UBUS_DEL_MAC_MAX];
+	struct blob_attr *cur;
+	uint8_t mac[6];
+	int remaining;
+	int ret;
+
+	ret = blobmsg_parse(wrl_ubus_del_mac_policy, __WRL_UBUS_DEL_MAC_MAX, tb, blob_data(msg), blob_len(msg));
+	if (ret || !tb[WRL_UBUS_DEL_MAC_MACS]) {
+		MSG(ERROR, "Failed to parse message\n");
+		return UBUS_STATUS_INVALID_ARGUMENT;
+	}
+
+	blobmsg_for_each_attr(cur, tb[WRL_UBUS_DEL_MAC_MACS], remaining) {
+		if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING ||
+		    !wrl_mac_from_string(blobmsg_get_string(cur), mac)) {
+			MSG(ERROR, "Invalid MAC address\n");
+			continue;
+		}
+
+		wrl_mac_table_remove(&wrl_ubus_config(wrl)->macs, mac);
+	}
+
+	wrl_mac_config_changed(wrl);
+
+	return UBUS_STATUS_OK;
+}
+
+enum {
+	WRL_UBUS_LOAD_MAC_PATH,
+	WRL_UBUS_LOAD_MAC_REPLACE,
+	__WRL_UBUS_LOAD_MAC_MAX,
+};
+
+static const struct blobmsg_policy wrl_ubus_load_mac_policy[] = {
+	[WRL_UBUS_LOAD_MAC_PATH] = { .name = "path", .type = BLOBMSG_TYPE_STRING },
+	[WRL_UBUS_LOAD_MAC_REPLACE] = { .name = "replace", .type = BLOBMSG_TYPE_BOOL },
+};
+
+static int
+wrl_ubus_load_mac_config(struct ubus_context *ctx, struct ubus_object *obj,
+			 struct ubus_request_data *req, const char *method,
+			 struct blob_attr *msg)
+{
+	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
+	struct blob_attr *tb[__WRL_UBUS_LOAD_MAC_MAX];
+	struct wrl_mac_table macs;
+	const char *path;
+	int replace;
+	int ret;
+
+	ret = blobmsg_parse(wrl_ubus_load_mac_policy, __WRL_UBUS_LOAD_MAC_MAX, tb, blob_data(msg), blob_len(msg));
+	if (ret || !tb[WRL_UBUS_LOAD_MAC_PATH]) {
+		MSG(ERROR, "Failed to parse message\n");
+		return UBUS_STATUS_INVALID_ARGUMENT;
+	}
+
+	path = blobmsg_get_string(tb[WRL_UBUS_LOAD_MAC_PATH]);
+
+	/* Files replace the table unless asked to merge */
+	replace = !tb[WRL_UBUS_LOAD_MAC_REPLACE] || blobmsg_get_bool(tb[WRL_UBUS_LOAD_MAC_REPLACE]);
+
+	/* A replacement is loaded aside, a broken file leaves the active table untouched */
+	wrl_mac_table_init(&macs);
+
+	ret = wrl_mac_table_load(replace ? &macs : &wrl_ubus_config(wrl)->macs, path);
+	if (ret < 0) {
+		wrl_mac_table_free(&macs);
+		return ret == -ENOENT ? UBUS_STATUS_NOT_FOUND : UBUS_STATUS_UNKNOWN_ERROR;
+	}
+
+	if (replace)
+		wrl_mac_table_swap(&wrl_ubus_config(wrl)->macs, &macs);
+	wrl_mac_table_free(&macs);
+
+	wrl_mac_config_changed(wrl);
+
+	return UBUS_STATUS_OK;
+}
+
+enum {
+	WRL_UBUS_GET_MAC_MAC,
+	__WRL_UBUS_GET_MAC_MAX,
+};
+
+static const struct blobmsg_policy wrl_ubus_get_mac_policy[] = {
+	[WRL_UBUS_GET_MAC_MAC] = { .name = "mac", .type = BLOBMSG_TYPE_STRING },
+};
+
+static int
+wrl_ubus_get_mac_config(struct ubus_context *ctx, struct ubus_object *obj,
+			struct ubus_request_data *req, const char *method,
+			struct blob_attr *msg)
+{
+	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
+	struct blob_attr *tb[__WRL_UBUS_GET_MAC_MAX];
+	struct wrl_mac_table_entry *entry;
+	uint8_t mac[6];
+	void *t;
+
+	blobmsg_parse(wrl_ubus_get_mac_policy, __WRL_UBUS_GET_MAC_MAX, tb, blob_data(msg), blob_len(msg));
+
+	blob_buf_init(&b, 0);
+
+	/* The table is too large for a single reply, only single entries are listed */
+	blobmsg_add_u32(&b, "entries", wrl->config.macs.num_entries);
+	blobmsg_add_u32(&b, "memory", wrl_mac_table_memory(&wrl->config.macs));
+
+	if (tb[WRL_UBUS_GET_MAC_MAC]) {
+		if (!wrl_mac_from_string(blobmsg_get_string(tb[WRL_UBUS_GET_MAC_MAC]), mac))
+			return UBUS_STATUS_INVALID_ARGUMENT;
+
+		entry = wrl_mac_table_get(&wrl->config.macs, mac);
+		if (!entry)
+			return UBUS_STATUS_NOT_FOUND;
+
+		t = blobmsg_open_table(&b, "mac_config");
+		blobmsg_add_string(&b, "mac", wrl_mac_to_string(entry->address, NULL));
+		blobmsg_add_u32(&b, "down", entry->down);
+		blobmsg_add_u32(&b, "up", entry->up);
+		blobmsg_close_table(&b, t);
+	}
+
+	ubus_send_reply(ctx, req, b.head);
+
+	return UBUS_STATUS_OK;
+}
+
+enum {
+	WRL_UBUS_SET_CONFIG_INTERFACES,
+	WRL_UBUS_SET_CONFIG_CLIENTS,
+	WRL_UBUS_SET_CONFIG_MAC_CONFIG,
+	WRL_UBUS_SET_CONFIG_GROUPS,
+	__WRL_UBUS_SET_CONFIG_MAX,
+};
+
+static const struct blobmsg_policy wrl_ubus_set_config_policy[] = {
+	[WRL_UBUS_SET_CONFIG_INTERFACES] = { .name = "interfaces", .type = BLOBMSG_TYPE_ARRAY },
+	[WRL_UBUS_SET_CONFIG_CLIENTS] = { .name = "clients", .type = BLOBMSG_TYPE_ARRAY },
+	[WRL_UBUS_SET_CONFIG_MAC_CONFIG] = { .name = "mac_config", .type = BLOBMSG_TYPE_STRING },
+	[WRL_UBUS_SET_CONFIG_GROUPS] = { .name = "groups", .type = BLOBMSG_TYPE_ARRAY },
+};
+
+static uint32_t
+wrl_ubus_list_count(struct list_head *list)
+{
+	struct list_head *pos;
+	uint32_t count = 0;
+
+	list_for_each(pos, list)
+		count++;
+
+	return count;
+}
+
+/* Only policies resolving to different limits for known interfaces and clients cause operations */
+static void
+wrl_config_committed(struct wrl_data *wrl, uint32_t changes)
+{
+	struct wrl_interface *interface;
+	struct wrl_client *client;
+
+	if (list_empty(&wrl->config.interfaces) && list_empty(&wrl->config.clients) &&
+	    !wrl->config.macs.num_entries) {
+		/* Nothing to enforce, shaping is removed as with clear_config */
+		if (wrl->full_purge == WRL_PURGE_NONE) {
+			wrl->full_purge = WRL_PURGE_PENDING;
+			wrl_schedule_apply(wrl, 0);
+		}
+		return;
+	}
+
+	if (!changes && wrl->full_purge == WRL_PURGE_NONE)
+		return;
+
+	wrl->full_purge = WRL_PURGE_NONE;
+
+	/* Tracked clients are evaluated right away, new ones follow with the next client lists */
+	list_for_each_entry(interface, &wrl->interfaces, head) {
+		wrl_config_interface_update(&wrl->config, interface);
+
+		wrl_client_for_each(client, &interface->clients) {
+			if (client->connected)
+				wrl_config_client_update(&wrl->config, interface, client);
+		}
+	}
+
+	wrl_schedule_apply(wrl, 0);
+}
+
+static void
+wrl_ubus_config_reply(struct ubus_context *ctx, struct ubus_request_data *req,
+		      struct wrl_data *wrl, uint32_t changes)
+{
+	blob_buf_init(&b, 0);
+	blobmsg_add_u32(&b, "changed", changes);
+	blobmsg_add_u32(&b, "interfaces", wrl_ubus_list_count(&wrl->config.interfaces));
+	blobmsg_add_u32(&b, "clients", wrl_ubus_list_count(&wrl->config.clients));
+	blobmsg_add_u32(&b, "macs", wrl->config.macs.num_entries);
+	blobmsg_add_u32(&b, "groups", wrl_ubus_list_count(&wrl->config.groups));
+	ubus_send_reply(ctx, req, b.head);
+}
+
+static int
+wrl_ubus_set_config_stage(struct wrl_config *staging, struct blob_attr **tb)
+{
+	/* Large enough for interface, client and group policies */
+	struct blob_attr *policy_tb[__WRL_UBUS_SET_INTERFACE_MAX];
+	struct blob_attr *cur;
+	int remaining;
+	int ret;
+
+	if (tb[WRL_UBUS_SET_CONFIG_INTERFACES]) {
+		blobmsg_for_each_attr(cur, tb[WRL_UBUS_SET_CONFIG_INTERFACES], remaining) {
+			if (blobmsg_type(cur) != BLOBMSG_TYPE_TABLE ||
+			    blobmsg_parse(wrl_ubus_set_interface_policy, __WRL_UBUS_SET_INTERFACE_MAX, policy_tb,
+					  blobmsg_data(cur), blobmsg_data_len(cur)))
+				return UBUS_STATUS_INVALID_ARGUMENT;
+
+			ret = wrl_ubus_interface_policy_set(staging, policy_tb);
+			if (ret)
+				return ret;
+		}
+	}
+
+	if (tb[WRL_UBUS_SET_CONFIG_CLIENTS]) {
+		blobmsg_for_each_attr(cur, tb[WRL_UBUS_SET_CONFIG_CLIENTS], remaining) {
+			if (blobmsg_type(cur) != BLOBMSG_TYPE_TABLE ||
+			    blobmsg_parse(wrl_ubus_set_client_policy, __WRL_UBUS_SET_CLIENT_MAX, policy_tb,
+					  blobmsg_data(cur), blobmsg_data_len(cur)))
+				return UBUS_STATUS_INVALID_ARGUMENT;
+
+			ret = wrl_ubus_client_policy_set(staging, policy_tb);
+			if (ret)
+				return ret;
+		}
+	}
+
+	if (tb[WRL_UBUS_SET_CONFIG_GROUPS]) {
+		blobmsg_for_each_attr(cur, tb[WRL_UBUS_SET_CONFIG_GROUPS], remaining) {
+			if (blobmsg_type(cur) != BLOBMSG_TYPE_TABLE ||
+			    blobmsg_parse(wrl_ubus_set_group_policy, __WRL_UBUS_SET_GROUP_MAX, policy_tb,
+					  blobmsg_data(cur), blobmsg_data_len(cur)))
+				return UBUS_STATUS_INVALID_ARGUMENT;
+
+			ret = wrl_ubus_group_policy_set(staging, policy_tb);
+			if (ret)
+				return ret;
+		}
+	}
+
+	/* MAC overrides not part of the config are dropped */
+	if (tb[WRL_UBUS_SET_CONFIG_MAC_CONFIG]) {
+		ret = wrl_mac_table_load(&staging->macs, blobmsg_get_string(tb[WRL_UBUS_SET_CONFIG_MAC_CONFIG]));
+		if (ret < 0)
+			return ret == -ENOENT ? UBUS_STATUS_NOT_FOUND : UBUS_STATUS_UNKNOWN_ERROR;
+	}
+
+	return UBUS_STATUS_OK;
+}
+
+static int
+wrl_ubus_set_config(struct ubus_context *ctx, struct ubus_object *obj,
+		    struct ubus_request_data *req, const char *method,
+		    struct blob_attr *msg)
+{
+	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
+	struct blob_attr *tb[__WRL_UBUS_SET_CONFIG_MAX];
+	struct wrl_config staging;
+	uint32_t changes;
+	int ret;
+
+	ret = blobmsg_parse(wrl_ubus_set_config_policy, __WRL_UBUS_SET_CONFIG_MAX, tb, blob_data(msg), blob_len(msg));
+	if (ret) {
+		MSG(ERROR, "Failed to parse message\n");
+		return UBUS_STATUS_INVALID_ARGUMENT;
+	}
+
+	/* The whole config is built aside, an invalid policy leaves the active one untouched */
+	wrl_config_init(&staging);
+
+	ret = wrl_ubus_set_config_stage(&staging, tb);
+	if (ret) {
+		MSG(ERROR, "Rejecting invalid configuration\n");
+		goto out;
+	}
+
+	changes = wrl_config_replace(&wrl->config, &staging);
+	MSG(INFO, "Configuration replaced, %u policies changed\n", changes);
+
+	wrl_config_committed(wrl, changes);
+	wrl_ubus_config_reply(ctx, req, wrl, changes);
+
+out:
+	wrl_config_interface_purge(&staging);
+	wrl_config_client_purge(&staging);
+	wrl_config_mac_purge(&staging);
+	wrl_config_group_purge(&staging);
+
+	return ret;
+}
+
+static int
+wrl_ubus_begin_config(struct ubus_context *ctx, struct ubus_object *obj,
+		      struct ubus_request_data *req, const char *method,
+		      struct blob_attr *msg)
+{
+	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
+
+	/* A staged config never committed is dropped */
+	wrl_config_interface_purge(&wrl->staging);
+	wrl_config_client_purge(&wrl->staging);
+	wrl_config_mac_purge(&wrl->staging);
+	wrl_config_group_purge(&wrl->staging);
+	wrl->staging_active = 1;
+
+	MSG(INFO, "Staging configuration\n");
+
+	return UBUS_STATUS_OK;
+}
+
+static int
+wrl_ubus_commit_config(struct ubus_context *ctx, struct ubus_object *obj,
+		       struct ubus_request_data *req, const char *method,
+		       struct blob_attr *msg)
+{
+	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
+	uint32_t changes;
+
+	if (!wrl->staging_active)
+		return UBUS_STATUS_NO_DATA;
+
+	changes = wrl_config_replace(&wrl->config, &wrl->staging);
+	MSG(INFO, "Configuration committed, %u policies changed\n", changes);
+
+	/* Previous policies were swapped into the staged config */
+	wrl_config_interface_purge(&wrl->staging);
+	wrl_config_client_purge(&wrl->staging);
+	wrl_config_mac_purge(&wrl->staging);
+	wrl_config_group_purge(&wrl->staging);
+	wrl->staging_active = 0;
+
+	wrl_config_committed(wrl, changes);
+	wrl_ubus_config_reply(ctx, req, wrl, changes);
+
+	return UBUS_STATUS_OK;
+}
+
+static void
+wrl_ubus_add_counters(struct blob_buf *buf, const char *name, struct wrl_counters *counters)
+{
+	void *t;
+
+	t = blobmsg_open_table(buf, name);
+	blobmsg_add_u64(buf, "bytes", counters->bytes);
+	blobmsg_add_u64(buf, "packets", counters->packets);
+	blobmsg_add_u32(buf, "drops", counters->drops);
+	blobmsg_add_u32(buf, "overlimits", counters->overlimits);
+	blobmsg_add_u32(buf, "backlog", counters->backlog);
+	blobmsg_add_u32(buf, "rate", counters->rate);
+	blobmsg_close_table(buf, t);
+}
+
+static int
+wrl_ubus_get_interface(struct ubus_context *ctx, struct ubus_object *obj,
+		       struct ubus_request_data *req, const char *method,
+		       struct blob_attr *msg)
+{
+	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
+	struct wrl_interface *interface;
+	void *a, *t;
+
+	blob_buf_init(&b, 0);
+
+	a = blobmsg_open_array(&b, "interfaces");
+	list_for_each_entry(interface, &wrl->interfaces, head) {
+		t = blobmsg_open_table(&b, "interface");
+		blobmsg_add_string(&b, "interface", interface->name);
+		blobmsg_add_string(&b, "ssid", interface->ssid);
+		blobmsg_add_u32(&b, "down", interface->rate.down);
+		blobmsg_add_u32(&b, "up", interface->rate.up);
+		blobmsg_add_u8(&b, "applied", interface->rate.applied);
+		blobmsg_add_u32(&b, "clients", interface->clients.num_clients);
+		blobmsg_add_u32(&b, "max_clients", interface->clients.max_clients);
+		blobmsg_add_u32(&b, "client_memory", wrl_client_table_memory(&interface->clients));
+		blobmsg_add_u8(&b, "rebalance", interface->rebalance);
+		if (interface->group.slot) {
+			blobmsg_add_string(&b, "group", interface->group.name);
+			blobmsg_add_u32(&b, "slot", interface->group.slot);
+		}
+		wrl_ubus_add_counters(&b, "download", &interface->usage.down);
+		wrl_ubus_add_counters(&b, "upload", &interface->usage.up);
+		blobmsg_close_table(&b, t);
+	}
+	blobmsg_close_array(&b, a);
+
+	ubus_send_reply(ctx, req, b.head);
+
+	return UBUS_STATUS_OK;
+}
+
+enum {
+	WRL_UBUS_GET_CLIENT_INTERFACE,
+	WRL_UBUS_GET_CLIENT_ADDRESS,
+	WRL_UBUS_GET_CLIENT_UNAPPLIED,
+	WRL_UBUS_GET_CLIENT_OFFSET,
+	WRL_UBUS_GET_CLIENT_LIMIT,
+	WRL_UBUS_GET_CLIENT_SINCE,
+	__WRL_UBUS_GET_CLIENT_MAX,
+};
+
+static const struct blobmsg_policy wrl_ubus_get_client_policy[] = {
+	[WRL_UBUS_GET_CLIENT_INTERFACE] = { .name = "interface", .type = BLOBMSG_TYPE_STRING },
+	[WRL_UBUS_GET_CLIENT_ADDRESS] = { .name = "address", .type = BLOBMSG_TYPE_STRING },
+	[WRL_UBUS_GET_CLIENT_UNAPPLIED] = { .name = "unapplied", .type = BLOBMSG_TYPE_BOOL },
+	[WRL_UBUS_GET_CLIENT_OFFSET] = { .name = "offset", .type = BLOBMSG_TYPE_INT32 },
+	[WRL_UBUS_GET_CLIENT_LIMIT] = { .name = "limit", .type = BLOBMSG_TYPE_INT32 },
+	[WRL_UBUS_GET_CLIENT_SINCE] = { .name = "since", .type = BLOBMSG_TYPE_INT32 },
+};
+
+static void
+wrl_ubus_client_report(struct wrl_data *wrl)
+{
+	uint32_t generation;
+
+	/* Changes are stamped where they are made, reporting only publishes them */
+	generation = wrl_client_report_publish(wrl->report.reset);
+	if (!generation)
+		return;
+
+	if (wrl->report.reset) {
+		wrl->report.reset = 0;
+		wrl->report.floor = generation;
+	}
+
+	wrl->report.generation = generation;
+}
+
+static int
+wrl_ubus_get_client(struct ubus_context *ctx, struct ubus_object *obj,
+		    struct ubus_request_data *req, const char *method,
+		    struct blob_attr *msg)
+{
+	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
+	struct blob_attr *tb[__WRL_UBUS_GET_CLIENT_MAX];
+	struct wrl_client_removed *removed;
+	struct wrl_interface *interface;
+	struct wrl_client *client;
+	const char *ifname = NULL;
+	uint32_t offset = 0, limit = 0, since = 0;
+	uint32_t i, matched = 0, listed = 0;
+	uint8_t mac[6], unapplied = 0, full;
+	uint8_t *address = NULL;
+	void *a, *t;
+
+	blobmsg_parse(wrl_ubus_get_client_policy, __WRL_UBUS_GET_CLIENT_MAX, tb, blob_data(msg), blob_len(msg));
+
+	if (tb[WRL_UBUS_GET_CLIENT_INTERFACE])
+		ifname = blobmsg_get_string(tb[WRL_UBUS_GET_CLIENT_INTERFACE]);
+
+	if (tb[WRL_UBUS_GET_CLIENT_ADDRESS]) {
+		if (!wrl_mac_from_string(blobmsg_get_string(tb[WRL_UBUS_GET_CLIENT_ADDRESS]), mac))
+			return UBUS_STATUS_INVALID_ARGUMENT;
+		address = mac;
+	}
+
+	if (tb[WRL_UBUS_GET_CLIENT_UNAPPLIED])
+		unapplied = blobmsg_get_bool(tb[WRL_UBUS_GET_CLIENT_UNAPPLIED]);
+	if (tb[WRL_UBUS_GET_CLIENT_OFFSET])
+		offset = blobmsg_get_u32(tb[WRL_UBUS_GET_CLIENT_OFFSET]);
+	if (tb[WRL_UBUS_GET_CLIENT_LIMIT])
+		limit = blobmsg_get_u32(tb[WRL_UBUS_GET_CLIENT_LIMIT]);
+	if (tb[WRL_UBUS_GET_CLIENT_SINCE])
+		since = blobmsg_get_u32(tb[WRL_UBUS_GET_CLIENT_SINCE]);
+
+	wrl_ubus_client_report(wrl);
+
+	/* Releases since then are unknown or the generation is from an earlier instance, start over */
+	full = !since || since < wrl->report.floor || since > wrl->report.generation;
+	list_for_each_entry(interface, &wrl->interfaces, head) {
+		if (since && since < interface->clients.report_floor)
+			full = 1;
+	}
+
+	blob_buf_init(&b, 0);
+	blobmsg_add_u32(&b, "generation", wrl->report.generation);
+	blobmsg_add_u8(&b, "full", full);
 
 	a = blobmsg_open_array(&b, "clients");
 	list_for_each_entry(interface, &wrl->interfaces, head) {
-		for (int i = 0; i < WRL_INTERFACE_NUM_CLIENTS; i++) {
-			client = &interface->clients[i];
-			if (wrl_mac_is_zero(client->address))
+		if (ifname && strcmp(interface->name, ifname))
+			continue;
+
+		wrl_client_for_each(client, &interface->clients) {
+			if (address && memcmp(client->address, address, sizeof(mac)))
+				continue;
+			if (unapplied && client->rate.applied)
+				continue;
+			if (!full && client->reported <= since)
 				continue;
-			
+
+			if (matched++ < offset || (limit && listed >= limit))
+				continue;
+			listed++;
+
 			t = blobmsg_open_table(&b, "client");
 			blobmsg_add_string(&b, "address", wrl_mac_to_string(client->address, NULL));
 			blobmsg_add_string(&b, "interface", interface->name);
 			blobmsg_add_u32(&b, "down", client->rate.down);
 			blobmsg_add_u32(&b, "up", client->rate.up);
 			blobmsg_add_u8(&b, "applied", client->rate.applied);
+			blobmsg_add_u32(&b, "guarantee_down", client->guarantee.down);
+			blobmsg_add_u32(&b, "guarantee_up", client->guarantee.up);
+			blobmsg_add_u32(&b, "airtime", client->airtime.weight);
+			wrl_ubus_add_counters(&b, "download", &client->usage.down);
+			wrl_ubus_add_counters(&b, "upload", &client->usage.up);
 			blobmsg_close_table(&b, t);
 		}
 	}
 	blobmsg_close_array(&b, a);
 
+	blobmsg_add_u32(&b, "total", matched);
+
+	/* Only for incremental queries, to be applied before the clients listed. Sent with the first page only. */
+	if (!full && !offset) {
+		a = blobmsg_open_array(&b, "removed");
+		list_for_each_entry(interface, &wrl->interfaces, head) {
+			if (ifname && strcmp(interface->name, ifname))
+				continue;
+
+			for (i = 0; i < interface->clients.num_removed && i < WRL_CLIENT_REMOVED_MAX; i++) {
+				removed = &interface->clients.removed[i];
+				if (removed->generation <= since)
+					continue;
+				if (address && memcmp(removed->address, address, sizeof(mac)))
+					continue;
+
+				t = blobmsg_open_table(&b, "client");
+				blobmsg_add_string(&b, "address", wrl_mac_to_string(removed->address, NULL));
+				blobmsg_add_string(&b, "interface", interface->name);
+				blobmsg_close_table(&b, t);
+			}
+		}
+		blobmsg_close_array(&b, a);
+	}
+
 	ubus_send_reply(ctx, req, b.head);
 
 	return UBUS_STATUS_OK;
 }
 
+static void
+wrl_ubus_add_histogram(struct blob_buf *buf, const char *name, struct wrl_stats_histogram *histogram)
+{
+	int last = -1;
+	void *t, *a;
+
+	t = blobmsg_open_table(buf, name);
+	blobmsg_add_u32(buf, "count", histogram->count);
+	blobmsg_add_u32(buf, "avg", histogram->count ? histogram->sum / histogram->count : 0);
+	blobmsg_add_u32(buf, "max", histogram->max);
+
+	/* Bucket n counts durations below 2^n usec, trailing empty buckets are omitted */
+	for (int i = 0; i < WRL_STATS_HISTOGRAM_BUCKETS; i++) {
+		if (histogram->buckets[i])
+			last = i;
+	}
+
+	a = blobmsg_open_array(buf, "buckets");
+	for (int i = 0; i <= last; i++)
+		blobmsg_add_u32(buf, NULL, histogram->buckets[i]);
+	blobmsg_close_array(buf, a);
+
+	blobmsg_close_table(buf, t);
+}
+
+enum {
+	WRL_UBUS_GET_STATS_RESET,
+	__WRL_UBUS_GET_STATS_MAX,
+};
+
+static const struct blobmsg_policy wrl_ubus_get_stats_policy[] = {
+	[WRL_UBUS_GET_STATS_RESET] = { .name = "reset", .type = BLOBMSG_TYPE_BOOL },
+};
+
+static int
+wrl_ubus_get_stats(struct ubus_context *ctx, struct ubus_object *obj,
+		   struct ubus_request_data *req, const char *method,
+		   struct blob_attr *msg)
+{
+	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
+	struct blob_attr *tb[__WRL_UBUS_GET_STATS_MAX];
+	struct wrl_interface *interface;
+	void *a, *t;
+
+	blobmsg_parse(wrl_ubus_get_stats_policy, __WRL_UBUS_GET_STATS_MAX, tb, blob_data(msg), blob_len(msg));
+
+	blob_buf_init(&b, 0);
+
+	/* Durations in usec */
+	t = blobmsg_open_table(&b, "stages");
+	for (int i = 0; i < __WRL_STATS_STAGE_MAX; i++)
+		wrl_ubus_add_histogram(&b, wrl_stats_stage_name(i), &wrl_stats.stages[i]);
+	blobmsg_close_table(&b, t);
+
+	t = blobmsg_open_table(&b, "counters");
+	blobmsg_add_u64(&b, "ticks", wrl_stats.counters.ticks);
+	blobmsg_add_u64(&b, "requests", wrl_stats.counters.requests);
+	blobmsg_add_u64(&b, "request_failures", wrl_stats.counters.request_failures);
+	blobmsg_add_u64(&b, "request_timeouts", wrl_stats.counters.request_timeouts);
+	blobmsg_add_u64(&b, "transactions", wrl_stats.counters.transactions);
+	blobmsg_add_u64(&b, "ops", wrl_stats.counters.ops);
+	blobmsg_add_u64(&b, "op_failures", wrl_stats.counters.op_failures);
+	blobmsg_add_u64(&b, "roams", wrl_stats.counters.roams);
+	blobmsg_add_u64(&b, "migrations", wrl_stats.counters.migrations);
+	blobmsg_add_u64(&b, "backend_commands", wrl_stats.counters.backend_commands);
+	blobmsg_add_u64(&b, "backend_failures", wrl_stats.counters.backend_failures);
+	blobmsg_close_table(&b, t);
+
+	/* Shaping work left after the last transaction was built */
+	t = blobmsg_open_table(&b, "queue");
+	blobmsg_add_u32(&b, "interfaces", wrl->queue.pending[WRL_APPLY_PRIO_INTERFACE]);
+	blobmsg_add_u32(&b, "associations", wrl->queue.pending[WRL_APPLY_PRIO_ASSOCIATION]);
+	blobmsg_add_u32(&b, "updates", wrl->queue.pending[WRL_APPLY_PRIO_UPDATE]);
+	blobmsg_add_u32(&b, "removals", wrl->queue.pending[WRL_APPLY_PRIO_REMOVAL]);
+	blobmsg_add_u32(&b, "deferred", wrl->queue.deferred);
+	blobmsg_add_u32(&b, "in_flight", wrl->queue.in_flight);
+	blobmsg_close_table(&b, t);
+
+	a = blobmsg_open_array(&b, "interfaces");
+	list_for_each_entry(interface, &wrl->interfaces, head) {
+		t = blobmsg_open_table(&b, "interface");
+		blobmsg_add_string(&b, "interface", interface->name);
+		wrl_ubus_add_histogram(&b, "enforcement", &interface->enforcement);
+		blobmsg_close_table(&b, t);
+	}
+	blobmsg_close_array(&b, a);
+
+	ubus_send_reply(ctx, req, b.head);
+
+	if (tb[WRL_UBUS_GET_STATS_RESET] && blobmsg_get_bool(tb[WRL_UBUS_GET_STATS_RESET])) {
+		wrl_stats_reset();
+		list_for_each_entry(interface, &wrl->interfaces, head)
+			memset(&interface->enforcement, 0, sizeof(interface->enforcement));
+	}
+
+	return UBUS_STATUS_OK;
+}
 
 static const struct ubus_method wrl_ubus_methods[] = {
 	UBUS_METHOD_NOARG("clear_config", wrl_ubus_clear_config),
+	UBUS_METHOD("set_config", wrl_ubus_set_config, wrl_ubus_set_config_policy),
+	UBUS_METHOD_NOARG("begin_config", wrl_ubus_begin_config),
+	UBUS_METHOD_NOARG("commit_config", wrl_ubus_commit_config),
 
 	UBUS_METHOD("set_client_config", wrl_ubus_set_client_config, wrl_ubus_set_client_policy),
 	UBUS_METHOD_NOARG("get_client_config", wrl_ubus_get_client_config),
@@ -491,8 +1557,17 @@ static const struct ubus_method wrl_ubus_methods[] = {
 	UBUS_METHOD("set_interface_config", wrl_ubus_set_interface_config, wrl_ubus_set_interface_policy),
 	UBUS_METHOD_NOARG("get_interface_config", wrl_ubus_get_interface_config),
 
+	UBUS_METHOD("set_group_config", wrl_ubus_set_group_config, wrl_ubus_set_group_policy),
+	UBUS_METHOD_NOARG("get_group_config", wrl_ubus_get_group_config),
+
+	UBUS_METHOD("set_mac_config", wrl_ubus_set_mac_config, wrl_ubus_set_mac_policy),
+	UBUS_METHOD("del_mac_config", wrl_ubus_del_mac_config, wrl_ubus_del_mac_policy),
+	UBUS_METHOD("load_mac_config", wrl_ubus_load_mac_config, wrl_ubus_load_mac_policy),
+	UBUS_METHOD("get_mac_config", wrl_ubus_get_mac_config, wrl_ubus_get_mac_policy),
+
 	UBUS_METHOD_NOARG("get_interface", wrl_ubus_get_interface),
-	UBUS_METHOD_NOARG("get_client", wrl_ubus_get_client),
+	UBUS_METHOD("get_client", wrl_ubus_get_client, wrl_ubus_get_client_policy),
+	UBUS_METHOD("get_stats", wrl_ubus_get_stats, wrl_ubus_get_stats_policy),
 };
 
 static struct ubus_object_type wrl_ubus_obj_type =
@@ -505,6 +1580,37 @@ struct ubus_object wrl_ubus_obj = {
 	.n_methods = ARRAY_SIZE(wrl_ubus_methods),
 };
 
+enum {
+	WRL_UBUS_OBJECT_ADD_PATH,
+	__WRL_UBUS_OBJECT_ADD_MAX,
+};
+
+static const struct blobmsg_policy wrl_ubus_object_add_policy[] = {
+	[WRL_UBUS_OBJECT_ADD_PATH] = { .name = "path", .type = BLOBMSG_TYPE_STRING },
+};
+
+static void
+wrl_ubus_object_add(struct ubus_context *ctx, struct ubus_event_handler *ev,
+		    const char *type, struct blob_attr *msg)
+{
+	struct wrl_data *wrl = container_of(ctx, struct wrl_data, ubus.ctx);
+	struct blob_attr *tb[__WRL_UBUS_OBJECT_ADD_MAX];
+	const char *path;
+
+	blobmsg_parse(wrl_ubus_object_add_policy, __WRL_UBUS_OBJECT_ADD_MAX, tb, blob_data(msg), blob_len(msg));
+
+	if (!tb[WRL_UBUS_OBJECT_ADD_PATH])
+		return;
+
+	path = blobmsg_get_string(tb[WRL_UBUS_OBJECT_ADD_PATH]);
+	if (strncmp(path, WRL_UBUS_HOSTAPD_PATH, strlen(WRL_UBUS_HOSTAPD_PATH)))
+		return;
+
+	/* Pick up new interfaces without waiting for the next resync */
+	MSG(DEBUG, "Interface %s added to ubus\n", path);
+	wrl_schedule_resync(wrl, 0);
+}
+
 static int
 wrl_ubus_init(struct wrl_data *wrl)
 {
@@ -519,139 +1625,50 @@ wrl_ubus_init(struct wrl_data *wrl)
 	ubus_add_object(&wrl->ubus.ctx, &wrl_ubus_obj);
 	ubus_add_uloop(&wrl->ubus.ctx);
 
+	wrl->ubus.object_add.cb = wrl_ubus_object_add;
+	ubus_register_event_handler(&wrl->ubus.ctx, &wrl->ubus.object_add, "ubus.object.add");
+
 	return 0;
 }
 
 static void
-wrl_rate_apply_interface(struct wrl_interface *interface, uint8_t purge)
+wrl_apply_timeout(struct uloop_timeout *timeout)
 {
-	char command_buffer[512];
-	int tx_rate, rx_rate;
-
-	if (purge) {
-		snprintf(command_buffer, sizeof(command_buffer),
-			 "sh /lib/wireless-rate-limiter/htb-netdev.sh remove %s",
-			 interface->name);
-		wrl_execute_command(command_buffer);
-		return;
-	}
-
-	tx_rate = interface->rate.up;
-	rx_rate = interface->rate.down;
-
-	if (tx_rate == 0)
-		tx_rate = 1 * 1024 * 1024 * 1024;
-	
-	if (rx_rate == 0)
-		rx_rate = 1 * 1024 * 1024 * 1024;
+	struct wrl_data *wrl = container_of(timeout, struct wrl_data, apply);
 
-	snprintf(command_buffer, sizeof(command_buffer),
-		 "sh /lib/wireless-rate-limiter/htb-netdev.sh add %s %dkbit %dkbit",
-		 interface->name, rx_rate, tx_rate);
-	wrl_execute_command(command_buffer);
+	wrl_rate_apply(wrl);
 }
 
 static void
-wrl_rate_apply_client(struct wrl_interface *interface, struct wrl_client *client, int client_id)
+wrl_usage_timeout(struct uloop_timeout *timeout)
 {
-	char command_buffer[512];
-	char mac_string[18];
-	int tx_rate, rx_rate;
-
-	client_id = client->id + 10;
-
-	/* Check if we should remove the rate limit */
-	if (client->rate.down == 0 && client->rate.up == 0) {
-		snprintf(command_buffer, sizeof(command_buffer), "sh /lib/wireless-rate-limiter/htb-client.sh remove %d %s", client_id, interface->name);
-		wrl_execute_command(command_buffer);
-		return;
-	}
-
-	/* Add rate limit */
-	tx_rate = client->rate.up;
-	rx_rate = client->rate.down;
-
-	if (tx_rate == 0)
-		tx_rate = 1 * 1024 * 1024 * 1024;
-	if (rx_rate == 0)
-		rx_rate = 1 * 1024 * 1024 * 1024;
+	struct wrl_data *wrl = container_of(timeout, struct wrl_data, usage);
 
-	wrl_mac_to_string(client->address, mac_string);
+	wrl_usage_update(wrl);
+	wrl_rebalance(wrl);
 
-	snprintf(command_buffer, sizeof(command_buffer), "sh /lib/wireless-rate-limiter/htb-client.sh add %d %s %s %dkbit %dkbit", client_id, interface->name, mac_string, rx_rate, tx_rate);
-	wrl_execute_command(command_buffer);
-}
-
-static void
-wrl_rate_apply(struct wrl_data *wrl)
-{
-	struct wrl_interface *interface;
-	struct wrl_client *client;
-	int i;
-
-	list_for_each_entry(interface, &wrl->interfaces, head) {
-		if (wrl->full_purge == WRL_PURGE_PENDING) {
-			MSG(INFO, "Purge limits for interface %s rx=%dkbit/s tx=%dkbit/s\n",
-			    interface->name, interface->rate.down, interface->rate.up);
-			wrl_rate_apply_interface(interface, 1);
-			interface->rate.applied = 1;
-		} else if (wrl->full_purge == WRL_PURGE_DONE) {
-			/* Do nothing */
-			continue;
-		} else {
-			/* Apply interface rates */
-			if (!interface->rate.applied) {
-				MSG(INFO, "Applying rate for interface %s rx=%dkbit/s tx=%dkbit/s\n",
-				interface->name, interface->rate.down, interface->rate.up);
-				wrl_rate_apply_interface(interface, 0);
-			}
-		}
-
-		/* Apply client rates */
-		for (i = 0; i < WRL_INTERFACE_NUM_CLIENTS; i++) {
-			client = &interface->clients[i];
-			if (wrl_mac_is_zero(client->address))
-				continue;
-			
-			if (interface->rate.applied && client->rate.applied)
-				continue;
-
-			if (wrl->full_purge == WRL_PURGE_PENDING) {
-				/* Interface limits purged, do nothing instead of acking 0 limits */
-				client->rate.applied = 1;
-				continue;
-			}
-
-			MSG(INFO, "Applying rate for client %02x:%02x:%02x:%02x:%02x:%02x, rx=%dkbit/s, tx=%dkbit/s\n",
-			    client->address[0], client->address[1], client->address[2],
-			    client->address[3], client->address[4], client->address[5],
-			    interface->rate.down, interface->rate.up);
-			
-			wrl_rate_apply_client(interface, client, i);
-			client->rate.applied = 1;
-		}
-
-		interface->rate.applied = 1;
-	}
-
-	if (wrl->full_purge == WRL_PURGE_PENDING)
-		wrl->full_purge = WRL_PURGE_DONE;
+	uloop_timeout_set(&wrl->usage, WRL_USAGE_INTERVAL);
 }
 
 static void
 wrl_recurring_work_timeout(struct uloop_timeout *timeout)
 {
 	struct wrl_data *wrl = container_of(timeout, struct wrl_data, recurring);
+	uint64_t start = wrl_stats_now();
 
 	MSG(DEBUG, "Recurring work\n");
+	wrl_stats.counters.ticks++;
 
-	/* Update interface information */
+	/* Update interface information, client lists arrive asynchronously */
 	wrl_ubus_interfaces_update(wrl);
 
-	/* Apply client rate settings */
+	/* Apply interface rate settings, clients follow once all lists arrived */
+	uloop_timeout_cancel(&wrl->apply);
 	wrl_rate_apply(wrl);
 
-	uloop_timeout_set(&wrl->recurring, WRL_RECURRING_WORK_INTERVAL);
+	wrl_stats_stage_done(WRL_STATS_STAGE_TICK, start);
+
+	uloop_timeout_set(&wrl->recurring, WRL_RESYNC_INTERVAL);
 }
 
 
@@ -659,6 +1676,23 @@ int
 main(int argc, char *argv[])
 {
 	struct wrl_data wrl = {0};
+	const char *backend = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:")) != -1) {
+		switch (opt) {
+		case 'b':
+			backend = optarg;
+			break;
+		default:
+#ifdef WRL_BACKEND_BPF
+			fprintf(stderr, "Usage: %s [-b netlink|shell|bpf]\n", argv[0]);
+#else
+			fprintf(stderr, "Usage: %s [-b netlink|shell]\n", argv[0]);
+#endif
+			return 1;
+		}
+	}
 
 	wrl.full_purge = WRL_PURGE_DONE;
 
@@ -666,7 +1700,24 @@ main(int argc, char *argv[])
 	log_level_set(MSG_INFO);
 
 	INIT_LIST_HEAD(&wrl.interfaces);
+	INIT_LIST_HEAD(&wrl.groups);
 	wrl_config_init(&wrl.config);
+	wrl_config_init(&wrl.staging);
+
+	/* Shaping backend */
+	wrl.backend = wrl_backend_get(backend);
+	if (!wrl.backend)
+		return 1;
+
+	if (wrl.backend->init && wrl.backend->init()) {
+		MSG(ERROR, "Failed to initialize %s backend\n", wrl.backend->name);
+		return 1;
+	}
+	MSG(INFO, "Using %s backend\n", wrl.backend->name);
+
+	/* Only kernel state of tc based backends survives a restart */
+	if (wrl.backend->adopt)
+		wrl_snapshot_open(&wrl, WRL_SNAPSHOT_PATH);
 
 	uloop_init();
 
@@ -678,12 +1729,23 @@ main(int argc, char *argv[])
 	ubus_add_uloop(&wrl.ubus.ctx);
 
 	/* Recurring work */
+	wrl.apply.cb = wrl_apply_timeout;
 	wrl.recurring.cb = wrl_recurring_work_timeout;
-	uloop_timeout_set(&wrl.recurring, WRL_RECURRING_WORK_INTERVAL);
+	uloop_timeout_set(&wrl.recurring, 0);
+
+	wrl.usage.cb = wrl_usage_timeout;
+	uloop_timeout_set(&wrl.usage, WRL_USAGE_INTERVAL);
 
 	/* Cya */
 	uloop_run();
 	uloop_done();
 
+	wrl_snapshot_save(&wrl);
+	wrl_snapshot_close();
+
+	if (wrl.backend->deinit)
+		wrl.backend->deinit();
+	wrl_airtime_close();
+
 	return 0;
 }
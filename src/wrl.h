@@ -3,6 +3,7 @@
 #include <libubus.h>
 #include <libubox/uloop.h>
 
+#include "backend.h"
 #include "config.h"
 #include "list.h"
 
@@ -12,15 +13,73 @@ enum wrl_purge_state {
 	WRL_PURGE_NONE = 2,
 };
 
+/* Order in which pending shaping work is handed to the backend */
+enum wrl_apply_priority {
+	/* Client classes hang off the interface tree */
+	WRL_APPLY_PRIO_INTERFACE,
+	/* Newly associated clients are unshaped until added */
+	WRL_APPLY_PRIO_ASSOCIATION,
+	WRL_APPLY_PRIO_UPDATE,
+	/* Departed clients only hold on to their classes */
+	WRL_APPLY_PRIO_REMOVAL,
+	__WRL_APPLY_PRIO_MAX,
+};
+
 struct wrl_data {
 	struct {
 	    struct ubus_context ctx;
+	    struct ubus_event_handler object_add;
+
+	    /* Interfaces with an outstanding request */
+	    int requests_pending;
 	} ubus;
 
+	const struct wrl_backend *backend;
+
 	struct wrl_config config;
 	enum wrl_purge_state full_purge;
 
+	/* Policies set between begin_config and commit_config */
+	struct wrl_config staging;
+	uint8_t staging_active;
+
 	struct uloop_timeout recurring;
+	struct uloop_timeout apply;
+	struct uloop_timeout usage;
+	struct uloop_timeout snapshot;
+
+	/* Shaping changes handed to the backend */
+	struct wrl_transaction transaction;
+	uint8_t transaction_pending;
+	uint64_t transaction_start;
+	uint8_t apply_postponed;
+
+	/* Work found by the last apply, handed over or still queued */
+	struct {
+		uint32_t pending[__WRL_APPLY_PRIO_MAX];
+		uint32_t deferred;
+		uint32_t in_flight;
+	} queue;
+
+	/* Generations of get_client results, for incremental queries */
+	struct {
+		uint32_t generation;
+
+		/* Queries older than this need a full result */
+		uint32_t floor;
+		uint8_t reset;
+	} report;
 
 	struct list_head interfaces;
+
+	/* Groups referenced by interfaces or still installed */
+	struct list_head groups;
 };
+
+/* Shaping changes */
+void wrl_schedule_apply(struct wrl_data *wrl, int timeout);
+void wrl_rate_apply(struct wrl_data *wrl);
+
+/* Class counters */
+void wrl_usage_update(struct wrl_data *wrl);
+void wrl_rebalance(struct wrl_data *wrl);